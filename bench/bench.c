@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Run each stu program given under both allocators, writing the best
+ * wall times and the interpreter's stats for each as JSON.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libstu/stu.h>
+
+#define BENCH_RUNS      3
+#define BENCH_MAX_PATHS 16
+
+typedef struct Bench_allocator {
+    const char *name;
+    int allocator;
+} Bench_allocator;
+
+static const Bench_allocator allocators[] = {
+    { "system", STU_ALLOC_SYSTEM },
+    { "slab",   STU_ALLOC_SLAB   }
+};
+
+#define NUM_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+typedef struct Bench_result {
+    double startup_ms;
+    double eval_ms;
+    int ok;
+    long gcs;
+    long major_gcs;
+    long allocs;
+    long frees;
+    long heap_bytes;
+} Bench_result;
+
+static const char *paths[BENCH_MAX_PATHS];
+static int num_paths = 0;
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Pick the numbers out of the lines written by Stu_dump_stats. */
+static void
+parse_stats(const char *stats, Bench_result *result)
+{
+    for (const char *line = stats; line && *line; ) {
+        if (!strncmp(line, "Number of gcs:", 14))
+            sscanf(line + 14, "%ld (%ld major)", &result->gcs, &result->major_gcs);
+        else if (!strncmp(line, "Number of allocs:", 17))
+            sscanf(line + 17, "%ld", &result->allocs);
+        else if (!strncmp(line, "Number of frees:", 16))
+            sscanf(line + 16, "%ld", &result->frees);
+        else if (!strncmp(line, "Heap bytes:", 11))
+            sscanf(line + 11, "%ld", &result->heap_bytes);
+
+        if ((line = strchr(line, '\n')) != NULL)
+            line++;
+    }
+}
+
+static void
+run(const char *file, int allocator, Bench_result *result)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    double start, started, done;
+    StuVal *val;
+    FILE *out;
+    Stu *stu;
+
+    start = now_ms();
+    stu = Stu_new_with_allocator(allocator);
+    for (int i = 0; i < num_paths; i++)
+        Stu_add_include_path(stu, paths[i]);
+    started = now_ms();
+    val = Stu_eval_file(stu, file);
+    done = now_ms();
+
+    result->startup_ms = started - start;
+    result->eval_ms = done - started;
+
+    /* An error escaping the program counts as a failed run. */
+    if ((out = open_memstream(&buf, &len)) == NULL)
+        err(1, "open_memstream");
+    Stu_dump_val(stu, val, out);
+    fclose(out);
+    result->ok = strncmp(buf, "<err", 4) != 0;
+    free(buf);
+    buf = NULL;
+
+    if ((out = open_memstream(&buf, &len)) == NULL)
+        err(1, "open_memstream");
+    Stu_dump_stats(stu, out);
+    fclose(out);
+    parse_stats(buf, result);
+    free(buf);
+
+    Stu_release_val(stu, val);
+    Stu_destroy(&stu);
+}
+
+static void
+put_name(const char *file)
+{
+    const char *base = strrchr(file, '/');
+    size_t len;
+
+    base = base ? base + 1 : file;
+    len = strlen(base);
+    if (len > 4 && !strcmp(base + len - 4, ".stu"))
+        len -= 4;
+
+    putchar('"');
+    for (size_t i = 0; i < len; i++) {
+        if (base[i] == '"' || base[i] == '\\')
+            putchar('\\');
+        putchar(base[i]);
+    }
+    putchar('"');
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n runs] [-L path] file.stu ...\n", prog);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    Bench_result best, cur;
+    int option, runs = BENCH_RUNS, first = 1;
+
+    while ((option = getopt(argc, argv, "n:L:")) != -1) {
+        switch (option) {
+        case 'n':
+            if ((runs = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+
+        case 'L':
+            if (num_paths == BENCH_MAX_PATHS)
+                errx(1, "too many include paths");
+            paths[num_paths++] = optarg;
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc)
+        usage(argv[0]);
+
+    printf("[");
+    for (int i = optind; i < argc; i++) {
+        for (unsigned a = 0; a < NUM_ALLOCATORS; a++) {
+            memset(&best, 0, sizeof(best));
+            for (int r = 0; r < runs; r++) {
+                memset(&cur, 0, sizeof(cur));
+                run(argv[i], allocators[a].allocator, &cur);
+                if (r == 0 || cur.eval_ms < best.eval_ms)
+                    best = cur;
+            }
+
+            printf("%s\n  {\"bench\": ", first ? "" : ",");
+            put_name(argv[i]);
+            printf(", \"allocator\": \"%s\", \"ok\": %s, \"runs\": %d,"
+                   " \"startup_ms\": %.3f, \"eval_ms\": %.3f,"
+                   " \"gcs\": %ld, \"major_gcs\": %ld, \"allocs\": %ld,"
+                   " \"frees\": %ld, \"heap_bytes\": %ld}",
+                   allocators[a].name, best.ok ? "true" : "false", runs,
+                   best.startup_ms, best.eval_ms, best.gcs, best.major_gcs,
+                   best.allocs, best.frees, best.heap_bytes);
+            fflush(stdout);
+            first = 0;
+        }
+    }
+    printf("\n]\n");
+
+    return 0;
+}
@@ -17,9 +17,36 @@
 #ifndef TEST_DEFINED
 #define TEST_DEFINED
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libstu/stu.h>
+
 #define TEST_START         int __failed = 0
 #define TEST_OK(cond, msg) printf("%s...%s\n", (msg), ((cond) ? "OK" : "FAIL")); \
                            if (!(cond)) __failed++;
 #define TEST_FINISH        return __failed
 
+/* Evaluate buf and compare the dumped result with expected. */
+static inline int
+eval_matches(Stu *stu, const char *buf, const char *expected)
+{
+    char *dumped = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&dumped, &len);
+    StuVal *result = Stu_eval_buf(stu, buf);
+    int matched;
+
+    Stu_dump_val(stu, result, out);
+    Stu_release_val(stu, result);
+    fclose(out);
+
+    if (!(matched = strcmp(dumped, expected) == 0))
+        fprintf(stderr, "got: %s\n", dumped);
+    free(dumped);
+
+    return matched;
+}
+
 #endif
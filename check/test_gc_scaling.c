@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libstu/stu.h>
+#include <libstu/sv.h>
+#include "test.h"
+
+#define SMALL_LIST 1000000
+#define LARGE_LIST 10000000
+
+/*
+ * A list ten times longer may take at most this many times longer to
+ * collect; a collector which was quadratic in the list would take a
+ * hundred times longer.
+ */
+#define MAX_RATIO 25
+
+/*
+ * Build a list of n cells which stays live throughout, returning the time
+ * spent collecting while doing so. Each major collection traces the
+ * whole list built so far.
+ */
+static uint64_t
+build_list(long n, int *intact)
+{
+    Stu *stu = Stu_new();
+    StuMetrics before, after;
+    Sv *xs = NIL;
+    long i, sum;
+
+    Stu_get_metrics(stu, &before);
+    PUSH_SCOPE(stu);
+    for (i = n; i > 0; i--) {
+        xs = Sv_cons(stu, Sv_new_int(stu, i), xs);
+        POP_SCOPE(stu);
+        PUSH_SCOPE(stu);
+        SCOPE_SAVE(stu, xs);
+    }
+    Stu_get_metrics(stu, &after);
+
+    for (i = 0, sum = 0; !IS_NIL(xs); xs = CDR(xs), i++)
+        sum += SV_I(CAR(xs));
+    *intact = i == n && sum == n * (n + 1) / 2
+        && after.gc_major_collections > before.gc_major_collections;
+    POP_SCOPE(stu);
+    Stu_destroy(&stu);
+
+    return after.gc_pause_ns - before.gc_pause_ns;
+}
+
+int
+main(void)
+{
+    uint64_t small, large;
+    int ok;
+
+    TEST_START;
+
+    small = build_list(SMALL_LIST, &ok);
+    TEST_OK(ok, "1M cell list collected");
+    large = build_list(LARGE_LIST, &ok);
+    TEST_OK(ok, "10M cell list collected");
+
+    fprintf(stderr, "collecting: %.3fs for 1M cells, %.3fs for 10M\n",
+            small / 1e9, large / 1e9);
+    ok = large <= small * MAX_RATIO;
+    TEST_OK(ok, "collection time linear in the list");
+
+    TEST_FINISH;
+}
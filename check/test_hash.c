@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <err.h>
 
 #include <libstu/hash.h>
@@ -34,6 +35,8 @@
 #define TEST_VAL4 "test value 4"
 #define TEST_VAL5 "test value 5"
 
+#define BENCH_KEYS 1000000
+
 void
 destroy(Hash_ent *entry, void *arg)
 {
@@ -131,5 +134,59 @@ main(void)
     /* Destroy the hash. */
     Hash_destroy(&hash);
 
+    /* Keys are not limited in length. */
+    char long_key[1024];
+    memset(long_key, 'k', sizeof(long_key) - 1);
+    long_key[sizeof(long_key) - 1] = '\0';
+    hash = Hash_new(NULL, NULL);
+    Hash_put(hash, long_key, (void *) 1);
+    long_key[sizeof(long_key) - 2] = 'x';
+    Hash_put(hash, long_key, (void *) 2);
+    TEST_OK((HASH_NUM_ENTRIES(hash) == 2), "Long keys differing at the end are distinct");
+    TEST_OK((Hash_get(hash, long_key)->v == (void *) 2), "Long key found");
+    Hash_destroy(&hash);
+
+    /* Time a large table, checking every key survives growth and deletion. */
+    char bench_key[32];
+    long found = 0, missing = 0;
+    clock_t start = clock();
+
+    hash = Hash_new(NULL, NULL);
+    for (long n = 0; n < BENCH_KEYS; n++) {
+        snprintf(bench_key, sizeof(bench_key), "symbol-%ld", n);
+        Hash_put(hash, bench_key, (void *) n);
+    }
+    clock_t inserted = clock();
+
+    for (long n = 0; n < BENCH_KEYS; n++) {
+        snprintf(bench_key, sizeof(bench_key), "symbol-%ld", n);
+        cur = Hash_get(hash, bench_key);
+        if (cur && cur->v == (void *) n)
+            found++;
+    }
+    clock_t looked_up = clock();
+
+    for (long n = 0; n < BENCH_KEYS; n += 2) {
+        snprintf(bench_key, sizeof(bench_key), "symbol-%ld", n);
+        Hash_del(hash, bench_key);
+    }
+    for (long n = 0; n < BENCH_KEYS; n++) {
+        snprintf(bench_key, sizeof(bench_key), "symbol-%ld", n);
+        cur = Hash_get(hash, bench_key);
+        if ((cur == NULL) != (n % 2 == 0))
+            missing++;
+    }
+    clock_t deleted = clock();
+
+    TEST_OK((found == BENCH_KEYS), "All benchmark keys found");
+    TEST_OK((HASH_NUM_ENTRIES(hash) == BENCH_KEYS / 2), "Half the benchmark keys deleted");
+    TEST_OK((missing == 0), "Only the deleted benchmark keys are missing");
+    printf("%d keys: insert %.3fs, lookup %.3fs, delete and lookup %.3fs\n",
+           BENCH_KEYS,
+           (double) (inserted - start) / CLOCKS_PER_SEC,
+           (double) (looked_up - inserted) / CLOCKS_PER_SEC,
+           (double) (deleted - looked_up) / CLOCKS_PER_SEC);
+    Hash_destroy(&hash);
+
     TEST_FINISH;
 }
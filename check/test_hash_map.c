@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libstu/stu.h>
+#include "test.h"
+
+static const char *prelude =
+    "(def h (make-hash 'a 1 \"str\" 2 3/4 'q))\n"
+    "(def fill (lambda (i) (hash-put h i (list i)) (if (= i 0) h (fill (- i 1)))))\n"
+    "(fill 1000)\n"
+    "(hash-del h 'a)\n"
+    "(def churn (lambda (n acc) (if (= n 0) (length acc) (churn (- n 1) (cons n acc)))))\n";
+
+static const char *program =
+    "(list (hash-get h \"str\") (hash-get h 3/4) (hash-get h 500) (hash-has? h 'a)"
+    " (hash-count h) (car (hash-keys h)))";
+
+static const char *expected = "(2 q (500) #f 1003 \"str\")";
+
+int
+main(void)
+{
+    char image[] = "/tmp/test_hash_map.XXXXXX";
+    StuEnv *env = NULL;
+    StuVal *result;
+    Stu *stu, *loaded;
+    int fd, ok;
+
+    TEST_START;
+
+    if ((fd = mkstemp(image)) < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    stu = Stu_new();
+    result = Stu_eval_buf_in_env(stu, prelude, Stu_main_env(stu), &env);
+    Stu_update_main_env(stu, env);
+    Stu_release_val(stu, result);
+
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "hash filled");
+    Stu_release_val(stu, Stu_eval_buf(stu, "(churn 5000 nil)"));
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "entries survive collection");
+    ok = Stu_save_image(stu, image) == 0;
+    TEST_OK(ok, "image saved");
+    Stu_destroy(&stu);
+
+    /* Keys hashed by value must still be found in the loaded heap. */
+    loaded = Stu_new_from_image(image);
+    TEST_OK(loaded != NULL, "image loaded");
+    if (loaded) {
+        ok = eval_matches(loaded, program, expected);
+        TEST_OK(ok, "loaded hash has its entries");
+        ok = eval_matches(loaded, "(hash-get (hash-put h \"new\" 7) \"new\")", "7");
+        TEST_OK(ok, "loaded hash added to");
+        Stu_destroy(&loaded);
+    }
+
+    unlink(image);
+
+    TEST_FINISH;
+}
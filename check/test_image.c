@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libstu/stu.h>
+#include "test.h"
+
+static const char *prelude =
+    "(deftype point x y)\n"
+    "(def origin (point 3 4))\n"
+    "(def range (lambda (n acc) (if (= n 0) acc (range (- n 1) (cons n acc)))))\n"
+    "(def pair (cons 'a))\n"
+    "(def misc [1/3 2.5 \"str\" 5000000000000000000])\n"
+    "(def re #/^a+b$/)\n";
+
+static const char *macro = "(defmacro twice (x) `(list ,x ,x))";
+
+static const char *program =
+    "(list (range 5 nil) origin::y (type-of origin) (pair 'b) misc"
+    " (re-match? re \"aab\") (twice 7))";
+
+static const char *expected =
+    "((1 2 3 4 5) 4 point (a . b) [1/3 2.5000000000 \"str\" 5000000000000000000]"
+    " #t (7 7))";
+
+int
+main(void)
+{
+    char image[] = "/tmp/test_image.XXXXXX";
+    StuEnv *env = NULL;
+    StuVal *result;
+    Stu *stu, *loaded;
+    int fd, ok;
+    FILE *junk;
+
+    TEST_START;
+
+    if ((fd = mkstemp(image)) < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    stu = Stu_new();
+    result = Stu_eval_buf_in_env(stu, prelude, Stu_main_env(stu), &env);
+    Stu_update_main_env(stu, env);
+    Stu_release_val(stu, result);
+    Stu_release_val(stu, Stu_eval_buf(stu, macro));
+
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "prelude evaluated");
+    ok = Stu_save_image(stu, image) == 0;
+    TEST_OK(ok, "image saved");
+    Stu_destroy(&stu);
+
+    loaded = Stu_new_from_image(image);
+    TEST_OK(loaded != NULL, "image loaded");
+    if (loaded) {
+        ok = eval_matches(loaded, program, expected);
+        TEST_OK(ok, "loaded interpreter has the prelude");
+        Stu_set_eval_mode(loaded, STU_EVAL_TREE);
+        ok = eval_matches(loaded, program, expected);
+        TEST_OK(ok, "tree-walker agrees");
+        ok = eval_matches(loaded, "(car (reverse (range 2000 nil)))", "2000");
+        TEST_OK(ok, "loaded heap survives collection");
+        Stu_destroy(&loaded);
+    }
+
+    /* Anything other than an image is refused. */
+    if ((junk = fopen(image, "w")) != NULL) {
+        fputs("(def not-an-image 1)\n", junk);
+        fclose(junk);
+    }
+    loaded = Stu_new_from_image(image);
+    TEST_OK(loaded == NULL, "junk refused");
+    loaded = Stu_new_from_image("/nonexistent/image");
+    TEST_OK(loaded == NULL, "missing image refused");
+
+    unlink(image);
+
+    TEST_FINISH;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libstu/stu.h>
+#include "test.h"
+
+static const char *program =
+    "(defun count (n) (if (= n 0) 0 (count (- n 1))))\n"
+    "(defmacro twice (x) `(list ,x ,x))\n"
+    "(count 100)\n"
+    "(twice 1)\n";
+
+int
+main(void)
+{
+    StuMetrics before, after;
+    Stu *stu;
+    int ok;
+
+    TEST_START;
+
+    stu = Stu_new();
+    Stu_get_metrics(stu, &before);
+    Stu_release_val(stu, Stu_eval_buf(stu, program));
+    ok = eval_matches(stu, "(try (throw 'oops) (lambda (e) (car e)))", "oops");
+    TEST_OK(ok, "exception caught");
+    Stu_get_metrics(stu, &after);
+
+    ok = after.calls >= before.calls + 100;
+    TEST_OK(ok, "calls counted");
+    ok = after.macro_expansions > before.macro_expansions;
+    TEST_OK(ok, "macro expansions counted");
+    ok = after.exceptions == before.exceptions + 1;
+    TEST_OK(ok, "exceptions counted");
+    ok = after.env_lookups > before.env_lookups
+        && after.env_lookup_steps >= after.env_lookups;
+    TEST_OK(ok, "lookups counted");
+    ok = after.values.allocs > before.values.allocs
+        && after.gc_allocs > before.gc_allocs
+        && after.heap_bytes > 0 && after.objects > 0;
+    TEST_OK(ok, "allocations counted");
+    ok = after.gc_pause_max_ns <= after.gc_pause_ns
+        && after.scope_depth_max >= after.scope_depth;
+    TEST_OK(ok, "maxima consistent");
+
+    ok = eval_matches(stu, "(type-of (runtime-stats))", "runtime-stats");
+    TEST_OK(ok, "runtime-stats structure made");
+    ok = eval_matches(
+        stu, "(def s (runtime-stats)) (list (> s::calls 0) s::exceptions)",
+        "(#t 1)");
+    TEST_OK(ok, "runtime-stats fields read");
+    Stu_destroy(&stu);
+
+    TEST_FINISH;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libstu/stu.h>
+#include "test.h"
+
+static const char *module =
+    "(deftype pt x y)\n"
+    "(def p (pt 1 2))\n"
+    "(def data (lambda () '(1 2.5 3/4 \"s\" [1 sym \"x\"] (a . b) #t nil)))\n"
+    "(def acc p::y)\n"
+    "(def big (lambda () `(0 ,acc ,@(data))))\n"
+    "(def re #/^x/i)\n";
+
+static const char *changed = "(def acc 3)\n";
+
+static const char *program =
+    "(def m (import \"mod.stu\"))\n"
+    "(list (m::big) (re-match? m::re \"XY\"))";
+
+static const char *expected =
+    "((0 2 1 2.5000000000 3/4 \"s\" [1 sym \"x\"] (a . b) #t nil) #t)";
+
+static void
+write_file(const char *dir, const char *name, const char *contents)
+{
+    char path[strlen(dir) + strlen(name) + 2];
+    FILE *out;
+
+    sprintf(path, "%s/%s", dir, name);
+    if ((out = fopen(path, "w")) != NULL) {
+        fputs(contents, out);
+        fclose(out);
+    }
+}
+
+/* Apply f to each file in dir, returning how many there were. */
+static int
+each_file(const char *dir, void (*f)(const char *, const char *))
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int n = 0;
+
+    while (d && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] != '.') {
+            if (f)
+                f(dir, e->d_name);
+            n++;
+        }
+    }
+    if (d)
+        closedir(d);
+
+    return n;
+}
+
+static void
+corrupt_file(const char *dir, const char *name)
+{
+    write_file(dir, name, "STUFORMS and then nonsense");
+}
+
+static void
+remove_file(const char *dir, const char *name)
+{
+    char path[strlen(dir) + strlen(name) + 2];
+
+    sprintf(path, "%s/%s", dir, name);
+    unlink(path);
+}
+
+static Stu
+*new_stu(const char *src, const char *cache)
+{
+    Stu *stu = Stu_new();
+
+    Stu_add_include_path(stu, src);
+    Stu_set_module_cache(stu, cache);
+
+    return stu;
+}
+
+int
+main(void)
+{
+    char src[] = "/tmp/test_mod_src.XXXXXX";
+    char cache[] = "/tmp/test_mod_cache.XXXXXX";
+    Stu *stu;
+    int ok;
+
+    TEST_START;
+
+    if (mkdtemp(src) == NULL || mkdtemp(cache) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    write_file(src, "mod.stu", module);
+
+    stu = new_stu(src, cache);
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "module imported");
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "module imported again");
+    ok = each_file(cache, NULL) == 1;
+    TEST_OK(ok, "parsed forms cached");
+    Stu_destroy(&stu);
+
+    stu = new_stu(src, cache);
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "module imported from cached forms");
+
+    /* A changed file is imported afresh, both in and across interpreters. */
+    write_file(src, "mod.stu", changed);
+    ok = eval_matches(stu, "(def m (import \"mod.stu\")) m::acc", "3");
+    TEST_OK(ok, "changed module imported again");
+    Stu_destroy(&stu);
+
+    stu = new_stu(src, cache);
+    ok = eval_matches(stu, "(def m (import \"mod.stu\")) m::acc", "3");
+    TEST_OK(ok, "stale forms ignored");
+    Stu_destroy(&stu);
+
+    /* Bad cache files are reparsed, and replaced. */
+    write_file(src, "mod.stu", module);
+    each_file(cache, corrupt_file);
+    stu = new_stu(src, cache);
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "corrupt forms ignored");
+    Stu_destroy(&stu);
+
+    stu = new_stu(src, "/nonexistent/cache");
+    ok = eval_matches(stu, program, expected);
+    TEST_OK(ok, "missing cache directory ignored");
+    Stu_destroy(&stu);
+
+    each_file(cache, remove_file);
+    each_file(src, remove_file);
+    rmdir(cache);
+    rmdir(src);
+
+    TEST_FINISH;
+}
@@ -28,12 +28,13 @@ main(void)
 
     TEST_START;
 
-    TEST_OK((unsigned long) NIL == 0, "NIL is initially NULL");
-
-    Stu *stu1 = Stu_new();
     TEST_OK((unsigned long) NIL != 0, "NIL is not NULL");
+    TEST_OK(NIL == Sv_nil, "Sv_nil is NIL");
     nil_addr = (unsigned long) NIL;
 
+    Stu *stu1 = Stu_new();
+    TEST_OK((unsigned long) NIL == nil_addr, "NIL unchanged by Stu_new");
+
     Stu *stu2 = Stu_new();
     TEST_OK((unsigned long) NIL != 0, "NIL is still not NULL");
     TEST_OK((unsigned long) NIL == nil_addr, "NIL was preserved");
@@ -42,7 +43,7 @@ main(void)
     TEST_OK((unsigned long) NIL == nil_addr, "NIL preserved after destroy");
 
     Stu_destroy(&stu2);
-    TEST_OK((unsigned long) NIL == 0, "NIL has been cleaned up");
+    TEST_OK((unsigned long) NIL == nil_addr, "NIL preserved after last destroy");
 
     TEST_FINISH;
 }
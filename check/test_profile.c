@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libstu/stu.h>
+#include "test.h"
+
+#define MAX_ROUNDS 200
+
+static const char *program =
+    "(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n"
+    "(fib 18)";
+
+/*
+ * Check each line is a stack of frames followed by a count, returning
+ * the total count, or -1 if a line is malformed.
+ */
+static long
+count_samples(char *profile, const char *frame, int *seen)
+{
+    long total = 0, n;
+    char *line, *count, *end;
+
+    for (line = strtok(profile, "\n"); line; line = strtok(NULL, "\n")) {
+        if ((count = strrchr(line, ' ')) == NULL)
+            return -1;
+        n = strtol(count + 1, &end, 10);
+        if (*end != '\0' || n <= 0 || strchr(line, ' ') != count)
+            return -1;
+        if (strstr(line, frame))
+            *seen = 1;
+        total += n;
+    }
+
+    return total;
+}
+
+int
+main(void)
+{
+    Stu *stu = Stu_new(), *other = Stu_new();
+    char *profile = NULL;
+    size_t len = 0;
+    long total = 0;
+    int ok, seen = 0;
+    FILE *out;
+
+    TEST_START;
+
+    ok = Stu_profile_start(stu, 1000) == 0;
+    TEST_OK(ok, "profiler started");
+    ok = Stu_profile_start(other, 1000) == -1;
+    TEST_OK(ok, "one interpreter profiled at a time");
+
+    /* Run until at least a sample has been taken. */
+    for (int i = 0; i < MAX_ROUNDS && !seen; i++) {
+        Stu_release_val(stu, Stu_eval_buf(stu, program));
+        out = open_memstream(&profile, &len);
+        Stu_profile_stop(stu, out);
+        fclose(out);
+        Stu_profile_start(stu, 1000);
+        total = count_samples(profile, "<TOPLEVEL>;fib;fib", &seen);
+        free(profile);
+        profile = NULL;
+        if (total < 0)
+            break;
+    }
+    TEST_OK(total >= 0, "collapsed stacks written");
+    TEST_OK(seen, "samples taken in fib");
+
+    Stu_profile_stop(stu, NULL);
+    ok = Stu_profile_start(other, 0) == 0;
+    TEST_OK(ok, "another interpreter profiled once stopped");
+    Stu_profile_stop(other, NULL);
+
+    Stu_destroy(&stu);
+    Stu_destroy(&other);
+
+    TEST_FINISH;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libstu/stu.h>
+#include "test.h"
+
+#define MIN_THREADS 2
+#define MAX_THREADS 16
+#define ROUNDS      20
+
+static const char *program =
+    "(defun range (n acc) (if (= n 0) acc (range (- n 1) (cons n acc))))\n"
+    "(defun sum (xs acc) (if (= xs nil) acc (sum (cdr xs) (+ acc (car xs)))))\n"
+    "(list (sum (range 2000 nil) 0) 1/3 \"str\" 'sym [1 2] (type-of 1.5))";
+
+static const char *expected = "(2001000 1/3 \"str\" sym [1 2] float)";
+
+/*
+ * Each thread creates, uses and destroys its own interpreters, returning
+ * the number of rounds which went wrong.
+ */
+static void
+*run(void *arg)
+{
+    long failed = 0;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        Stu *stu = Stu_new();
+        char *dumped = NULL;
+        size_t len = 0;
+        FILE *out = open_memstream(&dumped, &len);
+
+        StuVal *result = Stu_eval_buf(stu, program);
+        Stu_dump_val(stu, result, out);
+        Stu_release_val(stu, result);
+        fclose(out);
+
+        if (strcmp(dumped, expected) != 0
+            || Stu_is_valid_form(stu, "(list 1 '[a b") != -1)
+            failed++;
+
+        free(dumped);
+        Stu_destroy(&stu);
+    }
+
+    return (void *) failed;
+}
+
+int
+main(void)
+{
+    pthread_t threads[MAX_THREADS];
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN), failed = 0;
+    void *thread_failed;
+    int started;
+
+    TEST_START;
+
+    if (num_threads < MIN_THREADS)
+        num_threads = MIN_THREADS;
+    if (num_threads > MAX_THREADS)
+        num_threads = MAX_THREADS;
+
+    for (long i = 0; i < num_threads; i++) {
+        started = pthread_create(&threads[i], NULL, run, NULL) == 0;
+        TEST_OK(started, "thread started");
+    }
+
+    for (long i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], &thread_failed);
+        failed += (long) thread_failed;
+    }
+
+    TEST_OK(failed == 0, "interpreters on separate threads agree");
+    TEST_OK(NIL == Sv_nil, "Sv_nil is NIL");
+
+    TEST_FINISH;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libstu/stu.h>
+#include <libstu/vector.h>
+#include "test.h"
+
+#define NUM_VALUES 40000
+#define NUM_VERSIONS 40
+#define NUM_SETS 2000
+
+/* Stand-ins for values, which the vectors only store. */
+#define VAL(i) ((struct Sv *) (((long) (i) << 1) | 1))
+
+static int
+matches(Sv_vector *vec, struct Sv **expected, long length)
+{
+    struct Sv **values;
+    long i, j, n;
+
+    if (vec->length != length)
+        return 0;
+    for (i = 0; i < length; i++)
+        if (Vector_at(vec, i) != expected[i])
+            return 0;
+    for (i = 0; i < length; i += n) {
+        values = Vector_chunk(vec, i, &n);
+        for (j = 0; j < n; j++)
+            if (values[j] != expected[i + j])
+                return 0;
+    }
+
+    return 1;
+}
+
+int
+main(void)
+{
+    static const long sizes[] = { 0, 1, 31, 32, 33, 64, 65, 1024, 1056, 1057, 33825 };
+    struct Sv **expected = malloc(NUM_VALUES * sizeof(*expected));
+    Sv_vector *versions[NUM_VERSIONS], *vec, *next;
+    StuMetrics before, after;
+    long i, v, ok;
+    Stu *stu;
+
+    TEST_START;
+
+    stu = Stu_new();
+    for (i = 0; i < NUM_VALUES; i++)
+        expected[i] = VAL(i);
+    Stu_get_metrics(stu, &before);
+
+    for (i = 0, ok = 1; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        vec = Vector_new(stu, sizes[i], expected);
+        ok = ok && matches(vec, expected, sizes[i]);
+        Vector_release(stu, vec);
+    }
+    TEST_OK(ok, "vectors made from arrays");
+
+    /* Keep some of the versions made on the way, which must not change. */
+    vec = Vector_new(stu, 0, NULL);
+    for (i = 0, v = 0; i < NUM_VALUES; i++) {
+        next = Vector_push(stu, vec, expected[i]);
+        if (i % (NUM_VALUES / NUM_VERSIONS) == 0)
+            versions[v++] = vec;
+        else
+            Vector_release(stu, vec);
+        vec = next;
+    }
+    ok = matches(vec, expected, NUM_VALUES);
+    TEST_OK(ok, "vector appended to");
+    for (i = 0, ok = 1; i < NUM_VERSIONS; i++)
+        ok = ok && matches(versions[i], expected, i * (NUM_VALUES / NUM_VERSIONS));
+    TEST_OK(ok, "earlier versions unchanged");
+
+    srandom(1);
+    for (i = 0; i < NUM_SETS; i++) {
+        v = random() % NUM_VALUES;
+        next = Vector_set(stu, vec, v, VAL(-i));
+        ok = Vector_at(next, v) == VAL(-i) && Vector_at(vec, v) == expected[v];
+        expected[v] = VAL(-i);
+        Vector_release(stu, vec);
+        vec = next;
+        if (!ok)
+            break;
+    }
+    TEST_OK(ok, "values set");
+    ok = matches(vec, expected, NUM_VALUES);
+    TEST_OK(ok, "vector set");
+
+    Vector_release(stu, vec);
+    for (i = 0; i < NUM_VERSIONS; i++)
+        Vector_release(stu, versions[i]);
+    Stu_get_metrics(stu, &after);
+    ok = after.payloads.allocs - before.payloads.allocs
+        == after.payloads.releases - before.payloads.releases;
+    TEST_OK(ok, "nodes all released");
+
+    Stu_destroy(&stu);
+    free(expected);
+
+    TEST_FINISH;
+}
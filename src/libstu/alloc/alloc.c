@@ -22,6 +22,7 @@
 #include "alloc.h"
 #include "alloc_sys.h"
 #include "alloc_slab.h"
+#include "alloc_class.h"
 
 extern Alloc
 *Alloc_new(Stu *stu, size_t size, enum Alloc_type type)
@@ -49,6 +50,22 @@ extern Alloc
     return new;
 }
 
+/*
+ * Create an allocator for variable sized blocks, which keeps a pool of
+ * the given type for each of its size classes.
+ */
+extern Alloc
+*Alloc_new_classes(Stu *stu, enum Alloc_type type)
+{
+    Alloc base;
+
+    memset(&base, 0, sizeof(base));
+    base.type = ALLOC_TYPE_CLASS;
+    base.stu = stu;
+
+    return AllocClass_new(base, type);
+}
+
 extern void
 Alloc_destroy(Alloc **to_destroy)
 {
@@ -67,11 +84,28 @@ Alloc_destroy(Alloc **to_destroy)
 extern void
 *Alloc_allocate(Alloc *allocator)
 {
+    allocator->allocs++;
     return allocator->allocate(allocator);
 }
 
+extern void
+*Alloc_allocate_size(Alloc *allocator, size_t size)
+{
+    allocator->allocs++;
+    return allocator->allocate_size(allocator, size);
+}
+
 extern void
 Alloc_release(Alloc *allocator, void *to_release)
 {
+    allocator->releases++;
     allocator->release(allocator, to_release);
 }
+
+/* Give unused memory back to the system, if the allocator holds any. */
+extern void
+Alloc_trim(Alloc *allocator)
+{
+    if (allocator->trim != NULL)
+        allocator->trim(allocator);
+}
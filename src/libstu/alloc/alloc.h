@@ -18,10 +18,12 @@
 #define ALLOC_DEFINED
 
 #include <stddef.h>
+#include <stdint.h>
 
 enum Alloc_type {
     ALLOC_TYPE_SYS,
-    ALLOC_TYPE_SLAB
+    ALLOC_TYPE_SLAB,
+    ALLOC_TYPE_CLASS
 };
 
 typedef struct Stu Stu;
@@ -31,14 +33,22 @@ struct Alloc {
     enum Alloc_type type;
     Stu *stu;
     size_t size;
+    size_t heap_bytes; /* Memory currently held from the system. */
+    uint64_t allocs;
+    uint64_t releases;
     void (*destroy)(Alloc *);
     void *(*allocate)(Alloc *);
+    void *(*allocate_size)(Alloc *, size_t);
     void (*release)(Alloc *, void *);
+    void (*trim)(Alloc *);
 };
 
 extern Alloc *Alloc_new(Stu *, size_t, enum Alloc_type);
+extern Alloc *Alloc_new_classes(Stu *, enum Alloc_type);
 extern void Alloc_destroy(Alloc **);
 extern void *Alloc_allocate(Alloc *);
+extern void *Alloc_allocate_size(Alloc *, size_t);
 extern void Alloc_release(Alloc *, void *);
+extern void Alloc_trim(Alloc *);
 
 #endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <err.h>
+
+#include "config.h"
+#include "alloc.h"
+#include "alloc_class.h"
+
+/*
+ * Variable sized blocks are rounded up to one of these size classes,
+ * each served by its own fixed size allocator. Anything bigger goes
+ * straight to the system. The sizes include the block header.
+ */
+static const size_t class_sizes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
+
+#define NUM_CLASSES (sizeof(class_sizes) / sizeof(class_sizes[0]))
+#define LARGE_CLASS NUM_CLASSES
+#define CLASS_GRAIN 16
+#define MAX_CLASS_SIZE 1024
+
+/* Each block is preceded by the class it was allocated from. */
+typedef struct Block {
+    size_t class;
+    size_t size;
+} Block;
+
+/* Size class allocator child class. */
+typedef struct AllocClass {
+    Alloc base;
+    Alloc *classes[NUM_CLASSES];
+
+    /* The class for each multiple of CLASS_GRAIN up to MAX_CLASS_SIZE. */
+    unsigned char class_of[MAX_CLASS_SIZE / CLASS_GRAIN + 1];
+} AllocClass;
+
+extern Alloc
+*AllocClass_new(Alloc base, enum Alloc_type type)
+{
+    AllocClass *new = NULL;
+
+    if ((new = calloc(1, sizeof(*new))) == NULL)
+        err(1, "AllocClass_new");
+
+    new->base = base;
+    new->base.allocate_size = AllocClass_allocate_size;
+    new->base.release = AllocClass_release;
+    new->base.destroy = AllocClass_destroy;
+    new->base.trim = AllocClass_trim;
+
+    for (size_t i = 0, j = 0; i <= MAX_CLASS_SIZE / CLASS_GRAIN; i++) {
+        while (class_sizes[j] < i * CLASS_GRAIN)
+            j++;
+        new->class_of[i] = j;
+    }
+
+    for (size_t i = 0; i < NUM_CLASSES; i++)
+        new->classes[i] = Alloc_new(base.stu, class_sizes[i], type);
+
+    return (Alloc *) new;
+}
+
+extern void
+AllocClass_destroy(Alloc *base)
+{
+    AllocClass *allocator = (AllocClass *) base;
+
+    for (size_t i = 0; i < NUM_CLASSES; i++)
+        Alloc_destroy(&allocator->classes[i]);
+}
+
+extern void
+*AllocClass_allocate_size(Alloc *base, size_t size)
+{
+    AllocClass *allocator = (AllocClass *) base;
+    size_t i, total = sizeof(Block) + size;
+    Block *block = NULL;
+
+    if (total <= MAX_CLASS_SIZE) {
+        i = allocator->class_of[(total + CLASS_GRAIN - 1) / CLASS_GRAIN];
+        block = Alloc_allocate(allocator->classes[i]);
+        base->heap_bytes += class_sizes[i];
+    } else {
+        i = LARGE_CLASS;
+        if ((block = calloc(1, total)) == NULL)
+            err(1, "AllocClass_allocate_size");
+        base->heap_bytes += total;
+    }
+    block->class = i;
+    block->size = total;
+
+    return block + 1;
+}
+
+extern void
+AllocClass_release(Alloc *base, void *to_release)
+{
+    AllocClass *allocator = (AllocClass *) base;
+    Block *block = NULL;
+
+    if (to_release == NULL)
+        return;
+
+    block = ((Block *) to_release) - 1;
+    if (block->class == LARGE_CLASS) {
+        base->heap_bytes -= block->size;
+        free(block);
+    } else {
+        base->heap_bytes -= class_sizes[block->class];
+        Alloc_release(allocator->classes[block->class], block);
+    }
+}
+
+extern void
+AllocClass_trim(Alloc *base)
+{
+    AllocClass *allocator = (AllocClass *) base;
+
+    for (size_t i = 0; i < NUM_CLASSES; i++)
+        Alloc_trim(allocator->classes[i]);
+}
@@ -14,53 +14,108 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
-#include <limits.h>
 
 #include "config.h"
 #include "alloc.h"
 #include "alloc_slab.h"
 
-#define INITIAL_NUM_SLABS 5
+#define CHUNK_ALIGN 8
 
+/*
+ * Empty slabs are given back once more than a quarter of the slabs are
+ * empty, keeping this many in reserve so that a program hovering around
+ * a slab boundary does not map and unmap one on every collection.
+ */
+#define SLAB_KEEP_EMPTY 1
+
+/*
+ * Each slab is a power of two sized block aligned to its own size, with
+ * this header at the start followed by the chunks. The slab owning a
+ * chunk is found by masking the chunk's address.
+ */
 typedef struct Slab {
-    int *free_list;
-    void *chunks;
-    int free_list_head;
-    int chunk_head;
+    struct AllocSlab *allocator;
+    struct Slab *next;
+    long used;
+    int releasing;
 } Slab;
 
+/* A released chunk holds the link to the next free chunk. */
+typedef struct Chunk {
+    struct Chunk *next;
+} Chunk;
+
 /* Slab allocator child class. */
 typedef struct AllocSlab {
     Alloc base;
     Slab *slabs;
-    int num_slabs;
-    int used_slabs;
-    int slab_size;
+    Slab *fresh_slab;
+    Chunk *free_list;
+    char *fresh;
+    char *fresh_end;
+    size_t chunk_size;
+    size_t slab_bytes;
+    long num_slabs;
+    long empty_slabs;
 } AllocSlab;
 
+#define SLAB_HEADER_SIZE \
+    ((sizeof(Slab) + CHUNK_ALIGN - 1) & ~((size_t) CHUNK_ALIGN - 1))
+#define SLAB_OF(a, p) \
+    ((Slab *) ((uintptr_t) (p) & ~((uintptr_t) (a)->slab_bytes - 1)))
+
+/* Map a slab aligned to its size, by trimming an oversized mapping. */
+static void
+*map_slab(size_t bytes)
+{
+    char *mem, *aligned;
+    size_t head, tail;
+
+    mem = mmap(NULL, 2 * bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        err(1, "map_slab; could not map slab");
+
+    aligned = (char *) (((uintptr_t) mem + bytes - 1) & ~((uintptr_t) bytes - 1));
+    head = aligned - mem;
+    tail = bytes - head;
+    if (head > 0)
+        munmap(mem, head);
+    if (tail > 0)
+        munmap(aligned + bytes, tail);
+
+    return aligned;
+}
+
 static void
-init_slab(AllocSlab *allocator, Slab *slab)
+next_slab(AllocSlab *allocator)
 {
-    slab->chunk_head = -1;
-    slab->chunks = malloc(
-        allocator->slab_size * allocator->base.size);
-    if (slab->chunks == NULL)
-        err(1, "init_slab; could not allocate slab chunks");
-
-    slab->free_list_head = -1;
-    slab->free_list = malloc(
-        allocator->slab_size * sizeof(*slab->free_list));
-    if (slab->free_list == NULL)
-        err(1, "init_slab; could not allocate free list");
+    Slab *slab = map_slab(allocator->slab_bytes);
+
+    slab->allocator = allocator;
+    slab->used = 0;
+    slab->releasing = 0;
+    slab->next = allocator->slabs;
+    allocator->slabs = slab;
+    allocator->fresh_slab = slab;
+    allocator->num_slabs++;
+    allocator->empty_slabs++;
+    allocator->base.heap_bytes += allocator->slab_bytes;
+
+    allocator->fresh = (char *) slab + SLAB_HEADER_SIZE;
+    allocator->fresh_end = (char *) slab + allocator->slab_bytes;
 }
 
 extern Alloc
 *AllocSlab_new(Alloc base)
 {
     AllocSlab *new = NULL;
+    size_t wanted;
 
     if ((new = calloc(1, sizeof(*new))) == NULL)
         err(1, "AllocSlab_new");
@@ -69,150 +124,130 @@ extern Alloc
     new->base.allocate = AllocSlab_allocate;
     new->base.release = AllocSlab_release;
     new->base.destroy = AllocSlab_destroy;
+    new->base.trim = AllocSlab_trim;
+
+    /* Chunks must be able to hold a free list link. */
+    new->chunk_size = base.size < sizeof(Chunk) ? sizeof(Chunk) : base.size;
+    new->chunk_size = (new->chunk_size + CHUNK_ALIGN - 1)
+        & ~((size_t) CHUNK_ALIGN - 1);
 
-    new->used_slabs = 0;
-    new->num_slabs = INITIAL_NUM_SLABS;
-    new->slab_size = SLAB_SIZE;
-    new->slabs = calloc(new->num_slabs, sizeof(*(new->slabs)));
-    if (new->slabs == NULL)
-        err(1, "AllocSlab_new; could not allocate slabs");
+    /* Room for at least SLAB_SIZE chunks, rounded up to a power of two. */
+    wanted = SLAB_HEADER_SIZE + SLAB_SIZE * new->chunk_size;
+    for (new->slab_bytes = 4096; new->slab_bytes < wanted; new->slab_bytes *= 2)
+        ;
 
     /* Create a slab up front. */
-    init_slab(new, &new->slabs[new->used_slabs++]);
+    next_slab(new);
 
     return (Alloc *) new;
 }
 
-static void
-free_slab(Slab *slab)
-{
-    free(slab->chunks);
-    free(slab->free_list);
-}
-
 extern void
 AllocSlab_destroy(Alloc *base)
 {
     AllocSlab *allocator = (AllocSlab *) base;
-    int i;
+    Slab *slab = allocator->slabs, *next = NULL;
 
-    for (i = 0; i < allocator->used_slabs; i++)
-        free_slab(&allocator->slabs[i]);
-
-    free(allocator->slabs);
-}
-
-static Slab
-*next_slab(AllocSlab *allocator)
-{
-    Slab *slab = NULL;
-
-    if (allocator->used_slabs == allocator->num_slabs) {
-        allocator->num_slabs *= 2;
-        allocator->slabs = realloc(allocator->slabs,
-            allocator->num_slabs * sizeof(*(allocator->slabs)));
-        if (allocator->slabs == NULL)
-            err(1, "next_slab; could not re-allocate slabs");
+    while (slab) {
+        next = slab->next;
+        munmap(slab, allocator->slab_bytes);
+        slab = next;
     }
 
-    slab = &allocator->slabs[allocator->used_slabs++];
-    init_slab(allocator, slab);
-
-    return slab;
+    allocator->slabs = NULL;
+    allocator->base.heap_bytes = 0;
 }
 
-static void
-*next_chunk(AllocSlab *allocator, Slab *slab)
+extern void
+*AllocSlab_allocate(Alloc *base)
 {
-    int i;
-    unsigned long start = (unsigned long) slab->chunks;
+    AllocSlab *allocator = (AllocSlab *) base;
     void *chunk = NULL;
+    Slab *slab = NULL;
 
-    if (slab->free_list_head >= 0) {
+    if (allocator->free_list) {
         /* From the free list. */
-        i = slab->free_list[slab->free_list_head--];
-        chunk = (void *) (start + (i * allocator->base.size));
-    } else if (slab->chunk_head < (allocator->slab_size - 1)) {
-        /* From the unallocated chunks. */
-        slab->chunk_head += 1;
-        chunk = (void *) (start + (slab->chunk_head * allocator->base.size));
+        chunk = allocator->free_list;
+        allocator->free_list = allocator->free_list->next;
+    } else {
+        /* From the unallocated chunks, making a new slab if needed. */
+        if (allocator->fresh + allocator->chunk_size > allocator->fresh_end)
+            next_slab(allocator);
+        chunk = allocator->fresh;
+        allocator->fresh += allocator->chunk_size;
     }
 
-    if (chunk)
-        memset(chunk, 0, allocator->base.size);
+    slab = SLAB_OF(allocator, chunk);
+    if (slab->used++ == 0)
+        allocator->empty_slabs--;
+
+    memset(chunk, 0, allocator->base.size);
 
     return chunk;
 }
 
 extern void
-*AllocSlab_allocate(Alloc *base)
+AllocSlab_release(Alloc *base, void *to_release)
 {
     AllocSlab *allocator = (AllocSlab *) base;
-    void *chunk = NULL;
+    Chunk *chunk = to_release;
     Slab *slab = NULL;
-    int i;
-
-    for (i = 0; i < allocator->used_slabs; i++) {
-        if ((chunk = next_chunk(allocator, &allocator->slabs[i])) != NULL)
-            return chunk;
-    }
 
-    /* No available chunks in allocated slabs, make a new slab. */
-    slab = next_slab(allocator);
-
-    return next_chunk(allocator, slab);
-}
-
-static int
-in_slab(AllocSlab *allocator, Slab *slab, void *chunk)
-{
-    unsigned long start, end, query;
+    if (to_release == NULL)
+        return;
 
-    query = (unsigned long) chunk;
-    start = (unsigned long) slab->chunks;
-    end = start + (allocator->slab_size - 1) * allocator->base.size;
-
-    return query >= start && query <= end;
-}
-
-static Slab
-*find_slab(AllocSlab *allocator, void *chunk)
-{
-    int i;
-
-    for (i = 0; i < allocator->used_slabs; i++) {
-        if (in_slab(allocator, &allocator->slabs[i], chunk))
-            return &allocator->slabs[i];
+    slab = SLAB_OF(allocator, to_release);
+    if (slab->allocator != allocator) {
+        warnx("Chunk 0x%lx not found in any slabs, ignoring",
+              (unsigned long) to_release);
+        return;
     }
 
-    return NULL;
-}
-
-static void
-release_chunk(AllocSlab *allocator, Slab *slab, void *chunk)
-{
-    int i = (((unsigned long) chunk) - ((unsigned long) slab->chunks))
-        / allocator->base.size;
-
-    if (i > 0
-        && i < allocator->slab_size
-        && slab->free_list_head < (allocator->slab_size - 1))
-    {
-        /* Save the index of the freed chunk. */
-        slab->free_list[++slab->free_list_head] = i;
-    }
+    chunk->next = allocator->free_list;
+    allocator->free_list = chunk;
+    if (--slab->used == 0)
+        allocator->empty_slabs++;
 }
 
+/*
+ * Unmap empty slabs. Their chunks are spread through the free list,
+ * which is rebuilt without them, so this is only done once enough slabs
+ * are empty to be worth the pass.
+ */
 extern void
-AllocSlab_release(Alloc *base, void *to_release)
+AllocSlab_trim(Alloc *base)
 {
     AllocSlab *allocator = (AllocSlab *) base;
-    Slab *slab = NULL;
+    Slab *slab = NULL, **link = NULL;
+    Chunk *chunk = NULL, **chunk_link = NULL;
+    long to_release = allocator->empty_slabs - SLAB_KEEP_EMPTY;
+
+    if (to_release <= 0 || allocator->empty_slabs * 4 <= allocator->num_slabs)
+        return;
+
+    for (slab = allocator->slabs; slab && to_release > 0; slab = slab->next) {
+        if (slab->used == 0 && slab != allocator->fresh_slab) {
+            slab->releasing = 1;
+            to_release--;
+        }
+    }
 
-    if ((slab = find_slab(allocator, to_release)) != NULL) {
-        release_chunk(allocator, slab, to_release);
-    } else {
-        warnx("Chunk 0x%lx not found in any slabs, ignoring",
-              (unsigned long) to_release);
+    for (chunk_link = &allocator->free_list; (chunk = *chunk_link) != NULL; ) {
+        if (SLAB_OF(allocator, chunk)->releasing)
+            *chunk_link = chunk->next;
+        else
+            chunk_link = &chunk->next;
+    }
+
+    for (link = &allocator->slabs; (slab = *link) != NULL; ) {
+        if (slab->releasing) {
+            *link = slab->next;
+            munmap(slab, allocator->slab_bytes);
+            allocator->num_slabs--;
+            allocator->empty_slabs--;
+            allocator->base.heap_bytes -= allocator->slab_bytes;
+        } else {
+            link = &slab->next;
+        }
     }
 }
@@ -23,5 +23,6 @@ extern Alloc *AllocSlab_new(Alloc);
 extern void AllocSlab_destroy(Alloc *);
 extern void *AllocSlab_allocate(Alloc *);
 extern void AllocSlab_release(Alloc *, void *);
+extern void AllocSlab_trim(Alloc *);
 
 #endif
@@ -37,6 +37,7 @@ extern Alloc
     new->allocate = AllocSys_allocate;
     new->release = AllocSys_release;
     new->destroy = NULL;
+    new->trim = NULL;
 
     return new;
 }
@@ -48,6 +49,7 @@ extern void
 
     if ((block = calloc(1, allocator->size)) == NULL)
         err(1, "AllocSys_allocate");
+    allocator->heap_bytes += allocator->size;
 
     return block;
 }
@@ -55,5 +57,8 @@ extern void
 extern void
 AllocSys_release(Alloc *allocator, void *to_release)
 {
-    free(to_release);
+    if (to_release) {
+        free(to_release);
+        allocator->heap_bytes -= allocator->size;
+    }
 }
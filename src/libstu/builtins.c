@@ -15,6 +15,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +31,7 @@
 #include "types.h"
 #include "call_stack.h"
 #include "mod.h"
+#include "symtab.h"
 
 typedef enum {
   INTEGER,
@@ -37,40 +39,157 @@ typedef enum {
   REAL
 } value_type;
 
-#define DEF(name, func, nargs, rest) Sv_native_func_register((stu), (name), (func), (nargs), (rest))
+/*
+ * The fields of the structures made by runtime-stats, in order, with the
+ * counter each one holds.
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+} metric_fields[] = {
+    { "value-allocs", offsetof(StuMetrics, values.allocs) },
+    { "value-releases", offsetof(StuMetrics, values.releases) },
+    { "value-bytes", offsetof(StuMetrics, values.bytes) },
+    { "env-allocs", offsetof(StuMetrics, envs.allocs) },
+    { "env-releases", offsetof(StuMetrics, envs.releases) },
+    { "env-bytes", offsetof(StuMetrics, envs.bytes) },
+    { "special-allocs", offsetof(StuMetrics, specials.allocs) },
+    { "special-releases", offsetof(StuMetrics, specials.releases) },
+    { "special-bytes", offsetof(StuMetrics, specials.bytes) },
+    { "lambda-allocs", offsetof(StuMetrics, lambdas.allocs) },
+    { "lambda-releases", offsetof(StuMetrics, lambdas.releases) },
+    { "lambda-bytes", offsetof(StuMetrics, lambdas.bytes) },
+    { "code-allocs", offsetof(StuMetrics, code.allocs) },
+    { "code-releases", offsetof(StuMetrics, code.releases) },
+    { "code-bytes", offsetof(StuMetrics, code.bytes) },
+    { "payload-allocs", offsetof(StuMetrics, payloads.allocs) },
+    { "payload-releases", offsetof(StuMetrics, payloads.releases) },
+    { "payload-bytes", offsetof(StuMetrics, payloads.bytes) },
+    { "heap-bytes", offsetof(StuMetrics, heap_bytes) },
+    { "objects", offsetof(StuMetrics, objects) },
+    { "gc-allocs", offsetof(StuMetrics, gc_allocs) },
+    { "gc-frees", offsetof(StuMetrics, gc_frees) },
+    { "gc-collections", offsetof(StuMetrics, gc_collections) },
+    { "gc-major-collections", offsetof(StuMetrics, gc_major_collections) },
+    { "gc-pause-ns", offsetof(StuMetrics, gc_pause_ns) },
+    { "gc-pause-max-ns", offsetof(StuMetrics, gc_pause_max_ns) },
+    { "scope-depth", offsetof(StuMetrics, scope_depth) },
+    { "scope-depth-max", offsetof(StuMetrics, scope_depth_max) },
+    { "env-lookups", offsetof(StuMetrics, env_lookups) },
+    { "env-lookup-steps", offsetof(StuMetrics, env_lookup_steps) },
+    { "calls", offsetof(StuMetrics, calls) },
+    { "macro-expansions", offsetof(StuMetrics, macro_expansions) },
+    { "exceptions", offsetof(StuMetrics, exceptions) },
+};
+
+#define NUM_METRIC_FIELDS (sizeof(metric_fields) / sizeof(*metric_fields))
+
+extern Sv
+*Builtin_runtime_stats(Stu *stu, Env *env, Sv **args)
+{
+    StuMetrics metrics;
+    Sv *fields = NIL, *vals = NIL;
+    uint64_t value;
+
+    if (stu->metrics_type == 0) {
+        for (long i = NUM_METRIC_FIELDS - 1; i >= 0; i--)
+            fields = Sv_cons(stu, Sv_new_sym(stu, metric_fields[i].name), fields);
+        stu->metrics_type = Type_new(
+            stu, Sv_new_sym(stu, "runtime-stats"), Sv_new_vector(stu, fields));
+    }
+
+    Stu_get_metrics(stu, &metrics);
+    for (long i = NUM_METRIC_FIELDS - 1; i >= 0; i--) {
+        memcpy(&value, (char *) &metrics + metric_fields[i].offset, sizeof(value));
+        vals = Sv_cons(stu, Sv_new_int(stu, (long) value), vals);
+    }
+
+    return Sv_new_structure(stu, stu->metrics_type, vals);
+}
+
 #define DEFAULT SV_NATIVE_FUNC_DEFAULT
 #define REST SV_NATIVE_FUNC_REST
 #define PURE SV_NATIVE_FUNC_PURE
 #define MACRO SV_NATIVE_FUNC_MACRO
+
+/*
+ * Every native function, in the order registered. Images refer to native
+ * functions by their position here.
+ */
+static const Builtin builtins[] = {
+    { "+", Builtin_add, 1, REST | PURE },
+    { "-", Builtin_sub, 1, REST | PURE },
+    { "*", Builtin_mul, 1, REST | PURE },
+    { "/", Builtin_div, 1, REST | PURE },
+    { "cons", Builtin_cons, 2, PURE },
+    { "list", Builtin_list, 1, REST | PURE },
+    { "macroexpand-1", Builtin_macroexpand_1, 1, DEFAULT },
+    { "macroexpand", Builtin_macroexpand, 1, DEFAULT },
+    { "eval", Builtin_eval, 1, DEFAULT },
+    { "car", Builtin_car, 1, PURE },
+    { "cdr", Builtin_cdr, 1, PURE },
+    { "reverse", Builtin_reverse, 1, PURE },
+    { "read", Builtin_read, 1, DEFAULT },
+    { "print", Builtin_print, 1, DEFAULT },
+    { "=", Builtin_eq, 1, REST | PURE },
+    { ">", Builtin_gt, 1, REST | PURE },
+    { "<", Builtin_lt, 1, REST | PURE },
+    { ">=", Builtin_gte, 1, REST | PURE },
+    { "<=", Builtin_lte, 1, REST | PURE },
+    { "at", Builtin_at, 2, PURE },
+    { "type-of", Builtin_type_of, 1, PURE },
+    { "re-match?", Builtin_re_match_p, 2, PURE },
+    { "re-match", Builtin_re_match, 2, PURE },
+    { "throw", Builtin_throw, 1, DEFAULT },
+    { "vector-length", Builtin_vector_length, 1, PURE },
+    { "import", Builtin_import, 1, DEFAULT },
+    { "runtime-stats", Builtin_runtime_stats, 0, DEFAULT },
+    { "length", Builtin_length, 1, PURE },
+    { "map", Builtin_map, 2, DEFAULT },
+    { "filter", Builtin_filter, 2, DEFAULT },
+    { "foldl", Builtin_foldl, 3, DEFAULT },
+    { "foldr", Builtin_foldr, 3, DEFAULT },
+    { "append", Builtin_append, 1, REST | PURE },
+    { "nth", Builtin_nth, 2, PURE },
+    { "last", Builtin_last, 1, PURE },
+    { "vector-append", Builtin_vector_append, 2, PURE },
+    { "vector-set", Builtin_vector_set, 3, PURE },
+    { "make-hash", Builtin_make_hash, 1, REST },
+    { "hash-get", Builtin_hash_get, 2, DEFAULT },
+    { "hash-has?", Builtin_hash_has_p, 2, DEFAULT },
+    { "hash-put", Builtin_hash_put, 3, DEFAULT },
+    { "hash-del", Builtin_hash_del, 2, DEFAULT },
+    { "hash-count", Builtin_hash_count, 1, DEFAULT },
+    { "hash-keys", Builtin_hash_keys, 1, DEFAULT },
+    { "hash-values", Builtin_hash_values, 1, DEFAULT },
+    { "hash-each", Builtin_hash_each, 2, DEFAULT },
+};
+
+#define NUM_BUILTINS (sizeof(builtins) / sizeof(*builtins))
+
 extern void
 Builtin_init(Stu *stu)
 {
-    DEF("+", Builtin_add, 1, REST | PURE);
-    DEF("-", Builtin_sub, 1, REST | PURE);
-    DEF("*", Builtin_mul, 1, REST | PURE);
-    DEF("/", Builtin_div, 1, REST | PURE);
-    DEF("cons", Builtin_cons, 2, PURE);
-    DEF("list", Builtin_list, 1, REST | PURE);
-    DEF("macroexpand-1", Builtin_macroexpand_1, 1, DEFAULT);
-    DEF("macroexpand", Builtin_macroexpand, 1, DEFAULT);
-    DEF("eval", Builtin_eval, 1, DEFAULT);
-    DEF("car", Builtin_car, 1, PURE);
-    DEF("cdr", Builtin_cdr, 1, PURE);
-    DEF("reverse", Builtin_reverse, 1, PURE);
-    DEF("read", Builtin_read, 1, DEFAULT);
-    DEF("print", Builtin_print, 1, DEFAULT);
-    DEF("=", Builtin_eq, 1, REST | PURE);
-    DEF(">", Builtin_gt, 1, REST | PURE);
-    DEF("<", Builtin_lt, 1, REST | PURE);
-    DEF(">=", Builtin_gte, 1, REST | PURE);
-    DEF("<=", Builtin_lte, 1, REST | PURE);
-    DEF("at", Builtin_at, 2, PURE);
-    DEF("type-of", Builtin_type_of, 1, PURE);
-    DEF("re-match?", Builtin_re_match_p, 2, PURE);
-    DEF("re-match", Builtin_re_match, 2, PURE);
-    DEF("throw", Builtin_throw, 1, DEFAULT);
-    DEF("vector-length", Builtin_vector_length, 1, PURE);
-    DEF("import", Builtin_import, 1, DEFAULT);
+    for (long i = 0; i < NUM_BUILTINS; i++)
+        Sv_native_func_register(
+            stu, builtins[i].name, builtins[i].func, builtins[i].nargs,
+            builtins[i].flags);
+}
+
+extern const Builtin
+*Builtin_get(long i)
+{
+    return i >= 0 && i < NUM_BUILTINS ? &builtins[i] : NULL;
+}
+
+extern long
+Builtin_index(Sv_native_func_t func)
+{
+    for (long i = 0; i < NUM_BUILTINS; i++)
+        if (builtins[i].func == func)
+            return i;
+
+    return -1;
 }
 
 #define INIT_ACC(init) value_type acc_type = INTEGER, cur_type = INTEGER; \
@@ -79,10 +198,10 @@ Builtin_init(Stu *stu)
                        long acc = (init), i; \
                        racc.n = 0; racc.d = 0;
 
-#define SET_ACC(op) switch (cur->type) { \
+#define SET_ACC(op) switch (SV_TYPE(cur)) { \
                     case SV_INT: \
                         cur_type = INTEGER; \
-                        i = cur->val.i; \
+                        i = SV_I(cur); \
                         break; \
                     case SV_RATIONAL: \
                         if (acc_type == REAL) { \
@@ -344,7 +463,7 @@ extern Sv
 *Builtin_car(Stu *stu, Env *env, Sv **args)
 {
     Sv *x = *args;
-    if (x->type != SV_CONS)
+    if (SV_TYPE(x) != SV_CONS)
         return Sv_new_err(stu, "'car' needs a single list argument");
     return CAR(x);
 }
@@ -353,7 +472,7 @@ extern Sv
 *Builtin_cdr(Stu *stu, Env *env, Sv **args)
 {
     Sv *x = *args;
-    if (x->type != SV_CONS)
+    if (SV_TYPE(x) != SV_CONS)
         return Sv_new_err(stu, "'cdr' needs a single list argument");
     return CDR(x);
 }
@@ -362,7 +481,7 @@ extern Sv
 *Builtin_reverse(Stu *stu, Env *env, Sv **args)
 {
     Sv *x = *args;
-    if (x->type != SV_CONS && x->type != SV_NIL)
+    if (SV_TYPE(x) != SV_CONS && SV_TYPE(x) != SV_NIL)
         return Sv_new_err(stu, "'reverse' needs a single list argument");
     return Sv_reverse(stu, x);
 }
@@ -373,7 +492,7 @@ extern Sv
     Sv *code = *x, *result = NULL;
     Sv *forms = NIL;
 
-    if (code->type != SV_STR || code->val.buf == NULL)
+    if (SV_TYPE(code) != SV_STR || code->val.buf == NULL)
         return Sv_new_err(stu, "read expects a string argument");
 
     forms = Stu_parse_buf(stu, code->val.buf);
@@ -410,15 +529,15 @@ extern Sv
     if (!x && !y) return Sv_new_bool(stu, 1);    \
     if (x && y) { \
         while (!IS_NIL(rest) && (y = CAR(rest))) { \
-            if (x->type == y->type) { \
-                switch (x->type) { \
+            if (SV_TYPE(x) == SV_TYPE(y)) { \
+                switch (SV_TYPE(x)) { \
                     case SV_NIL: \
                         result = 1; \
                         break; \
                     case SV_INT: \
                     case SV_BOOL: \
                     case SV_SYM: \
-                        result = result && compare_numbers(op, x->val.i, y->val.i); \
+                        result = result && compare_numbers(op, SV_I(x), SV_I(y)); \
                         break; \
                     case SV_RATIONAL: \
                         result = result && compare_rationals(op, x->val.rational, y->val.rational); \
@@ -430,10 +549,10 @@ extern Sv
                     default: \
                         return Sv_new_err(stu, "'eq' does not support these types"); \
                 } \
-            } else if (x->type == SV_INT && x->type == SV_RATIONAL) { \
-                result = result && compare_numbers(op, x->val.i * y->val.rational.d, y->val.rational.n); \
-            } else if (y->type == SV_INT && x->type == SV_RATIONAL) { \
-                result = result && compare_numbers(op, x->val.rational.n, y->val.i * x->val.rational.d); \
+            } else if (SV_TYPE(x) == SV_INT && SV_TYPE(x) == SV_RATIONAL) { \
+                result = result && compare_numbers(op, SV_I(x) * y->val.rational.d, y->val.rational.n); \
+            } else if (SV_TYPE(y) == SV_INT && SV_TYPE(x) == SV_RATIONAL) { \
+                result = result && compare_numbers(op, x->val.rational.n, SV_I(y) * x->val.rational.d); \
             } else { \
                 return Sv_new_bool(stu, 0);      \
             } \
@@ -537,7 +656,7 @@ extern Sv
 *Builtin_vector_length(Stu *stu, Env *env, Sv **args)
 {
     Sv *vec = args[0];
-    if (vec->type != SV_VECTOR)
+    if (SV_TYPE(vec) != SV_VECTOR)
         return Sv_new_err(stu, "vector-length argument not a vector");
     return Sv_new_int(stu, vec->val.vector->length);
 }
@@ -547,64 +666,421 @@ extern Sv
 {
     Sv *vec_sv = args[0];
     Sv *index = args[1];
-    if (vec_sv->type != SV_VECTOR)
+    if (SV_TYPE(vec_sv) != SV_VECTOR)
         return Sv_new_err(stu, "at first argument not a vector");
-    if (index->type != SV_INT)
+    if (SV_TYPE(index) != SV_INT)
         return Sv_new_err(stu, "at second argument not an integer");
     Sv_vector *vec = vec_sv->val.vector;
-    long i = index->val.i;
+    long i = SV_I(index);
     if (i < 0 || i >= vec->length)
         return Sv_new_err(stu, "at index out of bounds");
-    return vec->values[i];
+    return Vector_at(vec, i);
+}
+
+extern Sv
+*Builtin_vector_append(Stu *stu, Env *env, Sv **args)
+{
+    Sv *vec = args[0];
+    if (SV_TYPE(vec) != SV_VECTOR)
+        return Sv_new_err(stu, "vector-append first argument not a vector");
+    if (IS_NIL(args[1]))
+        return Sv_new_err(stu, "vector-append cannot append nil");
+    return Sv_vector_append(stu, vec, args[1]);
+}
+
+extern Sv
+*Builtin_vector_set(Stu *stu, Env *env, Sv **args)
+{
+    Sv *vec = args[0];
+    Sv *index = args[1];
+    if (SV_TYPE(vec) != SV_VECTOR)
+        return Sv_new_err(stu, "vector-set first argument not a vector");
+    if (SV_TYPE(index) != SV_INT)
+        return Sv_new_err(stu, "vector-set second argument not an integer");
+    long i = SV_I(index);
+    if (i < 0 || i >= vec->val.vector->length)
+        return Sv_new_err(stu, "vector-set index out of bounds");
+    return Sv_vector_set(stu, vec, i, args[2]);
+}
+
+#define IS_LIST(x) (IS_NIL(x) || SV_TYPE(x) == SV_CONS)
+#define EACH(x) (; !IS_NIL(x) && SV_TYPE(x) == SV_CONS; x = CDR(x))
+
+/*
+ * Link cell onto the end of the list being built from head. The list
+ * head is kept in the current scope, while cell may have been made in
+ * one since popped, so the rest are reached through the list.
+ */
+static void
+list_append(Stu *stu, Sv **head, Sv **last, Sv *cell)
+{
+    if (*last) {
+        GC_WRITE(stu, *last, cell);
+        (*last)->val.reg[SV_CDR_REG] = cell;
+    } else {
+        *head = cell;
+        SCOPE_SAVE(stu, cell);
+    }
+    *last = cell;
+}
+
+extern Sv
+*Builtin_length(Stu *stu, Env *env, Sv **args)
+{
+    Sv *x = args[0];
+    long n = 0;
+
+    if (!IS_LIST(x))
+        return Sv_new_err(stu, "'length' needs a single list argument");
+    for EACH(x)
+        n++;
+
+    return Sv_new_int(stu, n);
+}
+
+extern Sv
+*Builtin_map(Stu *stu, Env *env, Sv **args)
+{
+    Sv *f = args[0], *x = args[1], *head = NIL, *last = NULL, *cell, *arg;
+
+    if (!IS_LIST(x))
+        return Sv_new_err(stu, "'map' second argument not a list");
+
+    for EACH(x) {
+        PUSH_SCOPE(stu);
+        arg = CAR(x);
+        cell = Sv_cons(stu, Sv_call_argv(stu, env, f, 1, &arg), NIL);
+        POP_SCOPE(stu);
+        list_append(stu, &head, &last, cell);
+    }
+
+    return head;
+}
+
+extern Sv
+*Builtin_filter(Stu *stu, Env *env, Sv **args)
+{
+    Sv *p = args[0], *x = args[1], *head = NIL, *last = NULL, *cell, *arg, *y;
+
+    if (!IS_LIST(x))
+        return Sv_new_err(stu, "'filter' second argument not a list");
+
+    for EACH(x) {
+        PUSH_SCOPE(stu);
+        arg = CAR(x);
+        y = Sv_call_argv(stu, env, p, 1, &arg);
+        if (!y || SV_TYPE(y) != SV_BOOL) {
+            if (!y || SV_TYPE(y) != SV_ERR)
+                y = Sv_new_err(stu, "'filter' predicate must evaluate to a bool");
+            POP_N_SAVE(stu, y);
+            return y;
+        }
+        cell = SV_I(y) ? Sv_cons(stu, arg, NIL) : NULL;
+        POP_SCOPE(stu);
+        if (cell)
+            list_append(stu, &head, &last, cell);
+    }
+
+    return head;
+}
+
+/*
+ * Fold f over the list x from the left, starting with acc. Only the
+ * latest accumulator is kept in scope between calls.
+ */
+static Sv
+*fold(Stu *stu, Env *env, Sv *f, Sv *acc, Sv *x)
+{
+    Sv *argv[2];
+
+    PUSH_SCOPE(stu);
+    for EACH(x) {
+        argv[0] = CAR(x);
+        argv[1] = acc;
+        acc = Sv_call_argv(stu, env, f, 2, argv);
+        POP_SCOPE(stu);
+        PUSH_SCOPE(stu);
+        SCOPE_SAVE(stu, acc);
+    }
+    POP_N_SAVE(stu, acc);
+
+    return acc;
+}
+
+extern Sv
+*Builtin_foldl(Stu *stu, Env *env, Sv **args)
+{
+    if (!IS_LIST(args[2]))
+        return Sv_new_err(stu, "'foldl' third argument not a list");
+
+    return fold(stu, env, args[0], args[1], args[2]);
+}
+
+extern Sv
+*Builtin_foldr(Stu *stu, Env *env, Sv **args)
+{
+    Sv *f = args[0], *end = args[1], *x = args[2];
+
+    if (!IS_LIST(x))
+        return Sv_new_err(stu, "'foldr' third argument not a list");
+
+    /* Fold over a reversed copy rather than recursing down the list. */
+    return fold(stu, env, f, end, Sv_reverse(stu, x));
+}
+
+extern Sv
+*Builtin_append(Stu *stu, Env *env, Sv **args)
+{
+    Sv *lists = args[0], *head = NIL, *last = NULL, *cell, *x;
+
+    for (; !IS_NIL(lists) && !IS_NIL(CDR(lists)); lists = CDR(lists)) {
+        x = CAR(lists);
+        if (!IS_LIST(x))
+            return Sv_new_err(stu, "'append' arguments must be lists");
+        for EACH(x) {
+            PUSH_SCOPE(stu);
+            cell = Sv_cons(stu, CAR(x), NIL);
+            POP_SCOPE(stu);
+            list_append(stu, &head, &last, cell);
+        }
+    }
+
+    /* The last list is shared rather than copied. */
+    x = CAR(lists);
+    if (!last)
+        return IS_NIL(x) ? NIL : x;
+    GC_WRITE(stu, last, x);
+    last->val.reg[SV_CDR_REG] = x;
+
+    return head;
+}
+
+extern Sv
+*Builtin_nth(Stu *stu, Env *env, Sv **args)
+{
+    Sv *x = args[0], *index = args[1];
+    long i;
+
+    if (!IS_LIST(x))
+        return Sv_new_err(stu, "nth first argument not a list");
+    if (SV_TYPE(index) != SV_INT)
+        return Sv_new_err(stu, "nth second argument not an integer");
+
+    for (i = SV_I(index); i > 0 && !IS_NIL(x) && SV_TYPE(x) == SV_CONS; i--)
+        x = CDR(x);
+    if (i < 0 || IS_NIL(x) || SV_TYPE(x) != SV_CONS)
+        return Sv_new_err(stu, "nth index out of bounds");
+
+    return CAR(x);
+}
+
+extern Sv
+*Builtin_last(Stu *stu, Env *env, Sv **args)
+{
+    Sv *x = args[0], *y = NIL;
+
+    if (!IS_LIST(x))
+        return Sv_new_err(stu, "'last' needs a single list argument");
+    for EACH(x)
+        y = CAR(x);
+
+    return y;
+}
+
+#define IS_HASH(x) (!IS_NIL(x) && SV_TYPE(x) == SV_HASH_MAP)
+
+extern Sv
+*Builtin_make_hash(Stu *stu, Env *env, Sv **args)
+{
+    Sv *h = Sv_new_hash_map(stu), *x;
+
+    for (x = args[0]; !IS_NIL(x); x = CDR(CDR(x))) {
+        if (IS_NIL(CDR(x)))
+            return Sv_new_err(stu, "make-hash needs a value for every key");
+        Hash_map_put(stu, h->val.hash_map, CAR(x), CADR(x));
+    }
+
+    return h;
+}
+
+extern Sv
+*Builtin_hash_get(Stu *stu, Env *env, Sv **args)
+{
+    Hash_map_ent *e;
+
+    if (!IS_HASH(args[0]))
+        return Sv_new_err(stu, "hash-get first argument not a hash");
+    e = Hash_map_get(stu, args[0]->val.hash_map, args[1]);
+
+    return e ? e->value : NIL;
+}
+
+extern Sv
+*Builtin_hash_has_p(Stu *stu, Env *env, Sv **args)
+{
+    if (!IS_HASH(args[0]))
+        return Sv_new_err(stu, "hash-has? first argument not a hash");
+
+    return Sv_new_bool(stu, Hash_map_get(stu, args[0]->val.hash_map, args[1]) != NULL);
+}
+
+extern Sv
+*Builtin_hash_put(Stu *stu, Env *env, Sv **args)
+{
+    Sv *h = args[0];
+
+    if (!IS_HASH(h))
+        return Sv_new_err(stu, "hash-put first argument not a hash");
+
+    /* The hash may be older than what it now holds. */
+    GC_WRITE(stu, h, args[1]);
+    GC_WRITE(stu, h, args[2]);
+    Hash_map_put(stu, h->val.hash_map, args[1], args[2]);
+
+    return h;
+}
+
+extern Sv
+*Builtin_hash_del(Stu *stu, Env *env, Sv **args)
+{
+    if (!IS_HASH(args[0]))
+        return Sv_new_err(stu, "hash-del first argument not a hash");
+    Hash_map_del(stu, args[0]->val.hash_map, args[1]);
+
+    return args[0];
+}
+
+extern Sv
+*Builtin_hash_count(Stu *stu, Env *env, Sv **args)
+{
+    if (!IS_HASH(args[0]))
+        return Sv_new_err(stu, "hash-count argument not a hash");
+
+    return Sv_new_int(stu, Hash_map_count(stu, args[0]->val.hash_map));
+}
+
+/* List the keys or values of a hash, in the order they were put. */
+static Sv
+*hash_list(Stu *stu, Sv *h, int values)
+{
+    Hash_map *map = h->val.hash_map;
+    Hash_map_ent *e;
+    Sv *x = NIL;
+
+    PUSH_SCOPE(stu);
+    for (long i = map->used - 1; i >= 0; i--) {
+        e = &map->entries[i];
+        if (e->key != NULL) {
+            x = Sv_cons(stu, values ? e->value : e->key, x);
+            POP_SCOPE(stu);
+            PUSH_SCOPE(stu);
+            SCOPE_SAVE(stu, x);
+        }
+    }
+    POP_N_SAVE(stu, x);
+
+    return x;
+}
+
+extern Sv
+*Builtin_hash_keys(Stu *stu, Env *env, Sv **args)
+{
+    if (!IS_HASH(args[0]))
+        return Sv_new_err(stu, "hash-keys argument not a hash");
+
+    return hash_list(stu, args[0], 0);
+}
+
+extern Sv
+*Builtin_hash_values(Stu *stu, Env *env, Sv **args)
+{
+    if (!IS_HASH(args[0]))
+        return Sv_new_err(stu, "hash-values argument not a hash");
+
+    return hash_list(stu, args[0], 1);
+}
+
+/*
+ * Call f with each key and value of a hash in turn. The entries are
+ * looked up afresh on each step, as f may change the hash.
+ */
+extern Sv
+*Builtin_hash_each(Stu *stu, Env *env, Sv **args)
+{
+    Sv *h = args[0], *f = args[1], *argv[2], *y;
+    Hash_map_ent *e;
+
+    if (!IS_HASH(h))
+        return Sv_new_err(stu, "hash-each first argument not a hash");
+
+    for (long i = 0; i < h->val.hash_map->used; i++) {
+        e = &h->val.hash_map->entries[i];
+        if (e->key != NULL) {
+            argv[0] = e->key;
+            argv[1] = e->value;
+            PUSH_SCOPE(stu);
+            y = Sv_call_argv(stu, env, f, 2, argv);
+            if (y && SV_TYPE(y) == SV_ERR) {
+                POP_N_SAVE(stu, y);
+                return y;
+            }
+            POP_SCOPE(stu);
+        }
+    }
+
+    return NIL;
 }
 
 extern Sv
 *Builtin_type_of(Stu *stu, Env *env, Sv **args)
 {
     Sv *x = *args;
-    switch (x->type) {
+    switch (SV_TYPE(x)) {
     case SV_NIL:
         return x;
 
     case SV_SYM:
-        return Sv_new_sym(stu, "symbol");
+        return Sv_new_sym_from_id(stu, SYM_SYMBOL);
 
     case SV_INT:
-        return Sv_new_sym(stu, "integer");
+        return Sv_new_sym_from_id(stu, SYM_INTEGER);
 
     case SV_FLOAT:
-        return Sv_new_sym(stu, "float");
+        return Sv_new_sym_from_id(stu, SYM_FLOAT);
 
     case SV_RATIONAL:
-        return Sv_new_sym(stu, "rational");
+        return Sv_new_sym_from_id(stu, SYM_RATIONAL);
 
     case SV_BOOL:
-        return Sv_new_sym(stu, "boolean");
+        return Sv_new_sym_from_id(stu, SYM_BOOLEAN);
 
     case SV_STR:
-        return Sv_new_sym(stu, "string");
+        return Sv_new_sym_from_id(stu, SYM_STRING);
 
     case SV_CONS:
-        return Sv_new_sym(stu, "cons");
+        return Sv_new_sym_from_id(stu, SYM_CONS);
 
     case SV_REGEX:
-        return Sv_new_sym(stu, "regex");
+        return Sv_new_sym_from_id(stu, SYM_REGEX);
 
     case SV_NATIVE_FUNC:
     case SV_NATIVE_CLOS:
     case SV_LAMBDA:
     case SV_STRUCTURE_CONSTRUCTOR:
-        return Sv_new_sym(stu, "function");
+        return Sv_new_sym_from_id(stu, SYM_FUNCTION);
 
     case SV_VECTOR:
-        return Sv_new_sym(stu, "vector");
+        return Sv_new_sym_from_id(stu, SYM_VECTOR);
+
+    case SV_HASH_MAP:
+        return Sv_new_sym_from_id(stu, SYM_HASH);
 
     case SV_SPECIAL:
     case SV_ERR:
         return Sv_new_err(stu, "unknown type found in type-of");
 
     default:
-        return Type_name_symbol(stu, x->type);
+        return Type_name_symbol(stu, SV_TYPE(x));
     }
 }
 
@@ -614,9 +1090,9 @@ extern Sv
 {
     Sv *re = args[0];
     Sv *str = args[1];
-    if (re->type != SV_REGEX)
+    if (SV_TYPE(re) != SV_REGEX)
         return Sv_new_err(stu, "re-match first argument not a regex");
-    if (str->type != SV_STR)
+    if (SV_TYPE(str) != SV_STR)
         return Sv_new_err(stu, "re-match second argument not a string");
 
     regmatch_t matches[MAX_MATCHES + 1];
@@ -657,9 +1133,9 @@ extern Sv
 {
     Sv *re = args[0];
     Sv *str = args[1];
-    if (re->type != SV_REGEX)
+    if (SV_TYPE(re) != SV_REGEX)
         return Sv_new_err(stu, "re-match first argument not a regex");
-    if (str->type != SV_STR)
+    if (SV_TYPE(str) != SV_STR)
         return Sv_new_err(stu, "re-match second argument not a string");
 
     regmatch_t matches[MAX_MATCHES + 1];
@@ -684,6 +1160,7 @@ extern Sv
      *
      */
     stu->last_exception = Sv_cons(stu, Sv_copy(stu, args[0]), Call_stack_copy(stu));
+    stu->stats_exceptions++;
 
     /* Unwind the C stack back to last structureed try marker. */
     longjmp(*(stu->last_try_marker), 1);
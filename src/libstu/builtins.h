@@ -18,11 +18,22 @@
 #ifndef BUILTINS_DEFINED
 #define BUILTINS_DEFINED
 
+#include "native_func.h"
+
 typedef struct Stu Stu;
 typedef struct Env Env;
 typedef struct Sv Sv;
 
+typedef struct Builtin {
+    const char *name;
+    Sv_native_func_t func;
+    unsigned nargs;
+    unsigned flags;
+} Builtin;
+
 extern void Builtin_init(Stu *);
+extern const Builtin *Builtin_get(long);
+extern long Builtin_index(Sv_native_func_t);
 extern Sv *Builtin_add(Stu *, Env *, Sv **);
 extern Sv *Builtin_sub(Stu *, Env *, Sv **);
 extern Sv *Builtin_mul(Stu *, Env *, Sv **);
@@ -48,10 +59,30 @@ extern Sv *Builtin_vector_length(Stu *, Env *, Sv **);
 extern Sv *Builtin_tuple_constructor(Stu *, Env *, Sv **);
 extern Sv *Builtin_size(Stu *, Env *, Sv **);
 extern Sv *Builtin_at(Stu *, Env *, Sv **);
+extern Sv *Builtin_vector_append(Stu *, Env *, Sv **);
+extern Sv *Builtin_vector_set(Stu *, Env *, Sv **);
+extern Sv *Builtin_make_hash(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_get(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_has_p(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_put(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_del(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_count(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_keys(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_values(Stu *, Env *, Sv **);
+extern Sv *Builtin_hash_each(Stu *, Env *, Sv **);
 extern Sv *Builtin_type_of(Stu *, Env *, Sv **);
 extern Sv *Builtin_re_match(Stu *, Env *, Sv **);
 extern Sv *Builtin_re_match_p(Stu *, Env *, Sv **);
 extern Sv *Builtin_throw(Stu *, Env *, Sv **);
 extern Sv *Builtin_import(Stu *, Env *, Sv **);
+extern Sv *Builtin_runtime_stats(Stu *, Env *, Sv **);
+extern Sv *Builtin_length(Stu *, Env *, Sv **);
+extern Sv *Builtin_map(Stu *, Env *, Sv **);
+extern Sv *Builtin_filter(Stu *, Env *, Sv **);
+extern Sv *Builtin_foldl(Stu *, Env *, Sv **);
+extern Sv *Builtin_foldr(Stu *, Env *, Sv **);
+extern Sv *Builtin_append(Stu *, Env *, Sv **);
+extern Sv *Builtin_nth(Stu *, Env *, Sv **);
+extern Sv *Builtin_last(Stu *, Env *, Sv **);
 
 #endif
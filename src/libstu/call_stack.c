@@ -14,59 +14,127 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "env.h"
 #include "stu_private.h"
 #include "call_stack.h"
+#include "profile.h"
 #include "symtab.h"
 #include "sv.h"
+#include "utils.h"
+
+#define CALL_STACK_INITIAL_SIZE 256
+
+/*
+ * The call stack is an array of the values named by each call, being
+ * symbols or the functions themselves. Names are only resolved when a
+ * trace is needed, so calls made without a throw never allocate.
+ */
+static const char
+*frame_name(Stu *stu, Sv *x) {
+    switch (SV_TYPE(x)) {
+    case SV_SYM:
+        return Symtab_get_name(stu, SV_I(x));
+
+    case SV_STR:
+        return x->val.buf;
+
+    case SV_NATIVE_FUNC:
+        return "<NATIVE FUNCTION>";
+
+    case SV_NATIVE_CLOS:
+        return "<NATIVE CLOSURE>";
+
+    case SV_LAMBDA:
+        return "<LAMBDA>";
+
+    default:
+        return NULL;
+    }
+}
 
 extern Sv
 *Call_stack_copy(Stu *stu) {
-    return IS_NIL(stu->call_stack)
-        ? NIL
-        : Sv_copy(stu, stu->call_stack);
+    Sv *trace = NIL;
+
+    PUSH_SCOPE(stu);
+    for (long i = 0; i < stu->call_stack_depth; i++) {
+        trace = Sv_cons(
+            stu, Sv_new_str(stu, frame_name(stu, stu->call_stack[i])), trace);
+    }
+    POP_N_SAVE(stu, trace);
+
+    return trace;
+}
+
+extern const char
+*Call_stack_frame_name(Stu *stu, long i) {
+    return frame_name(stu, stu->call_stack[i]);
 }
 
 extern Sv
 *Call_stack_pop(Stu *stu) {
-    if (IS_NIL(stu->call_stack)) {
+    PROFILE_CHECK(stu);
+    if (stu->call_stack_depth == 0) {
         return NIL;
     }
 
-    Sv *head = CAR(stu->call_stack);
-    stu->call_stack = CDR(stu->call_stack);
-
-    return head;
+    return stu->call_stack[--stu->call_stack_depth];
 }
 
 extern void
 Call_stack_push(Stu *stu, Sv *x) {
-    Sv *head = NULL;
-
-    switch (x->type) {
-    case SV_SYM:
-        head = Sv_new_str(stu, Symtab_get_name(stu, x->val.i));
-        break;
+    PROFILE_CHECK(stu);
+    if (frame_name(stu, x) == NULL)
+        return;
 
-    case SV_STR:
-        head = Sv_copy(stu, x);
-        break;
+    if (stu->call_stack_depth == stu->call_stack_size) {
+        stu->call_stack_size = stu->call_stack_size
+            ? stu->call_stack_size * 2 : CALL_STACK_INITIAL_SIZE;
+        stu->call_stack = CHECKED_REALLOC(
+            stu->call_stack, stu->call_stack_size * sizeof(*stu->call_stack));
+    }
 
-    case SV_NATIVE_FUNC:
-        head = Sv_new_str(stu, "<NATIVE FUNCTION>");
-        break;
+    stu->call_stack[stu->call_stack_depth++] = x;
+}
 
-    case SV_NATIVE_CLOS:
-        head = Sv_new_str(stu, "<NATIVE CLOSURE>");
-        break;
+/*
+ * Push x for a tail call made from a frame which owns the top n
+ * entries, returning how many it owns afterwards. A function already
+ * among them is not pushed again, so a loop written as tail calls keeps
+ * the call stack bounded.
+ */
+extern int
+Call_stack_push_tail(Stu *stu, Sv *x, int n) {
+    const char *name = frame_name(stu, x);
+    long depth = stu->call_stack_depth;
 
-    case SV_LAMBDA:
-        head = Sv_new_str(stu, "<LAMBDA>");
-        break;
+    PROFILE_CHECK(stu);
+    if (name == NULL)
+        return n;
 
-    default:
-        return;
+    for (int i = 0; i < n && depth - i > 0; i++) {
+        Sv *cur = stu->call_stack[depth - i - 1];
+        if (cur == x || strcmp(frame_name(stu, cur), name) == 0)
+            return n;
     }
 
-    stu->call_stack = Sv_cons(stu, head, stu->call_stack);
+    Call_stack_push(stu, x);
+
+    return n + 1;
+}
+
+extern void
+Call_stack_visit(Stu *stu, void (*action)(Stu *, Gc *)) {
+    for (long i = 0; i < stu->call_stack_depth; i++)
+        action(stu, (Gc *) stu->call_stack[i]);
+}
+
+extern void
+Call_stack_destroy(Stu *stu) {
+    free(stu->call_stack);
+    stu->call_stack = NULL;
+    stu->call_stack_depth = stu->call_stack_size = 0;
 }
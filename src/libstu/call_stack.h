@@ -17,13 +17,22 @@
 #ifndef CALL_STACK_DEFINED
 #define CALL_STACK_DEFINED
 
+struct Gc;
 struct Stu;
 struct Sv;
 
 extern struct Sv *Call_stack_copy(struct Stu *);
 
+extern const char *Call_stack_frame_name(struct Stu *, long);
+
 extern struct Sv *Call_stack_pop(struct Stu *);
 
 extern void Call_stack_push(struct Stu *, struct Sv *);
 
+extern int Call_stack_push_tail(struct Stu *, struct Sv *, int);
+
+extern void Call_stack_visit(struct Stu *, void (*)(struct Stu *, struct Gc *));
+
+extern void Call_stack_destroy(struct Stu *);
+
 #endif
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <err.h>
+
+#include "alloc/alloc.h"
+#include "compile.h"
+#include "env.h"
+#include "gc.h"
+#include "special_form.h"
+#include "stu_private.h"
+#include "sv.h"
+#include "utils.h"
+
+#define CODE_INITIAL_SIZE 16
+
+static void compile_expr(Stu *, Code *, Sv *, Sv *, int);
+static Code *compile_unit(Stu *, Sv *, Sv *);
+
+extern Code
+*Code_new(Stu *stu)
+{
+    Code *code = NULL;
+
+    if ((code = Alloc_allocate(stu->code_alloc)) != NULL) {
+        GC_INIT(stu, code, GC_TYPE_CODE);
+        code->epoch = stu->macro_epoch;
+    } else {
+        err(1, "Code_new");
+    }
+
+    return code;
+}
+
+extern void
+Code_destroy(Stu *stu, Code **code)
+{
+    Code *c = *code;
+    if (code && c) {
+        free(c->ops);
+        free(c->consts);
+        free(c->codes);
+        free(c->caches);
+        Alloc_release(stu->code_alloc, c);
+        *code = NULL;
+    }
+}
+
+static int
+emit(Code *code, int op)
+{
+    if (code->num_ops == code->ops_capacity) {
+        code->ops_capacity = code->ops_capacity
+            ? code->ops_capacity * 2 : CODE_INITIAL_SIZE;
+        code->ops = CHECKED_REALLOC(
+            code->ops, code->ops_capacity * sizeof(*code->ops));
+    }
+    code->ops[code->num_ops] = op;
+
+    return code->num_ops++;
+}
+
+static int
+add_const(Code *code, Sv *x)
+{
+    if (code->num_consts == code->consts_capacity) {
+        code->consts_capacity = code->consts_capacity
+            ? code->consts_capacity * 2 : CODE_INITIAL_SIZE;
+        code->consts = CHECKED_REALLOC(
+            code->consts, code->consts_capacity * sizeof(*code->consts));
+    }
+    code->consts[code->num_consts] = x;
+
+    return code->num_consts++;
+}
+
+static int
+add_code(Code *code, Code *x)
+{
+    if (code->num_codes == code->codes_capacity) {
+        code->codes_capacity = code->codes_capacity
+            ? code->codes_capacity * 2 : CODE_INITIAL_SIZE;
+        code->codes = CHECKED_REALLOC(
+            code->codes, code->codes_capacity * sizeof(*code->codes));
+    }
+    code->codes[code->num_codes] = x;
+
+    return code->num_codes++;
+}
+
+static int
+add_cache(Code *code)
+{
+    if (code->num_caches == code->caches_capacity) {
+        code->caches_capacity = code->caches_capacity
+            ? code->caches_capacity * 2 : CODE_INITIAL_SIZE;
+        code->caches = CHECKED_REALLOC(
+            code->caches, code->caches_capacity * sizeof(*code->caches));
+    }
+    code->caches[code->num_caches].anchor = NULL;
+    code->caches[code->num_caches].val = NULL;
+    code->caches[code->num_caches].version = -1;
+
+    return code->num_caches++;
+}
+
+static void
+emit_const(Code *code, int op, Sv *x)
+{
+    emit(code, op);
+    emit(code, add_const(code, x));
+}
+
+/* Anything the compiler can't handle is left to the tree-walker. */
+static void
+compile_fallback(Stu *stu, Code *code, Sv *x)
+{
+    emit_const(code, OP_EVAL, x);
+}
+
+static void
+compile_if(Stu *stu, Code *code, Sv *x, Sv *scope, int tail)
+{
+    Sv *args = CDR(x), *clauses = CDR(args);
+    int branch, jump, end;
+
+    if (SV_TYPE(args) != SV_CONS || !clauses || SV_TYPE(clauses) != SV_CONS) {
+        compile_fallback(stu, code, x);
+        return;
+    }
+
+    emit_const(code, OP_FRAME_PUSH, CAR(x));
+    compile_expr(stu, code, CAR(args), scope, 0);
+    branch = emit(code, OP_BRANCH);
+    emit(code, 0);
+    emit(code, 0);
+
+    /*
+     * A clause in tail position may replace the current frame, so the
+     * if is popped off the call stack before it rather than after.
+     */
+    if (tail)
+        emit(code, OP_FRAME_POP);
+    compile_expr(stu, code, CAR(clauses), scope, tail);
+    jump = emit(code, OP_JUMP);
+    emit(code, 0);
+
+    code->ops[branch + 1] = code->num_ops;
+    if (tail)
+        emit(code, OP_FRAME_POP);
+    if (IS_NIL(CDR(clauses))) {
+        emit_const(code, OP_CONST, CDR(clauses));
+    } else {
+        compile_expr(stu, code, CADR(clauses), scope, tail);
+    }
+
+    if (tail) {
+        end = emit(code, OP_JUMP);
+        emit(code, 0);
+        code->ops[branch + 2] = code->num_ops;
+        emit(code, OP_FRAME_POP);
+        code->ops[jump + 1] = code->ops[end + 1] = code->num_ops;
+    } else {
+        code->ops[branch + 2] = code->ops[jump + 1] = code->num_ops;
+        emit(code, OP_FRAME_POP);
+    }
+}
+
+/*
+ * Resolve a symbol bound by the formals of an enclosing lambda to its
+ * call frame slot. Lambdas without formals bind no frame, so they are
+ * not counted in the depth.
+ */
+static int
+resolve(Stu *stu, Sv *scope, Sv *sym, int *depth, int *index)
+{
+    int arity;
+
+    for (*depth = 0; !IS_NIL(scope); scope = CDR(scope)) {
+        if ((*index = Sv_formals_index(stu, CAR(scope), SV_I(sym))) >= 0)
+            return 1;
+        if (Sv_formals_size(stu, CAR(scope), &arity) > 0)
+            (*depth)++;
+    }
+
+    return 0;
+}
+
+static void
+compile_lambda(Stu *stu, Code *code, Sv *args, Sv *scope)
+{
+    Sv *lambda = Sv_new_lambda(stu, NULL, CAR(args), CDR(args));
+
+    lambda->val.ufunc->scope = scope;
+    emit_const(code, OP_LAMBDA, lambda);
+}
+
+static void
+compile_def(Stu *stu, Code *code, Sv *x, Sv *scope)
+{
+    Sv *args = CDR(x);
+
+    if (SV_TYPE(args) != SV_CONS || !Special_form_is_def_pattern(CAR(args))) {
+        compile_fallback(stu, code, x);
+        return;
+    }
+
+    emit_const(code, OP_FRAME_PUSH, CAR(x));
+    compile_expr(stu, code, CADR(args), scope, 0);
+    emit_const(code, OP_DEF, CAR(args));
+    emit(code, OP_FRAME_POP);
+}
+
+static void
+compile_defun(Stu *stu, Code *code, Sv *x, Sv *scope)
+{
+    Sv *args = CDR(x), *rest = CDR(args);
+
+    if (SV_TYPE(args) != SV_CONS
+        || !Special_form_is_def_pattern(CAR(args))
+        || !rest || SV_TYPE(rest) != SV_CONS
+        || !Special_form_is_formals(CAR(rest)))
+    {
+        compile_fallback(stu, code, x);
+        return;
+    }
+
+    emit_const(code, OP_FRAME_PUSH, CAR(x));
+    compile_lambda(stu, code, rest, scope);
+    emit_const(code, OP_DEF, CAR(args));
+    emit(code, OP_FRAME_POP);
+}
+
+static void
+compile_try(Stu *stu, Code *code, Sv *x, Sv *scope)
+{
+    Sv *args = CDR(x), *handler = CADR(args);
+
+    if (SV_TYPE(args) != SV_CONS || !handler) {
+        compile_fallback(stu, code, x);
+        return;
+    }
+
+    emit_const(code, OP_FRAME_PUSH, CAR(x));
+    emit(code, OP_TRY);
+    emit(code, add_code(code, compile_unit(stu, CAR(args), scope)));
+    emit(code, add_code(code, compile_unit(stu, handler, scope)));
+    emit(code, SV_TYPE(handler) == SV_SYM ? add_const(code, handler) : -1);
+    emit(code, OP_FRAME_POP);
+}
+
+static void
+compile_call(Stu *stu, Code *code, Sv *x, Sv *scope, int tail)
+{
+    Sv *cur;
+    int n = 0;
+
+    /* Dotted argument lists are passed through unevaluated. */
+    for (cur = x; !IS_NIL(cur); cur = CDR(cur)) {
+        if (SV_TYPE(cur) != SV_CONS) {
+            compile_fallback(stu, code, x);
+            return;
+        }
+    }
+
+    for (cur = x; !IS_NIL(cur); cur = CDR(cur), n++)
+        compile_expr(stu, code, CAR(cur), scope, 0);
+
+    emit(code, tail ? OP_TAILCALL : OP_CALL);
+    emit(code, n - 1);
+    emit(code, SV_TYPE(CAR(x)) == SV_SYM ? add_const(code, CAR(x)) : -1);
+}
+
+static void
+compile_sexp(Stu *stu, Code *code, Sv *x, Sv *scope, int tail)
+{
+    Sv *head, *args;
+
+    x = Sv_expand(stu, x);
+    if (!x || SV_TYPE(x) != SV_CONS) {
+        compile_expr(stu, code, x, scope, tail);
+        return;
+    }
+
+    head = CAR(x);
+    args = CDR(x);
+
+    if (SV_TYPE(head) != SV_SYM || SV_I(head) > SPECIAL_FORM_DEFMOD) {
+        compile_call(stu, code, x, scope, tail);
+        return;
+    }
+
+    switch (SV_I(head)) {
+    case SPECIAL_FORM_QUOTE:
+        if (SV_TYPE(args) == SV_CONS && CDR(args) == NIL) {
+            emit_const(code, OP_CONST, CAR(args));
+        } else {
+            compile_fallback(stu, code, x);
+        }
+        break;
+
+    case SPECIAL_FORM_IF:
+        compile_if(stu, code, x, scope, tail);
+        break;
+
+    case SPECIAL_FORM_LAMBDA:
+    case SPECIAL_FORM_LAMBDA_U:
+        if (SV_TYPE(args) == SV_CONS && Special_form_is_formals(CAR(args))) {
+            compile_lambda(stu, code, args, scope);
+        } else {
+            compile_fallback(stu, code, x);
+        }
+        break;
+
+    case SPECIAL_FORM_DEF:
+        compile_def(stu, code, x, scope);
+        break;
+
+    case SPECIAL_FORM_DEFUN:
+        compile_defun(stu, code, x, scope);
+        break;
+
+    case SPECIAL_FORM_TRY:
+        compile_try(stu, code, x, scope);
+        break;
+
+    case SPECIAL_FORM_DEFTYPE:
+    case SPECIAL_FORM_DEFMACRO:
+    case SPECIAL_FORM_OPEN:
+    case SPECIAL_FORM_DEFMOD:
+        emit_const(code, OP_SPECIAL, x);
+        break;
+
+    default:
+        compile_call(stu, code, x, scope, tail);
+        break;
+    }
+}
+
+static void
+compile_expr(Stu *stu, Code *code, Sv *x, Sv *scope, int tail)
+{
+    Sv_vector *vec;
+    int depth, index;
+
+    if (!x) {
+        emit_const(code, OP_CONST, x);
+        return;
+    }
+
+    switch (SV_TYPE(x)) {
+    case SV_SYM:
+        if (resolve(stu, scope, x, &depth, &index)) {
+            emit(code, OP_LOCAL);
+            emit(code, depth);
+            emit(code, index);
+            emit(code, add_const(code, x));
+        } else {
+            emit_const(code, OP_LOOKUP, x);
+            emit(code, add_cache(code));
+        }
+        break;
+
+    case SV_CONS:
+        compile_sexp(stu, code, x, scope, tail);
+        break;
+
+    case SV_VECTOR:
+        vec = x->val.vector;
+        for (long i = 0; i < vec->length; i++)
+            compile_expr(stu, code, Vector_at(vec, i), scope, 0);
+        emit(code, OP_VECTOR);
+        emit(code, vec->length);
+        break;
+
+    case SV_STRUCTURE_ACCESS:
+        compile_expr(stu, code, x->val.reg[SV_CAR_REG], scope, 0);
+        emit_const(code, OP_FIELD, x->val.reg[SV_CDR_REG]);
+        break;
+
+    case SV_SPECIAL:
+        compile_fallback(stu, code, x);
+        break;
+
+    default:
+        emit_const(code, OP_CONST, x);
+        break;
+    }
+}
+
+static Code
+*compile_unit(Stu *stu, Sv *x, Sv *scope)
+{
+    Code *code = NULL;
+
+    PUSH_SCOPE(stu);
+    code = Code_new(stu);
+    compile_expr(stu, code, x, scope, 1);
+    emit(code, OP_RETURN);
+    POP_N_SAVE(stu, code);
+
+    return code;
+}
+
+extern Code
+*Compile_expr(Stu *stu, Sv *x)
+{
+    return compile_unit(stu, x, NIL);
+}
+
+/*
+ * Compile a lambda body. Each form may capture new bindings with def,
+ * which are visible to the forms that follow it. The scope lists the
+ * formals of the lambda and those enclosing it, innermost first, so
+ * references to them can be resolved to call frame slots.
+ */
+extern Code
+*Compile_body(Stu *stu, Sv *body, Sv *scope)
+{
+    Code *code = NULL;
+    Sv *cur = CAR(body);
+    short deferred = 0;
+
+    PUSH_SCOPE(stu);
+    code = Code_new(stu);
+    code->body = 1;
+
+    if (IS_NIL(body) || IS_NIL(cur)) {
+        emit_const(code, OP_CONST, NIL);
+    } else {
+        emit(code, OP_RESET);
+        while (!IS_NIL(cur)) {
+            if (deferred) {
+                /*
+                 * A macro defined earlier in this body may change how the
+                 * remaining forms expand, so they can't be compiled yet.
+                 */
+                emit_const(code, OP_EVAL, cur);
+            } else {
+                compile_expr(stu, code, cur, scope, IS_NIL(CADR(body)));
+            }
+
+            if (SV_TYPE(cur) == SV_CONS && CAR(cur) && SV_TYPE(CAR(cur)) == SV_SYM
+                && SV_I(CAR(cur)) == SPECIAL_FORM_DEFMACRO)
+            {
+                deferred = 1;
+            }
+
+            body = CDR(body);
+            if (!IS_NIL(cur = CAR(body)))
+                emit(code, OP_SEQ);
+        }
+    }
+
+    emit(code, OP_RETURN);
+    POP_N_SAVE(stu, code);
+
+    return code;
+}
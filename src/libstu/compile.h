@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef COMPILE_DEFINED
+#define COMPILE_DEFINED
+
+#include "gc.h"
+
+/*
+ * Bytecode instructions. Operands follow the opcode inline in the
+ * instruction stream.
+ */
+enum Code_op {
+    OP_CONST,       /* k: push constant k */
+    OP_LOOKUP,      /* k, c: push the value bound to symbol constant k, using cache c */
+    OP_LOCAL,       /* d, i, k: push slot i of the call frame d frames down */
+    OP_POP,         /* discard the top of the stack */
+    OP_RESET,       /* start capturing bindings for the first body form */
+    OP_SEQ,         /* rebase captured bindings and move to the next body form */
+    OP_CALL,        /* n, k: call stack[-n - 1] with n arguments, k names the frame */
+    OP_TAILCALL,    /* n, k: as OP_CALL, but a lambda replaces the current frame */
+    OP_RETURN,      /* return the top of the stack to the caller */
+    OP_JUMP,        /* pc: unconditional jump */
+    OP_BRANCH,      /* else, end: pop a bool and branch */
+    OP_LAMBDA,      /* k: close lambda template k over the current env */
+    OP_DEF,         /* k: bind pattern constant k to the top of the stack */
+    OP_SPECIAL,     /* k: delegate form constant k to its special form */
+    OP_EVAL,        /* k: evaluate form constant k with the tree-walker */
+    OP_VECTOR,      /* n: build a vector from the top n values */
+    OP_FIELD,       /* k: access field constant k of the structure on the stack */
+    OP_TRY,         /* b, h, k: run code b, catching with code h named by k */
+    OP_FRAME_PUSH,  /* k: push call stack entry for constant k */
+    OP_FRAME_POP    /* pop the last call stack entry */
+};
+
+/* Forward declarations. */
+struct Env;
+struct Stu;
+struct Sv;
+
+/*
+ * Inline cache of a global lookup. The value is that found below anchor,
+ * the first binding past the call frames, while the env version is
+ * unchanged.
+ */
+typedef struct Code_cache {
+    struct Env *anchor;
+    struct Sv *val;
+    long version;
+} Code_cache;
+
+/*
+ * A compiled unit of bytecode. Once compiled a code object is never
+ * modified apart from its lookup caches, so it can be shared between
+ * every closure created from the same lambda and safely run by several
+ * frames at once.
+ */
+typedef struct Code {
+    struct Gc gc;
+    int *ops;
+    int num_ops;
+    int ops_capacity;
+    struct Sv **consts;
+    int num_consts;
+    int consts_capacity;
+    struct Code **codes;
+    int num_codes;
+    int codes_capacity;
+    Code_cache *caches;
+    int num_caches;
+    int caches_capacity;
+    long epoch;
+    short body;
+} Code;
+
+extern Code *Code_new(struct Stu *);
+extern void Code_destroy(struct Stu *, Code **);
+extern Code *Compile_expr(struct Stu *, struct Sv *);
+extern Code *Compile_body(struct Stu *, struct Sv *, struct Sv *);
+
+#endif
@@ -16,13 +16,16 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <err.h>
 
 #include "alloc/alloc.h"
 #include "stu_private.h"
 #include "gc.h"
+#include "native_func.h"
 #include "env.h"
 #include "symtab.h"
+#include "utils.h"
 
 extern Env
 *Env_new(Stu *stu)
@@ -34,11 +37,29 @@ extern Env
     return new;
 }
 
+/*
+ * Create a call frame with size slots on top of prev. The symbol ids
+ * and values share one allocation, and all values start out NULL.
+ */
+extern Env
+*Env_new_frame(Stu *stu, Env *prev, int size)
+{
+    Env *new = Env_new(stu);
+
+    new->prev = prev;
+    new->vals = CHECKED_CALLOC(size, sizeof(*new->vals) + sizeof(*new->syms));
+    new->syms = (long *) (new->vals + size);
+    new->size = size;
+
+    return new;
+}
+
 extern void
 Env_destroy(Stu *stu, Env **env)
 {
     Env *e = *env;
     if (env && e) {
+        free(e->vals);
         Alloc_release(stu->env_alloc, *env);
         *env = NULL;
     }
@@ -67,6 +88,7 @@ Env_capture_reset(Stu *stu)
 extern void
 Env_capture(Stu *stu, Sv *key, Sv *val)
 {
+    stu->env_version++;
     stu->env_capture_head = Env_put(stu, stu->env_capture_head, key, val);
     if (stu->env_capture_tail == NULL) {
         stu->env_capture_tail = stu->env_capture_head;
@@ -80,6 +102,7 @@ extern Env
     }
 
     stu->env_capture_tail->prev = base;
+    GC_WRITE(stu, stu->env_capture_tail, base);
     return stu->env_capture_head;
 }
 
@@ -89,23 +112,102 @@ extern Env
     if (!key) return env;
 
     Env *new = Env_new(stu);
-    new->sym = key->val.i;
+    new->sym = SV_I(key);
     new->prev = env;
     new->val = val;
     return new;
 }
 
+/*
+ * Track a new binding in the main environment. Symbols bound to macros
+ * are remembered so that most symbols can be ruled out as macros without
+ * a lookup, and the macro epoch is bumped if any macro may have changed.
+ */
+static void
+main_bind(Stu *stu, long sym, Sv *val)
+{
+    long size = stu->macro_syms_size;
+
+    if (IS_MACRO(val)) {
+        if (sym >= size) {
+            stu->macro_syms_size = sym + 1 > size * 2 ? sym + 1 : size * 2;
+            stu->macro_syms = CHECKED_REALLOC(stu->macro_syms, stu->macro_syms_size);
+            memset(stu->macro_syms + size, 0, stu->macro_syms_size - size);
+        }
+        stu->macro_syms[sym] = 1;
+        stu->macro_epoch++;
+    } else if (sym < size && stu->macro_syms[sym]) {
+        /* A macro is being shadowed. */
+        stu->macro_epoch++;
+    }
+}
+
+/* Add a binding on top of the main environment to the index. */
+static void
+main_index(Stu *stu, Env *env)
+{
+    long size = stu->main_index_size;
+
+    if (env->sym >= size) {
+        stu->main_index_size = env->sym + 1 > size * 2 ? env->sym + 1 : size * 2;
+        stu->main_index = CHECKED_REALLOC(
+            stu->main_index, stu->main_index_size * sizeof(*stu->main_index));
+        memset(stu->main_index + size, 0,
+               (stu->main_index_size - size) * sizeof(*stu->main_index));
+    }
+
+    env->seq = ++stu->main_seq;
+    env->shadow = stu->main_index[env->sym];
+    stu->main_index[env->sym] = env;
+}
+
+/*
+ * Drop every indexed binding; those below floor are searched linearly
+ * from now on, and only later bindings are indexed.
+ */
+static void
+main_index_reset(Stu *stu, Env *floor)
+{
+    if (stu->main_index)
+        memset(stu->main_index, 0, stu->main_index_size * sizeof(*stu->main_index));
+    stu->main_index_base = stu->main_seq + 1;
+    stu->main_index_floor = floor;
+}
+
 extern Env
 *Env_main_put(Stu *stu, Sv *key, Sv *val)
 {
+    if (key)
+        main_bind(stu, SV_I(key), val);
     stu->main_env = Env_put(stu, stu->main_env, key, val);
+    if (key)
+        main_index(stu, stu->main_env);
+    stu->env_version++;
     return stu->main_env;
 }
 
+/*
+ * Fetch the macro bound to key in the main environment, or NULL if key
+ * does not name a macro.
+ */
+extern Sv
+*Env_main_macro(Stu *stu, Sv *key)
+{
+    Sv *x = NULL;
+
+    if (key && SV_TYPE(key) == SV_SYM && SV_I(key) < stu->macro_syms_size
+        && stu->macro_syms[SV_I(key)])
+    {
+        x = Env_main_get(stu, key);
+    }
+
+    return IS_MACRO(x) ? x : NULL;
+}
+
 extern Sv
 *Env_main_get(Stu *stu, Sv *key)
 {
-    return stu->main_env ? Env_get(stu->main_env, key) : NULL;
+    return stu->main_env ? Env_get(stu, stu->main_env, key) : NULL;
 }
 
 extern Env
@@ -117,38 +219,118 @@ extern Env
 extern Env
 *Env_main_set(Stu *stu, Env *env)
 {
+    Env *cur, **added = NULL;
+    long n = 0, capacity = 0;
+
+    /* Only bindings added on top of the current main env are new. */
+    for (cur = env; cur && cur != stu->main_env; cur = cur->prev) {
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            added = CHECKED_REALLOC(added, capacity * sizeof(*added));
+        }
+        added[n++] = cur;
+    }
+    if (cur == NULL) {
+        stu->macro_epoch++;
+        main_index_reset(stu, NULL);
+    }
+
+    /* Bind oldest first, so the index shadows in the same order. */
+    while (n-- > 0) {
+        cur = added[n];
+        if (cur->size > 0) {
+            for (int i = 0; i < cur->size; i++)
+                main_bind(stu, cur->syms[i], cur->vals[i]);
+            main_index_reset(stu, cur);
+        } else {
+            main_bind(stu, cur->sym, cur->val);
+            main_index(stu, cur);
+        }
+    }
+    free(added);
+
     stu->main_env = env;
+    stu->env_version++;
+
+    return env;
 }
 
-extern int
-Env_exists(Env *env, Sv *key)
+/*
+ * Find the slot holding the value of key in env. Once an indexed main
+ * environment binding is reached, the rest of the chain is searched via
+ * the index by following the shadowed bindings of key back to the
+ * newest one visible from there.
+ */
+static Sv
+**lookup(Stu *stu, Env *env, Sv *key)
 {
-    Env *cur;
+    Env *cur = env, *found;
+    long sym;
 
-    if (key) {
-        for (cur = env; cur; cur = cur->prev) {
-            if (cur->sym == key->val.i)
-                return 1;
+    if (!key || SV_TYPE(key) != SV_SYM)
+        return NULL;
+
+    sym = SV_I(key);
+    stu->stats_env_lookups++;
+    while (cur) {
+        stu->stats_env_lookup_steps++;
+        if (cur->size > 0) {
+            for (int i = cur->size - 1; i >= 0; i--) {
+                if (cur->syms[i] == sym)
+                    return &cur->vals[i];
+            }
+        } else if (cur->seq >= stu->main_index_base && cur->seq > 0) {
+            found = sym < stu->main_index_size ? stu->main_index[sym] : NULL;
+            while (found && found->seq > cur->seq)
+                found = found->shadow;
+            if (found && found->seq >= stu->main_index_base)
+                return &found->val;
+            cur = stu->main_index_floor;
+            continue;
+        } else if (cur->sym == sym) {
+            return &cur->val;
         }
+        cur = cur->prev;
     }
 
-    return 0;
+    return NULL;
+}
+
+extern int
+Env_exists(Stu *stu, Env *env, Sv *key)
+{
+    return lookup(stu, env, key) != NULL;
 }
 
 extern int
 Env_main_exists(Stu *stu, Sv *key)
 {
-    return Env_exists(stu->main_env, key);
+    return Env_exists(stu, stu->main_env, key);
 }
 
 extern Sv
-*Env_get(Env *env, Sv *key)
+*Env_get(Stu *stu, Env *env, Sv *key)
 {
-    Env *cur = env;
+    Sv **slot = lookup(stu, env, key);
 
-    for (; key && key->type == SV_SYM && cur; cur = cur->prev) {
-        if (cur->sym == key->val.i)
+    return slot ? *slot : NULL;
+}
+
+/*
+ * Fetch slot index of the call frame depth frames down from env. Any
+ * single bindings passed on the way, such as those captured by def,
+ * still shadow the slot so they are checked against key.
+ */
+extern Sv
+*Env_get_local(Env *env, int depth, int index, Sv *key)
+{
+    for (Env *cur = env; cur; cur = cur->prev) {
+        if (cur->size > 0) {
+            if (depth-- == 0)
+                return cur->vals[index];
+        } else if (cur->sym == SV_I(key)) {
             return cur->val;
+        }
     }
 
     return NULL;
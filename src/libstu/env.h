@@ -30,18 +30,36 @@ typedef struct Env {
     struct Env *prev;
     long sym;
     Sv *val;
+
+    /*
+     * A call frame binds all of a lambda's formals in a single node,
+     * with size slots in place of sym and val.
+     */
+    int size;
+    long *syms;
+    Sv **vals;
+
+    /*
+     * Position of a main environment binding, and the binding of the
+     * same symbol it shadows.
+     */
+    long seq;
+    struct Env *shadow;
 } Env;
 
 extern Env *Env_new(struct Stu *);
+extern Env *Env_new_frame(struct Stu *, Env *, int);
 extern void Env_destroy(struct Stu *, Env **);
 extern Env *Env_main_put(struct Stu *, Sv *, Sv *);
 extern Sv *Env_main_get(struct Stu *, Sv *);
+extern Sv *Env_main_macro(struct Stu *, Sv *);
 extern int Env_main_exists(struct Stu *, Sv *);
 extern Env *Env_main(struct Stu *);
 extern Env *Env_main_set(struct Stu *, Env *);
 extern Env *Env_put(struct Stu *, Env *, Sv *, Sv *);
-extern Sv *Env_get(Env *, Sv *);
-extern int Env_exists(Env *, Sv *);
+extern Sv *Env_get(struct Stu *, Env *, Sv *);
+extern int Env_exists(struct Stu *, Env *, Sv *);
+extern Sv *Env_get_local(Env *, int, int, Sv *);
 extern void Env_capture_save(struct Stu *, Env **, Env **);
 extern void Env_capture_restore(struct Stu *, Env *, Env *);
 extern void Env_capture(struct Stu *, Sv *, Sv *);
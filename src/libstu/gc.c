@@ -15,18 +15,30 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <err.h>
 
 #include "config.h"
 #include "alloc/alloc.h"
+#include "call_stack.h"
+#include "compile.h"
 #include "env.h"
 #include "hash.h"
+#include "mod.h"
 #include "stu_private.h"
 #include "sv.h"
 #include "symtab.h"
 #include "utils.h"
+#include "vm.h"
+
+#define GC_REMEMBERED_INITIAL_SIZE 64
+#define GC_ROOTS_INITIAL_SIZE      1024
+#define GC_SCOPES_INITIAL_SIZE     256
+#define GC_MARK_STACK_INITIAL_SIZE 1024
 
 static void
 Gc_visit_sv(Stu *stu, Sv *sv, void (*action)(Stu *, Gc *))
@@ -45,8 +57,17 @@ Gc_visit_sv(Stu *stu, Sv *sv, void (*action)(Stu *, Gc *))
             break;
 
         case SV_VECTOR:
-            for (long i = 0; i < sv->val.vector->length; i++) {
-                action(stu, (Gc *) sv->val.vector->values[i]);
+            for (long i = 0, n; i < sv->val.vector->length; i += n) {
+                Sv **values = Vector_chunk(sv->val.vector, i, &n);
+                for (long j = 0; j < n; j++)
+                    action(stu, (Gc *) values[j]);
+            }
+            break;
+
+        case SV_HASH_MAP:
+            for (long i = 0; i < sv->val.hash_map->used; i++) {
+                action(stu, (Gc *) sv->val.hash_map->entries[i].key);
+                action(stu, (Gc *) sv->val.hash_map->entries[i].value);
             }
             break;
 
@@ -55,6 +76,11 @@ Gc_visit_sv(Stu *stu, Sv *sv, void (*action)(Stu *, Gc *))
                 action(stu, (Gc *) sv->val.ufunc->env);
                 action(stu, (Gc *) sv->val.ufunc->formals);
                 action(stu, (Gc *) sv->val.ufunc->body);
+                action(stu, (Gc *) sv->val.ufunc->code);
+                action(stu, (Gc *) sv->val.ufunc->proto);
+                action(stu, (Gc *) sv->val.ufunc->bound);
+                action(stu, (Gc *) sv->val.ufunc->scope);
+                action(stu, (Gc *) sv->val.ufunc->expanded);
             }
             break;
 
@@ -80,74 +106,470 @@ Gc_visit_sv(Stu *stu, Sv *sv, void (*action)(Stu *, Gc *))
 static void
 Gc_visit_env(Stu *stu, Env *env, void (*action)(Stu *, Gc *))
 {
-    for (; env; env = env->prev) {
-        action(stu, (Gc *) env);
-        action(stu, (Gc *) env->val);
+    action(stu, (Gc *) env->prev);
+    action(stu, (Gc *) env->val);
+    for (int i = 0; i < env->size; i++)
+        action(stu, (Gc *) env->vals[i]);
+}
+
+static void
+Gc_visit_code(Stu *stu, Code *code, void (*action)(Stu *, Gc *))
+{
+    for (int i = 0; i < code->num_consts; i++)
+        action(stu, (Gc *) code->consts[i]);
+    for (int i = 0; i < code->num_codes; i++)
+        action(stu, (Gc *) code->codes[i]);
+    for (int i = 0; i < code->num_caches; i++) {
+        action(stu, (Gc *) code->caches[i].anchor);
+        action(stu, (Gc *) code->caches[i].val);
+    }
+}
+
+/* Apply action to each object directly referenced by gc. */
+static void
+Gc_visit(Stu *stu, Gc *gc, void (*action)(Stu *, Gc *))
+{
+    switch (GC_TYPE(gc)) {
+    case GC_TYPE_SV:
+        Gc_visit_sv(stu, (Sv *) gc, action);
+        break;
+
+    case GC_TYPE_ENV:
+        Gc_visit_env(stu, (Env *) gc, action);
+        break;
+
+    case GC_TYPE_CODE:
+        Gc_visit_code(stu, (Code *) gc, action);
+        break;
+    }
+}
+
+/*
+ * Objects are traced with an explicit stack rather than by recursion, so
+ * long lists and environment chains cannot exhaust the C stack.
+ */
+static void
+Gc_mark_stack_push(Stu *stu, Gc *gc)
+{
+    if (stu->gc_mark_stack_size == stu->gc_mark_stack_capacity) {
+        stu->gc_mark_stack_capacity = stu->gc_mark_stack_capacity
+            ? stu->gc_mark_stack_capacity * 2 : GC_MARK_STACK_INITIAL_SIZE;
+        stu->gc_mark_stack = CHECKED_REALLOC(
+            stu->gc_mark_stack,
+            stu->gc_mark_stack_capacity * sizeof(*stu->gc_mark_stack));
+    }
+    stu->gc_mark_stack[stu->gc_mark_stack_size++] = gc;
+}
+
+/* Visit the children of everything on the mark stack until it is empty. */
+static void
+Gc_mark_stack_drain(Stu *stu, void (*push)(Stu *, Gc *))
+{
+    while (stu->gc_mark_stack_size > 0)
+        Gc_visit(stu, stu->gc_mark_stack[--stu->gc_mark_stack_size], push);
+}
+
+static void
+Gc_push_marked(Stu *stu, Gc *gc)
+{
+    if (GC_IS_REF(gc) && !GC_MARKED(gc)) {
+        GC_MARK(gc);
+        Gc_mark_stack_push(stu, gc);
+    }
+}
+
+static void
+Gc_push_marked_young(Stu *stu, Gc *gc)
+{
+    if (GC_IS_YOUNG(gc) && !GC_MARKED(gc)) {
+        GC_MARK(gc);
+        Gc_mark_stack_push(stu, gc);
+    }
+}
+
+static void
+Gc_push_locked(Stu *stu, Gc *gc)
+{
+    if (GC_IS_REF(gc) && !GC_LOCKED(gc)) {
+        GC_LOCK(gc);
+        Gc_mark_stack_push(stu, gc);
+    }
+}
+
+/* Mark gc and everything reachable from it without passing an old object. */
+static void
+Gc_mark_young(Stu *stu, Gc *gc)
+{
+    Gc_push_marked_young(stu, gc);
+    Gc_mark_stack_drain(stu, Gc_push_marked_young);
+}
+
+static void
+Gc_note_young(Stu *stu, Gc *gc)
+{
+    if (GC_IS_YOUNG(gc))
+        stu->gc_young_child = 1;
+}
+
+static int
+Gc_has_young_child(Stu *stu, Gc *gc)
+{
+    stu->gc_young_child = 0;
+    Gc_visit(stu, gc, Gc_note_young);
+
+    return stu->gc_young_child;
+}
+
+static void
+Gc_list_add(Gc **head, Gc **tail, Gc *gc)
+{
+    gc->prev = NULL;
+    gc->next = NULL;
+    if (*head == NULL) {
+        *head = *tail = gc;
+    } else {
+        /* Add to the end of the list. */
+        gc->next = *tail;
+        (*tail)->prev = gc;
+        *tail = gc;
+    }
+}
+
+static void
+Gc_list_del(Gc **head, Gc **tail, Gc *gc)
+{
+    if (gc->prev == NULL)
+        *tail = gc->next;
+    else
+        gc->prev->next = gc->next;
+
+    if (gc->next == NULL)
+        *head = gc->prev;
+    else
+        gc->next->prev = gc->prev;
+}
+
+static void
+Gc_free(Stu *stu, Gc *gc)
+{
+    Sv *sv = NULL;
+    Env *env = NULL;
+    Code *code = NULL;
+
+    Gc_del(stu, gc);
+    switch (GC_TYPE(gc)) {
+    case GC_TYPE_SV:
+        sv = (Sv *) gc;
+        Sv_destroy(stu, &sv);
+        break;
+
+    case GC_TYPE_ENV:
+        env = (Env *) gc;
+        Env_destroy(stu, &env);
+        break;
+
+    case GC_TYPE_CODE:
+        code = (Code *) gc;
+        Code_destroy(stu, &code);
+        break;
+    }
+}
+
+/*
+ * Objects saved directly in a scope may still be under construction, so
+ * they are pinned in the young generation until their scope is gone.
+ */
+static void
+Gc_mark_scopes(Stu *stu, void (*action)(Stu *, Gc *))
+{
+    for (long i = 0; i < stu->gc_roots_size; i++) {
+        Gc *gc = stu->gc_roots[i];
+        if (GC_IS_YOUNG(gc)) {
+            gc->flags |= GC_PINNED_MASK;
+            action(stu, gc);
+        } else if (action == Gc_mark_young) {
+            Gc_visit(stu, gc, Gc_mark_young);
+        } else {
+            action(stu, gc);
+        }
+    }
+}
+
+static void
+Gc_mark_roots(Stu *stu, void (*action)(Stu *, Gc *))
+{
+    action(stu, (Gc *) stu->main_env);
+    Call_stack_visit(stu, action);
+    action(stu, (Gc *) stu->env_capture_head);
+    Vm_visit_roots(stu, action);
+    Mod_cache_visit(stu, action);
+    Gc_mark_scopes(stu, action);
+}
+
+/*
+ * Free the unreachable young objects, and promote the reachable ones
+ * which are not pinned. Promoted objects keep their mark if keep_marks
+ * is set. Returns the last old object from before the promotions.
+ */
+static Gc
+*Gc_promote(Stu *stu, int keep_marks)
+{
+    Gc *cur = stu->gc_head, *next = NULL, *boundary = stu->gc_old_tail;
+
+    while (cur) {
+        next = cur->prev;
+        if (GC_SWEEPABLE(cur)) {
+            Gc_free(stu, cur);
+        } else if (!(cur->flags & GC_PINNED_MASK)) {
+            Gc_list_del(&stu->gc_head, &stu->gc_tail, cur);
+            if (!keep_marks)
+                GC_UNMARK(cur);
+            cur->flags |= GC_OLD_MASK;
+            Gc_list_add(&stu->gc_old_head, &stu->gc_old_tail, cur);
+            stu->gc_old_count++;
+        }
+        cur = next;
+    }
+
+    return boundary;
+}
+
+/* Unpin and unmark the young objects left after promotion. */
+static void
+Gc_unpin(Stu *stu)
+{
+    for (Gc *cur = stu->gc_head; cur; cur = cur->prev) {
+        GC_UNMARK(cur);
+        cur->flags &= ~GC_PINNED_MASK;
+    }
+}
+
+static void
+Gc_forget(Stu *stu)
+{
+    for (long i = 0; i < stu->gc_remembered_size; i++)
+        stu->gc_remembered[i]->flags &= ~GC_REMEMBERED_MASK;
+    stu->gc_remembered_size = 0;
+}
+
+/*
+ * Collect the young generation. Old objects are not traced, apart from
+ * the remembered ones which may point to young objects.
+ */
+static void
+Gc_collect_minor(Stu *stu)
+{
+    Gc *cur, *boundary;
+    long num_remembered = stu->gc_remembered_size;
+    Gc **remembered = NULL;
+
+    Gc_mark_roots(stu, Gc_mark_young);
+    for (long i = 0; i < num_remembered; i++)
+        Gc_visit(stu, stu->gc_remembered[i], Gc_mark_young);
+
+    /* Take the remembered set, to be rebuilt below. */
+    if (num_remembered > 0) {
+        remembered = CHECKED_MALLOC(num_remembered * sizeof(*remembered));
+        memcpy(remembered, stu->gc_remembered, num_remembered * sizeof(*remembered));
     }
+    Gc_forget(stu);
+
+    boundary = Gc_promote(stu, 0);
+
+    /* Only pinned objects are young now; remember anything pointing to one. */
+    for (long i = 0; i < num_remembered; i++) {
+        if (Gc_has_young_child(stu, remembered[i]))
+            Gc_remember(stu, remembered[i]);
+    }
+    for (cur = boundary ? boundary->prev : stu->gc_old_head; cur; cur = cur->prev) {
+        if (Gc_has_young_child(stu, cur))
+            Gc_remember(stu, cur);
+    }
+
+    Gc_unpin(stu);
+    free(remembered);
 }
 
+/* Collect both generations. */
 static void
-Gc_mark_scope(Stu *stu, Scope *scope)
+Gc_collect_major(Stu *stu)
 {
-    for (; scope; scope = scope->prev)
-        Gc_mark(stu, scope->val);
+    Gc *cur, *next;
+
+    Gc_mark_roots(stu, Gc_mark);
+    Gc_forget(stu);
+    Gc_promote(stu, 1);
+
+    for (cur = stu->gc_old_head; cur; cur = next) {
+        next = cur->prev;
+        if (GC_SWEEPABLE(cur)) {
+            Gc_free(stu, cur);
+        } else {
+            GC_UNMARK(cur);
+            if (Gc_has_young_child(stu, cur))
+                Gc_remember(stu, cur);
+        }
+    }
+
+    Gc_unpin(stu);
+    stu->gc_old_live = stu->gc_old_count;
+    stu->gc_allocs_since_major = 0;
+    stu->stats_gc_major_collections++;
+}
+
+/* The memory held by the allocators of gc-managed objects. */
+extern size_t
+Gc_heap_bytes(Stu *stu)
+{
+    return stu->sv_alloc->heap_bytes
+        + stu->env_alloc->heap_bytes
+        + stu->sv_special_alloc->heap_bytes
+        + stu->sv_ufunc_alloc->heap_bytes
+        + stu->code_alloc->heap_bytes
+        + stu->payload_alloc->heap_bytes;
+}
+
+static void
+Gc_trim(Stu *stu)
+{
+    Alloc_trim(stu->sv_alloc);
+    Alloc_trim(stu->env_alloc);
+    Alloc_trim(stu->sv_special_alloc);
+    Alloc_trim(stu->sv_ufunc_alloc);
+    Alloc_trim(stu->code_alloc);
+    Alloc_trim(stu->payload_alloc);
+}
+
+/*
+ * Once the heap has grown past the soft limit everything is collected,
+ * rather than waiting for the allocation threshold. If that does not
+ * bring the heap back under the limit it is allowed to grow by half
+ * again before the next such collection. While it stays over the limit,
+ * the old generation is also collected each time as many objects have
+ * been allocated as it held, so old garbage cannot sit in the heap just
+ * because nothing new is surviving.
+ */
+static void
+Gc_set_heap_trigger(Stu *stu)
+{
+    size_t heap = Gc_heap_bytes(stu);
+
+    stu->gc_heap_trigger = heap > stu->gc_heap_limit
+        ? heap + heap / 2 : stu->gc_heap_limit;
 }
 
 extern void
-Gc_collect(Stu *stu)
+Gc_set_heap_limit(Stu *stu, size_t limit)
+{
+    stu->gc_heap_limit = limit;
+    Gc_set_heap_trigger(stu);
+}
+
+static uint64_t
+now_ns(void)
 {
-    int before_collect = stu->stats_gc_managed_objects, i;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    if (stu->gc_allocs > GC_THRESHOLD) {
-        Gc_mark(stu, (Gc *) stu->main_env);
-        for (Scope *scope = stu->gc_scope_stack; scope; scope = scope->stack_prev)
-            Gc_mark_scope(stu, scope);
-        Gc_sweep(stu, 0);
+extern void
+Gc_collect(Stu *stu)
+{
+    long before_collect = stu->stats_gc_managed_objects;
+    uint64_t start, pause;
+    size_t heap = stu->gc_heap_limit > 0 ? Gc_heap_bytes(stu) : 0;
+    int over_limit = stu->gc_heap_limit > 0
+        && (heap > stu->gc_heap_trigger
+            || (heap > stu->gc_heap_limit
+                && stu->gc_allocs_since_major > stu->gc_old_live));
+
+    if (stu->gc_allocs > GC_THRESHOLD || over_limit) {
+        /* The old generation is collected once it has doubled. */
+        start = now_ns();
+        stu->gc_allocs_since_major += stu->gc_allocs;
+        if (over_limit || stu->gc_old_count > 2 * stu->gc_old_live + GC_THRESHOLD)
+            Gc_collect_major(stu);
+        else
+            Gc_collect_minor(stu);
+        Gc_trim(stu);
+        if (stu->gc_heap_limit > 0)
+            Gc_set_heap_trigger(stu);
         stu->gc_allocs = 0;
         stu->stats_gc_cleaned += (before_collect - stu->stats_gc_managed_objects);
         stu->stats_gc_collections++;
+
+        pause = now_ns() - start;
+        stu->stats_gc_pause_ns += pause;
+        if (pause > stu->stats_gc_pause_max_ns)
+            stu->stats_gc_pause_max_ns = pause;
     }
 }
 
+extern void
+Gc_remember(Stu *stu, Gc *gc)
+{
+    if (stu->gc_remembered_size == stu->gc_remembered_capacity) {
+        stu->gc_remembered_capacity = stu->gc_remembered_capacity
+            ? stu->gc_remembered_capacity * 2 : GC_REMEMBERED_INITIAL_SIZE;
+        stu->gc_remembered = CHECKED_REALLOC(
+            stu->gc_remembered,
+            stu->gc_remembered_capacity * sizeof(*stu->gc_remembered));
+    }
+    gc->flags |= GC_REMEMBERED_MASK;
+    stu->gc_remembered[stu->gc_remembered_size++] = gc;
+}
+
 extern void
 Gc_scope_push(Stu *stu)
 {
-    Scope *new = Alloc_allocate(stu->gc_scope_alloc);
-    new->stack_prev = stu->gc_scope_stack;
-    stu->gc_scope_stack = new;
+    if (stu->gc_scopes_size == stu->gc_scopes_capacity) {
+        stu->gc_scopes_capacity = stu->gc_scopes_capacity
+            ? stu->gc_scopes_capacity * 2 : GC_SCOPES_INITIAL_SIZE;
+        stu->gc_scopes = CHECKED_REALLOC(
+            stu->gc_scopes, stu->gc_scopes_capacity * sizeof(*stu->gc_scopes));
+    }
+    stu->gc_scopes[stu->gc_scopes_size++] = stu->gc_roots_size;
     stu->stats_gc_scope_pushes += 1;
+    if ((uint64_t) stu->gc_scopes_size > stu->stats_gc_scope_depth_max)
+        stu->stats_gc_scope_depth_max = stu->gc_scopes_size;
 }
 
 extern void
 Gc_scope_pop(Stu *stu)
 {
-    Scope *old = stu->gc_scope_stack, *prev = NULL;
-
-    if (old != NULL)
-        stu->gc_scope_stack = old->stack_prev;
-    else
+    if (stu->gc_scopes_size == 0)
         return;
 
-    while (old) {
-        prev = old->prev;
-        Alloc_release(stu->gc_scope_alloc, old);
-        old = prev;
-    }
-
+    stu->gc_roots_size = stu->gc_scopes[--stu->gc_scopes_size];
     stu->stats_gc_scope_pops += 1;
 }
 
-/* Save result in the top scope if it exists. */
+/* Discard every scope above the first size scopes at once. */
+extern void
+Gc_scope_restore(Stu *stu, int size)
+{
+    if (size < stu->gc_scopes_size) {
+        stu->stats_gc_scope_pops += stu->gc_scopes_size - size;
+        stu->gc_scopes_size = size;
+        stu->gc_roots_size = stu->gc_scopes[size];
+    }
+}
+
+/* Save result in the top scope if it exists; immediates need no saving. */
 extern
 void Gc_scope_save(Stu *stu, Gc *gc)
 {
-    Scope *new, *top = stu->gc_scope_stack;
-
-    if (top) {
-        new = Alloc_allocate(stu->gc_scope_alloc);
-        new->prev = top->prev;
-        top->prev = new;
-        new->val = gc;
+    if (stu->gc_scopes_size > 0 && GC_IS_REF(gc)) {
+        if (stu->gc_roots_size == stu->gc_roots_capacity) {
+            stu->gc_roots_capacity = stu->gc_roots_capacity
+                ? stu->gc_roots_capacity * 2 : GC_ROOTS_INITIAL_SIZE;
+            stu->gc_roots = CHECKED_REALLOC(
+                stu->gc_roots, stu->gc_roots_capacity * sizeof(*stu->gc_roots));
+        }
+        stu->gc_roots[stu->gc_roots_size++] = gc;
     }
 }
 
@@ -157,137 +579,109 @@ Gc_add(Stu *stu, Gc *gc)
     stu->stats_gc_managed_objects++;
     stu->stats_gc_allocs++;
     stu->gc_allocs++;
-    if (stu->gc_head == NULL) {
-        stu->gc_head = stu->gc_tail = gc;
-    } else {
-        /* Add to the end of the list. */
-        gc->next = stu->gc_tail;
-        stu->gc_tail->prev = gc;
-        stu->gc_tail = gc;
-    }
-
+    Gc_list_add(&stu->gc_head, &stu->gc_tail, gc);
     Gc_scope_save(stu, gc);
 }
 
+/*
+ * Add an object straight to the old generation. This is for objects
+ * loaded from an image, which point only to each other and so need no
+ * remembering.
+ */
+extern void
+Gc_add_old(Stu *stu, Gc *gc)
+{
+    stu->stats_gc_managed_objects++;
+    stu->stats_gc_allocs++;
+    gc->flags |= GC_OLD_MASK;
+    Gc_list_add(&stu->gc_old_head, &stu->gc_old_tail, gc);
+    stu->gc_old_count++;
+    stu->gc_old_live++;
+}
+
 extern void
 Gc_del(Stu *stu, Gc *gc)
 {
     stu->stats_gc_managed_objects--;
     stu->stats_gc_frees++;
 
-    if (gc->prev == NULL)
-        stu->gc_tail = gc->next;
-    else
-        gc->prev->next = gc->next;
-
-    if (gc->next == NULL)
-        stu->gc_head = gc->prev;
-    else
-        gc->next->prev = gc->prev;
+    if (gc->flags & GC_OLD_MASK) {
+        Gc_list_del(&stu->gc_old_head, &stu->gc_old_tail, gc);
+        stu->gc_old_count--;
+    } else {
+        Gc_list_del(&stu->gc_head, &stu->gc_tail, gc);
+    }
 }
 
 extern void
 Gc_mark(Stu *stu, Gc *gc)
 {
-    if (gc && !GC_MARKED(gc)) {
-        GC_MARK(gc);
-        switch (gc->flags >> GC_TYPE_BITS) {
-        case GC_TYPE_SV:
-            Gc_visit_sv(stu, (Sv *) gc, Gc_mark);
-            break;
-
-        case GC_TYPE_ENV:
-            Gc_visit_env(stu, (Env *) gc, Gc_mark);
-            break;
-        }
-    }
+    Gc_push_marked(stu, gc);
+    Gc_mark_stack_drain(stu, Gc_push_marked);
 }
 
 extern void
 Gc_lock(Stu *stu, Gc *gc)
 {
-    if (gc && !GC_LOCKED(gc)) {
-        GC_LOCK(gc);
-        switch (gc->flags >> GC_TYPE_BITS) {
-        case GC_TYPE_SV:
-            Gc_visit_sv(stu, (Sv *) gc, Gc_lock);
-            break;
-
-        case GC_TYPE_ENV:
-            Gc_visit_env(stu, (Env *) gc, Gc_lock);
-            break;
-        }
-    }
+    Gc_push_locked(stu, gc);
+    Gc_mark_stack_drain(stu, Gc_push_locked);
 }
 
 extern void
 Gc_unlock(Stu *stu, Gc *gc)
 {
-    if (gc && !GC_LOCKED(gc)) {
+    if (GC_IS_REF(gc) && !GC_LOCKED(gc)) {
         GC_UNLOCK(gc);
-        switch (gc->flags >> GC_TYPE_BITS) {
-        case GC_TYPE_SV:
-            if (!IS_NIL((Sv *) gc))
-                Gc_visit_sv(stu, (Sv *) gc, Gc_unlock);
-            break;
-
-        case GC_TYPE_ENV:
-            Gc_visit_env(stu, (Env *) gc, Gc_unlock);
-            break;
-        }
+        Gc_visit(stu, gc, Gc_unlock);
     }
 }
 
+/* Free every unreachable object, or every object if unconditional. */
 extern void
 Gc_sweep(Stu *stu, int unconditional)
 {
-    Sv *sv = NULL;
-    Env *env = NULL;
-    Gc *cur = stu->gc_head, *next = NULL;
+    Gc *cur = NULL, *next = NULL;
 
-    while (cur) {
+    for (cur = stu->gc_head; cur; cur = next) {
         next = cur->prev;
-        if (unconditional || GC_SWEEPABLE(cur)) {
-            Gc_del(stu, cur);
-            switch (cur->flags >> GC_TYPE_BITS) {
-            case GC_TYPE_SV:
-                sv = (Sv *) cur;
-                Sv_destroy(stu, &sv);
-                break;
-
-            case GC_TYPE_ENV:
-                env = (Env *) cur;
-                Env_destroy(stu, &env);
-                break;
-            }
-        } else {
+        if (unconditional || GC_SWEEPABLE(cur))
+            Gc_free(stu, cur);
+        else
             GC_UNMARK(cur);
-        }
-        cur = next;
     }
-}
 
-extern int
-Gc_scope_stack_size(struct Stu *stu) {
-    int size = 0;
+    for (cur = stu->gc_old_head; cur; cur = next) {
+        next = cur->prev;
+        if (unconditional || GC_SWEEPABLE(cur))
+            Gc_free(stu, cur);
+        else
+            GC_UNMARK(cur);
+    }
 
-    for (Scope *s = stu->gc_scope_stack; s; s = s->stack_prev) {
-        size += 1;
+    if (unconditional) {
+        free(stu->gc_remembered);
+        stu->gc_remembered = NULL;
+        stu->gc_remembered_size = stu->gc_remembered_capacity = 0;
     }
+}
 
-    return size;
+extern int
+Gc_scope_stack_size(struct Stu *stu) {
+    return stu->gc_scopes_size;
 }
 
 extern void
 Gc_dump_stats(Stu *stu, FILE *out)
 {
     fprintf(out, "--\n");
-    fprintf(out, "Number of gcs:       %d\n", stu->stats_gc_collections);
-    fprintf(out, "Number of allocs:    %d\n", stu->stats_gc_allocs);
-    fprintf(out, "Number of frees:     %d\n", stu->stats_gc_frees);
-    fprintf(out, "Scope pushes:        %d\n", stu->stats_gc_scope_pushes);
-    fprintf(out, "Scope pops:          %d\n", stu->stats_gc_scope_pops);
-    fprintf(out, "Avg cleanups per gc: %.2f (%d cleaned)\n",
+    fprintf(out, "Number of gcs:       %" PRIu64 " (%" PRIu64 " major)\n",
+        stu->stats_gc_collections, stu->stats_gc_major_collections);
+    fprintf(out, "Number of allocs:    %" PRIu64 "\n", stu->stats_gc_allocs);
+    fprintf(out, "Number of frees:     %" PRIu64 "\n", stu->stats_gc_frees);
+    fprintf(out, "Scope pushes:        %" PRIu64 "\n", stu->stats_gc_scope_pushes);
+    fprintf(out, "Scope pops:          %" PRIu64 "\n", stu->stats_gc_scope_pops);
+    fprintf(out, "Heap bytes:          %zu\n", Gc_heap_bytes(stu));
+    fprintf(out, "Avg cleanups per gc: %.2f (%" PRIu64 " cleaned)\n",
         stu->stats_gc_cleaned / (stu->stats_gc_collections + 1.0),
         stu->stats_gc_cleaned);
 }
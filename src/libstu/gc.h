@@ -18,34 +18,62 @@
 #define GC_DEFINED
 
 #include <stdio.h>
+#include <stdint.h>
 
-#define GC_MARK_MASK  0x01
-#define GC_LOCK_MASK  0x02
-#define GC_TYPE_MASK  0xF0
-#define GC_TYPE_BITS  4
-#define GC_TYPE_SV    0x01
-#define GC_TYPE_ENV   0x02
+#define GC_MARK_MASK       0x01
+#define GC_LOCK_MASK       0x02
+#define GC_OLD_MASK        0x04
+#define GC_REMEMBERED_MASK 0x08
+#define GC_TYPE_MASK       0xF0
+#define GC_PINNED_MASK     0x100
+#define GC_TYPE_BITS       4
+#define GC_TYPE_SV         0x01
+#define GC_TYPE_ENV        0x02
+#define GC_TYPE_CODE       0x03
+
+/*
+ * Heap objects are at least 8 byte aligned, leaving the low bits of a
+ * pointer free to tag immediate values which are never collected.
+ */
+#define GC_IMM_MASK   0x07
+#define GC_IS_REF(x)  ((x) && !((uintptr_t) (x) & GC_IMM_MASK))
 
 #define PUSH_SCOPE(s)     Gc_scope_push((s))
 #define POP_SCOPE(s)      Gc_scope_pop((s))
 #define POP_N_SAVE(s, x)  POP_SCOPE((s)); Gc_scope_save((s), (Gc *) (x))
 #define PUSH_N_SAVE(s, x) PUSH_SCOPE((s)); Gc_scope_save((s), (Gc *) (x))
 #define SCOPE_SAVE(s, x)  Gc_scope_save((s), (Gc *) (x))
-#define GC_SWEEPABLE(x)   ((x) ? !GC_MARKED((x)) && !GC_LOCKED((x)) : 0)
-#define GC_MARKED(x)      ((x) ? (((Gc *) x)->flags & GC_MARK_MASK) : 0)
-#define GC_MARK(x)        ((x) ? (((Gc *) x)->flags |= GC_MARK_MASK) : 0)
-#define GC_UNMARK(x)      ((x) ? (((Gc *) x)->flags &= ~GC_MARK_MASK) : 0)
-#define GC_LOCKED(x)      ((x) ? (((Gc *) x)->flags & GC_LOCK_MASK) : 0)
-#define GC_LOCK(x)        ((x) ? (((Gc *) x)->flags |= GC_LOCK_MASK) : 0)
-#define GC_UNLOCK(x)      ((x) ? (((Gc *) x)->flags &= ~GC_LOCK_MASK) : 0)
-#define GC_PREV(x)        ((x) ? (((Gc *) x)->prev : NULL))
-#define GC_NEXT(x)        ((x) ? (((Gc *) x)->next : NULL))
-#define GC_IS_SV(x)       ((x) ? (((Gc *) x)->flags >> GC_TYPE_BITS) == GC_TYPE_SV : 0)
-#define GC_IS_ENV(x)      ((x) ? (((Gc *) x)->flags >> GC_TYPE_BITS) == GC_TYPE_ENV : 0)
+#define GC_SWEEPABLE(x)   (GC_IS_REF(x) ? !GC_MARKED((x)) && !GC_LOCKED((x)) : 0)
+#define GC_MARKED(x)      (GC_IS_REF(x) ? (((Gc *) x)->flags & GC_MARK_MASK) : 0)
+#define GC_MARK(x)        (GC_IS_REF(x) ? (((Gc *) x)->flags |= GC_MARK_MASK) : 0)
+#define GC_UNMARK(x)      (GC_IS_REF(x) ? (((Gc *) x)->flags &= ~GC_MARK_MASK) : 0)
+#define GC_LOCKED(x)      (GC_IS_REF(x) ? (((Gc *) x)->flags & GC_LOCK_MASK) : 0)
+#define GC_LOCK(x)        (GC_IS_REF(x) ? (((Gc *) x)->flags |= GC_LOCK_MASK) : 0)
+#define GC_UNLOCK(x)      (GC_IS_REF(x) ? (((Gc *) x)->flags &= ~GC_LOCK_MASK) : 0)
+#define GC_PREV(x)        (GC_IS_REF(x) ? (((Gc *) x)->prev : NULL))
+#define GC_NEXT(x)        (GC_IS_REF(x) ? (((Gc *) x)->next : NULL))
+#define GC_TYPE(x)        ((((Gc *) (x))->flags & GC_TYPE_MASK) >> GC_TYPE_BITS)
+#define GC_IS_SV(x)       (GC_IS_REF(x) ? GC_TYPE(x) == GC_TYPE_SV : 0)
+#define GC_IS_ENV(x)      (GC_IS_REF(x) ? GC_TYPE(x) == GC_TYPE_ENV : 0)
+#define GC_IS_CODE(x)     (GC_IS_REF(x) ? GC_TYPE(x) == GC_TYPE_CODE : 0)
+#define GC_IS_OLD(x)      (GC_IS_REF(x) ? (((Gc *) (x))->flags & GC_OLD_MASK) : 0)
+#define GC_IS_YOUNG(x)    (GC_IS_REF(x) ? !(((Gc *) (x))->flags & GC_OLD_MASK) : 0)
 #define GC_INIT(s, x, t)  ((x) ? (((Gc *) x)->flags = (t << GC_TYPE_BITS)) : 0); \
                               Gc_add(s, ((Gc *) x)); \
                               Gc_collect(s)
 
+/*
+ * Write barrier, for storing y into x after x was created. An old object
+ * pointing to a young one is remembered so that a minor collection will
+ * still find the young object.
+ */
+#define GC_WRITE(s, x, y) \
+    do { \
+        if (GC_IS_OLD(x) && GC_IS_YOUNG(y) \
+            && !(((Gc *) (x))->flags & GC_REMEMBERED_MASK)) \
+            Gc_remember((s), (Gc *) (x)); \
+    } while (0)
+
 /* Forward declarations. */
 struct Stu;
 
@@ -53,27 +81,25 @@ struct Gc;
 typedef struct Gc {
     struct Gc *next;
     struct Gc *prev;
-    unsigned char flags; /* Contains "mark" & object type. */
+    unsigned short flags; /* Contains "mark", generation & object type. */
 } Gc;
 
-struct Scope;
-typedef struct Scope {
-    struct Scope *stack_prev;
-    struct Scope *prev;
-    Gc *val;
-} Scope;
-
 extern void Gc_collect(struct Stu *);
 extern void Gc_add(struct Stu *, Gc *);
+extern void Gc_add_old(struct Stu *, Gc *);
 extern void Gc_del(struct Stu *, Gc *);
 extern void Gc_lock(struct Stu *, Gc *);
 extern void Gc_unlock(struct Stu *, Gc *);
 extern void Gc_mark(struct Stu *, Gc *);
+extern void Gc_remember(struct Stu *, Gc *);
 extern void Gc_sweep(struct Stu *, int);
 extern void Gc_scope_push(struct Stu *);
 extern void Gc_scope_pop(struct Stu *);
 extern void Gc_scope_save(struct Stu *, Gc *);
 extern int Gc_scope_stack_size(struct Stu *);
+extern void Gc_scope_restore(struct Stu *, int);
+extern size_t Gc_heap_bytes(struct Stu *);
+extern void Gc_set_heap_limit(struct Stu *, size_t);
 extern void Gc_dump_stats(struct Stu *, FILE *);
 
 #endif
@@ -21,16 +21,57 @@
 #include "hash.h"
 #include "utils.h"
 
-unsigned int
-hash_key(const char *key)
+/* Resize once the table is more than this fraction (in quarters) full. */
+#define HASH_MAX_LOAD 3
+
+static unsigned int
+hash_key(const char *key, size_t *len)
 {
+    const char *start = key;
     int c;
     unsigned int h = 5381;
 
     while((c = *key++))
         h = ((h << 5) + h) + c;
+    *len = key - start - 1;
+
+    return h;
+}
+
+/* Find the slot holding key, or the empty slot where it would go. */
+static size_t
+find_slot(Hash *hash, const char *key, unsigned int h, size_t len)
+{
+    size_t mask = hash->num_slots - 1, i = h & mask;
+    Hash_ent *ent;
+
+    while ((ent = hash->slots[i]) != NULL) {
+        if (ent->hash == h && ent->len == len && !memcmp(ent->k, key, len))
+            break;
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+static void
+resize(Hash *hash, size_t num_slots)
+{
+    Hash_ent **old = hash->slots;
+    size_t old_num_slots = hash->num_slots, mask = num_slots - 1, i, j;
+
+    hash->slots = CHECKED_CALLOC(num_slots, sizeof(*hash->slots));
+    hash->num_slots = num_slots;
+
+    for (i = 0; i < old_num_slots; i++) {
+        if (old[i] != NULL) {
+            for (j = old[i]->hash & mask; hash->slots[j]; j = (j + 1) & mask)
+                ;
+            hash->slots[j] = old[i];
+        }
+    }
 
-    return h % HASH_SIZE;
+    free(old);
 }
 
 extern Hash
@@ -39,6 +80,8 @@ extern Hash
     Hash *new = CHECKED_CALLOC(1, sizeof(*new));
     new->destroy = destroy;
     new->arg = arg;
+    new->num_slots = HASH_INITIAL_SIZE;
+    new->slots = CHECKED_CALLOC(new->num_slots, sizeof(*new->slots));
     return new;
 }
 
@@ -58,6 +101,7 @@ Hash_destroy(Hash **to_destroy)
         free(cur);
     }
 
+    free(hash->slots);
     free(hash);
     *to_destroy = NULL;
 }
@@ -66,15 +110,22 @@ extern void
 Hash_put(Hash *hash, const char *key, void *value)
 {
     Hash_ent *new;
+    unsigned int h;
+    size_t len, i;
 
     if (key == NULL)
         return;
 
     Hash_del(hash, key);
-    hash->num_entries++;
-    new = CHECKED_CALLOC(1, sizeof(*new));
+    if ((hash->num_entries + 1) * 4 > hash->num_slots * HASH_MAX_LOAD)
+        resize(hash, hash->num_slots * 2);
 
-    sstrncpy(new->k, key, MAX_KEY_LEN);
+    hash->num_entries++;
+    h = hash_key(key, &len);
+    new = CHECKED_CALLOC(1, sizeof(*new) + len + 1);
+    memcpy(new->k, key, len + 1);
+    new->len = len;
+    new->hash = h;
     new->v = value;
 
     /* Add to the end of the entries list.  */
@@ -86,69 +137,72 @@ Hash_put(Hash *hash, const char *key, void *value)
         hash->entries[TAIL] = new;
     }
 
-    /* Finally add to the relevant bucket. */
-    long i = hash_key(key);
-    if (hash->buckets[i] == NULL) {
-        hash->buckets[i] = new;
-    } else {
-        /* Collision, prepend new entry. */
-        new->collisions[PREV] = hash->buckets[i];
-        hash->buckets[i]->collisions[NEXT] = new;
-        hash->buckets[i] = new;
-    }
+    /* Finally take the first free slot. */
+    i = find_slot(hash, key, h, len);
+    hash->slots[i] = new;
 }
 
 extern Hash_ent
 *Hash_get(Hash *hash, const char *key)
 {
-    Hash_ent *ent = NULL;
+    unsigned int h;
+    size_t len;
 
     if (key == NULL)
         return NULL;
 
-    long i = hash_key(key);
-    for (ent = hash->buckets[i]; ent; ent = ent->collisions[PREV]) {
-        if (!strcmp(ent->k, key))
-            break;
-    }
+    h = hash_key(key, &len);
 
-    return ent;
+    return hash->slots[find_slot(hash, key, h, len)];
 }
 
 extern void
 Hash_del(Hash *hash, const char *key)
 {
     Hash_ent *ent;
+    unsigned int h;
+    size_t len, mask = hash->num_slots - 1, i, j, home;
 
-    ent = Hash_get(hash, key);
-    if (ent != NULL) {
-        hash->num_entries--;
-        if (hash->destroy)
-            hash->destroy(ent, hash->arg);
-
-        /* Remove from entries list. */
-        if (ent->entries[PREV] == NULL)
-            hash->entries[TAIL] = ent->entries[NEXT];
-        else
-            ent->entries[PREV]->entries[NEXT] = ent->entries[NEXT];
-
-        if (ent->entries[NEXT] == NULL)
-            hash->entries[HEAD] = ent->entries[PREV];
-        else
-            ent->entries[NEXT]->entries[PREV] = ent->entries[PREV];
-
-        /* Remove from collisions list. */
-        long i = hash_key(key);
-        if (ent->collisions[PREV] != NULL)
-            ent->collisions[PREV]->collisions[NEXT] = ent->collisions[NEXT];
-
-        if (ent->collisions[NEXT] == NULL)
-            hash->buckets[i] = ent->collisions[PREV];
-        else
-            ent->collisions[NEXT]->collisions[PREV] = ent->collisions[PREV];
-
-        free(ent);
+    if (key == NULL)
+        return;
+
+    h = hash_key(key, &len);
+    i = find_slot(hash, key, h, len);
+    if ((ent = hash->slots[i]) == NULL)
+        return;
+
+    hash->num_entries--;
+    if (hash->destroy)
+        hash->destroy(ent, hash->arg);
+
+    /* Remove from entries list. */
+    if (ent->entries[PREV] == NULL)
+        hash->entries[TAIL] = ent->entries[NEXT];
+    else
+        ent->entries[PREV]->entries[NEXT] = ent->entries[NEXT];
+
+    if (ent->entries[NEXT] == NULL)
+        hash->entries[HEAD] = ent->entries[PREV];
+    else
+        ent->entries[NEXT]->entries[PREV] = ent->entries[PREV];
+
+    /*
+     * Empty the slot, then move back any following entries which
+     * could not reach their home slot past it.
+     */
+    hash->slots[i] = NULL;
+    for (j = (i + 1) & mask; hash->slots[j]; j = (j + 1) & mask) {
+        home = hash->slots[j]->hash & mask;
+        if ((j > i && (home <= i || home > j))
+            || (j < i && (home <= i && home > j)))
+        {
+            hash->slots[i] = hash->slots[j];
+            hash->slots[j] = NULL;
+            i = j;
+        }
     }
+
+    free(ent);
 }
 
 extern Hash_ent
@@ -17,8 +17,9 @@
 #ifndef HASH_DEFINED
 #define HASH_DEFINED
 
-#define MAX_KEY_LEN 255
-#define HASH_SIZE   97
+#include <stddef.h>
+
+#define HASH_INITIAL_SIZE 16
 #define PREV        0
 #define NEXT        1
 #define HEAD        0
@@ -30,17 +31,24 @@
 struct Hash_ent;
 typedef struct Hash_ent {
     struct Hash_ent *entries[2];
-    struct Hash_ent *collisions[2];
-    char  k[MAX_KEY_LEN + 1];
     void *v;
+    unsigned int hash;
+    size_t len;
+    char k[];
 } Hash_ent;
 
+/*
+ * An open addressing table of entries, probed linearly from the slot
+ * given by the hash of the key. The entries are also kept in a list in
+ * insertion order.
+ */
 typedef struct Hash {
     int  num_entries;
     void (*destroy)(struct Hash_ent *entry, void *);
     void *arg;
     struct Hash_ent *entries[2];
-    struct Hash_ent *buckets[HASH_SIZE];
+    struct Hash_ent **slots;
+    size_t num_slots;
 } Hash;
 
 extern Hash *Hash_new(void (*destroy)(Hash_ent *entry, void *arg), void *arg);
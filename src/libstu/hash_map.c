@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "alloc/alloc.h"
+#include "hash_map.h"
+#include "stu_private.h"
+#include "sv.h"
+
+#define EMPTY -1
+
+/* Spread the bits of x over the whole word. */
+static unsigned long
+mix(unsigned long x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+static unsigned long
+hash_key(struct Sv *x)
+{
+    unsigned long h = 0xcbf29ce484222325UL;
+    const char *s;
+
+    switch (SV_TYPE(x)) {
+    case SV_INT:
+    case SV_SYM:
+        return mix(SV_I(x));
+
+    case SV_RATIONAL:
+        return mix(x->val.rational.n * 31 + x->val.rational.d);
+
+    case SV_STR:
+        for (s = x->val.buf ? x->val.buf : ""; *s; s++)
+            h = (h ^ (unsigned char) *s) * 0x100000001b3UL;
+        return h;
+
+    default:
+        return mix((uintptr_t) x);
+    }
+}
+
+static int
+keys_equal(struct Sv *x, struct Sv *y)
+{
+    if (x == y)
+        return 1;
+    if (SV_TYPE(x) != SV_TYPE(y))
+        return 0;
+
+    switch (SV_TYPE(x)) {
+    case SV_INT:
+        return SV_I(x) == SV_I(y);
+
+    case SV_RATIONAL:
+        return x->val.rational.n == y->val.rational.n
+            && x->val.rational.d == y->val.rational.d;
+
+    case SV_STR:
+        return x->val.buf && y->val.buf && strcmp(x->val.buf, y->val.buf) == 0;
+
+    default:
+        return 0;
+    }
+}
+
+/* Make a map with used entries for the caller to fill in, and no index. */
+extern Hash_map
+*Hash_map_new(Stu *stu, long used)
+{
+    Hash_map *map = Alloc_allocate_size(stu->payload_alloc, sizeof(*map));
+    size_t size;
+
+    map->count = 0;
+    map->used = used;
+    map->capacity = HASH_MAP_INITIAL_SIZE;
+    while (map->capacity < used)
+        map->capacity *= 2;
+    map->num_slots = 0;
+    map->slots = NULL;
+    size = map->capacity * sizeof(*map->entries);
+    map->entries = memset(Alloc_allocate_size(stu->payload_alloc, size), 0, size);
+
+    return map;
+}
+
+extern void
+Hash_map_destroy(Stu *stu, Hash_map *map)
+{
+    if (map->slots)
+        Alloc_release(stu->payload_alloc, map->slots);
+    Alloc_release(stu->payload_alloc, map->entries);
+    Alloc_release(stu->payload_alloc, map);
+}
+
+/*
+ * Move the live entries into an array of capacity, dropping deleted
+ * ones, and index them all again.
+ */
+static void
+rebuild(Stu *stu, Hash_map *map, long capacity)
+{
+    Hash_map_ent *entries = map->entries, *e;
+    long i, j, mask;
+
+    if (capacity != map->capacity) {
+        entries = Alloc_allocate_size(stu->payload_alloc, capacity * sizeof(*entries));
+        memset(entries, 0, capacity * sizeof(*entries));
+    }
+    for (i = 0, j = 0; i < map->used; i++) {
+        if (map->entries[i].key != NULL) {
+            entries[j] = map->entries[i];
+            if (map->slots == NULL)
+                entries[j].hash = hash_key(entries[j].key);
+            j++;
+        }
+    }
+    if (entries != map->entries) {
+        Alloc_release(stu->payload_alloc, map->entries);
+        map->entries = entries;
+    } else {
+        memset(entries + j, 0, (map->used - j) * sizeof(*entries));
+    }
+    map->count = map->used = j;
+
+    if (map->slots == NULL || map->capacity != capacity) {
+        if (map->slots)
+            Alloc_release(stu->payload_alloc, map->slots);
+        map->num_slots = capacity * 2;
+        map->slots = Alloc_allocate_size(
+            stu->payload_alloc, map->num_slots * sizeof(*map->slots));
+    }
+    map->capacity = capacity;
+
+    mask = map->num_slots - 1;
+    for (i = 0; i < map->num_slots; i++)
+        map->slots[i] = EMPTY;
+    for (i = 0; i < map->used; i++) {
+        e = &map->entries[i];
+        for (j = e->hash & mask; map->slots[j] != EMPTY; j = (j + 1) & mask);
+        map->slots[j] = i;
+    }
+}
+
+/* Find the slot for key, which is either empty or indexes its entry. */
+static long
+find_slot(Stu *stu, Hash_map *map, struct Sv *key, unsigned long hash)
+{
+    long mask, i;
+    Hash_map_ent *e;
+
+    if (map->slots == NULL)
+        rebuild(stu, map, map->capacity);
+
+    mask = map->num_slots - 1;
+    for (i = hash & mask; map->slots[i] != EMPTY; i = (i + 1) & mask) {
+        e = &map->entries[map->slots[i]];
+        if (e->hash == hash && e->key != NULL && keys_equal(e->key, key))
+            break;
+    }
+
+    return i;
+}
+
+extern Hash_map_ent
+*Hash_map_get(Stu *stu, Hash_map *map, struct Sv *key)
+{
+    long i;
+
+    key = IS_NIL(key) ? NIL : key;
+    i = find_slot(stu, map, key, hash_key(key));
+
+    return map->slots[i] == EMPTY ? NULL : &map->entries[map->slots[i]];
+}
+
+extern void
+Hash_map_put(Stu *stu, Hash_map *map, struct Sv *key, struct Sv *value)
+{
+    unsigned long hash;
+    Hash_map_ent *e;
+    long i;
+
+    key = IS_NIL(key) ? NIL : key;
+    hash = hash_key(key);
+    i = find_slot(stu, map, key, hash);
+    if (map->slots[i] != EMPTY) {
+        map->entries[map->slots[i]].value = value;
+        return;
+    }
+
+    /* Make room, by clearing out deleted entries if there are enough. */
+    if (map->used == map->capacity) {
+        rebuild(stu, map, map->count * 2 > map->capacity
+                ? map->capacity * 2 : map->capacity);
+        i = find_slot(stu, map, key, hash);
+    }
+
+    e = &map->entries[map->used];
+    e->key = key;
+    e->value = value;
+    e->hash = hash;
+    map->slots[i] = map->used++;
+    map->count++;
+}
+
+/* Delete the entry for key, returning whether there was one. */
+extern int
+Hash_map_del(Stu *stu, Hash_map *map, struct Sv *key)
+{
+    Hash_map_ent *e = Hash_map_get(stu, map, key);
+
+    if (e == NULL)
+        return 0;
+
+    e->key = NULL;
+    e->value = NULL;
+    map->count--;
+
+    return 1;
+}
+
+extern long
+Hash_map_count(Stu *stu, Hash_map *map)
+{
+    if (map->slots == NULL)
+        rebuild(stu, map, map->capacity);
+
+    return map->count;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HASH_MAP_DEFINED
+#define HASH_MAP_DEFINED
+
+#define HASH_MAP_INITIAL_SIZE 8
+
+struct Stu;
+struct Sv;
+
+/* An entry whose key is NULL has been deleted. */
+typedef struct Hash_map_ent {
+    struct Sv *key;
+    struct Sv *value;
+    unsigned long hash;
+} Hash_map_ent;
+
+/*
+ * A table of stu values, kept as an array of entries in insertion order
+ * and an index of slots into it, probed linearly from the slot given by
+ * the hash of the key. Ints, symbols, strings and rationals are hashed
+ * and compared by value, anything else by identity. A missing index is
+ * built from the entries on first use, hashing the keys afresh.
+ */
+typedef struct Hash_map {
+    long count;
+    long used;
+    long capacity;
+    long num_slots;
+    long *slots;
+    Hash_map_ent *entries;
+} Hash_map;
+
+extern Hash_map *Hash_map_new(struct Stu *, long);
+extern void Hash_map_destroy(struct Stu *, Hash_map *);
+extern Hash_map_ent *Hash_map_get(struct Stu *, Hash_map *, struct Sv *);
+extern void Hash_map_put(struct Stu *, Hash_map *, struct Sv *, struct Sv *);
+extern int Hash_map_del(struct Stu *, Hash_map *, struct Sv *);
+extern long Hash_map_count(struct Stu *, Hash_map *);
+
+#endif
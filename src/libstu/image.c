@@ -0,0 +1,1211 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <err.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc/alloc.h"
+#include "builtins.h"
+#include "env.h"
+#include "gc.h"
+#include "image.h"
+#include "native_func.h"
+#include "stu_private.h"
+#include "sv.h"
+#include "symtab.h"
+#include "types.h"
+#include "utils.h"
+
+/*
+ * An image is a header followed by sections of machine words:
+ *
+ *   builtins  the name of each native function, which must match ours
+ *   symbols   every symbol name, in id order
+ *   types     the name and field names of each user type
+ *   objects   the heap reachable from the roots, each object being its
+ *             scalars followed by the references it holds
+ *   roots     the main environment and module include locations
+ *
+ * Immediates are stored as they are. A reference is the position of an
+ * object in the objects section, shifted clear of the immediate tags, so
+ * loading can allocate every object and then relocate the references in
+ * place. Compiled code and macro expansions are left out, and are rebuilt
+ * when first needed. Images are only read by the build that wrote them.
+ *
+ * A forms file caches the parse of a source file, and has the same
+ * layout with a different magic:
+ *
+ *   source    the path, modification time and size of the source
+ *   symbols   the id and name of each symbol used, in id order
+ *   objects   the parsed forms, which may only be of the parser's types
+ *   roots     the list of forms
+ *
+ * Symbol ids are particular to an interpreter, so the symbols are mapped
+ * to those of the loading interpreter as they are relocated.
+ */
+#define IMAGE_REF(i)   (((Image_word) (i) + 1) << SV_TAG_BITS)
+#define IMAGE_INDEX(r) ((long) ((r) >> SV_TAG_BITS) - 1)
+
+#define IMAGE_OBJS_INITIAL_SIZE      1024
+#define IMAGE_TYPE_REFS_INITIAL_SIZE 64
+#define IMAGE_TMP_SUFFIX             ".XXXXXX"
+#define IMAGE_MODE                   0644
+
+typedef uintptr_t Image_word;
+
+typedef struct Image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t word_size;
+} Image_header;
+
+typedef struct Image_entry {
+    Gc *gc;
+    long index;
+} Image_entry;
+
+typedef struct Image_symbol {
+    long id;
+    long new_id;
+} Image_symbol;
+
+typedef struct Image_writer {
+    Stu *stu;
+    const char *what;
+    int quiet;
+    FILE *out;
+    char *tmp;
+    Gc **objs;
+    long num_objs;
+    long capacity;
+    Image_entry *sorted;
+    unsigned char *used_syms;
+    const char *error;
+} Image_writer;
+
+typedef struct Image_reader {
+    Stu *stu;
+    int quiet;
+    char *buf;
+    const char *cur;
+    const char *end;
+    Gc **objs;
+    long num_objs;
+    Image_word *type_refs;
+    long num_type_refs;
+    long type_refs_capacity;
+    Image_symbol *syms;
+    long num_syms;
+    int forms;
+    int bad;
+} Image_reader;
+
+typedef void (*Image_slot_f)(void *, void *);
+
+/* Slots hold pointers of various types, so are accessed by copying. */
+static void
+*slot_get(void *slot)
+{
+    void *x;
+
+    memcpy(&x, slot, sizeof(x));
+
+    return x;
+}
+
+static void
+slot_set(void *slot, void *x)
+{
+    memcpy(slot, &x, sizeof(x));
+}
+
+/* The types the parser produces, which are all a forms file may hold. */
+static int
+is_parsed_type(Sv_type type)
+{
+    switch (type) {
+    case SV_INT:
+    case SV_FLOAT:
+    case SV_RATIONAL:
+    case SV_STR:
+    case SV_ERR:
+    case SV_CONS:
+    case SV_STRUCTURE_ACCESS:
+    case SV_VECTOR:
+    case SV_SPECIAL:
+    case SV_REGEX:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Apply f to the address of each reference held by gc, in the order
+ * they are written to an image.
+ */
+static void
+visit_slots(Stu *stu, Gc *gc, Image_slot_f f, void *arg)
+{
+    Env *env;
+    Sv *sv;
+    long n;
+
+    if (GC_TYPE(gc) == GC_TYPE_ENV) {
+        env = (Env *) gc;
+        f(arg, &env->prev);
+        f(arg, &env->val);
+        for (int i = 0; i < env->size; i++)
+            f(arg, &env->vals[i]);
+        return;
+    }
+
+    sv = (Sv *) gc;
+    switch (sv->type) {
+    case SV_CONS:
+    case SV_STRUCTURE_ACCESS:
+        f(arg, &sv->val.reg[SV_CAR_REG]);
+        f(arg, &sv->val.reg[SV_CDR_REG]);
+        break;
+
+    case SV_SPECIAL:
+        f(arg, &sv->val.special->body);
+        break;
+
+    case SV_VECTOR:
+        for (long i = 0, n; i < sv->val.vector->length; i += n) {
+            Sv **values = Vector_chunk(sv->val.vector, i, &n);
+            for (long j = 0; j < n; j++)
+                f(arg, &values[j]);
+        }
+        break;
+
+    case SV_HASH_MAP:
+        for (long i = 0; i < sv->val.hash_map->used; i++) {
+            f(arg, &sv->val.hash_map->entries[i].key);
+            f(arg, &sv->val.hash_map->entries[i].value);
+        }
+        break;
+
+    case SV_NATIVE_CLOS:
+        for (unsigned i = 0; i < sv->val.clos->bound_num; i++)
+            f(arg, &sv->val.clos->bound_args[i]);
+        break;
+
+    case SV_LAMBDA:
+        f(arg, &sv->val.ufunc->env);
+        f(arg, &sv->val.ufunc->formals);
+        f(arg, &sv->val.ufunc->body);
+        f(arg, &sv->val.ufunc->bound);
+        f(arg, &sv->val.ufunc->scope);
+        f(arg, &sv->val.ufunc->proto);
+        break;
+
+    default:
+        if (sv->type >= SV_BUILTIN_TYPE_END) {
+            n = Type_field_vector(stu, sv->type)->val.vector->length;
+            for (long i = 0; i < n; i++)
+                f(arg, &sv->val.structure[i]);
+        }
+        break;
+    }
+}
+
+static void
+put(Image_writer *w, const void *p, size_t n)
+{
+    fwrite(p, 1, n, w->out);
+}
+
+static void
+put_word(Image_writer *w, Image_word x)
+{
+    put(w, &x, sizeof(x));
+}
+
+static void
+put_str(Image_writer *w, const char *s)
+{
+    size_t len = strlen(s);
+
+    put_word(w, len);
+    put(w, s, len);
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) ((const Image_entry *) a)->gc;
+    uintptr_t y = (uintptr_t) ((const Image_entry *) b)->gc;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+put_ref(Image_writer *w, void *x)
+{
+    Image_entry key = { x, 0 }, *found;
+
+    if (!GC_IS_REF(x)) {
+        put_word(w, (Image_word) x);
+    } else {
+        found = bsearch(&key, w->sorted, w->num_objs, sizeof(key), compare_entries);
+        put_word(w, IMAGE_REF(found->index));
+    }
+}
+
+static void
+put_slot(void *arg, void *slot)
+{
+    put_ref(arg, slot_get(slot));
+}
+
+/* Queue gc to be written, unless it is an immediate or already queued. */
+static void
+add(Image_writer *w, Gc *gc)
+{
+    if (!GC_IS_REF(gc) || GC_MARKED(gc))
+        return;
+
+    if (w->num_objs == w->capacity) {
+        w->capacity = w->capacity ? w->capacity * 2 : IMAGE_OBJS_INITIAL_SIZE;
+        w->objs = CHECKED_REALLOC(w->objs, w->capacity * sizeof(*w->objs));
+    }
+    GC_MARK(gc);
+    w->objs[w->num_objs++] = gc;
+}
+
+static void
+add_slot(void *arg, void *slot)
+{
+    add(arg, slot_get(slot));
+}
+
+static void
+put_native_func(Image_writer *w, Sv_native_func_t func)
+{
+    long i = Builtin_index(func);
+
+    if (i < 0)
+        w->error = "cannot save an unregistered native function";
+    put_word(w, i);
+}
+
+static void
+put_object(Image_writer *w, Gc *gc)
+{
+    Env *env = (Env *) gc;
+    Sv *sv = (Sv *) gc;
+
+    put_word(w, GC_TYPE(gc));
+    if (GC_TYPE(gc) == GC_TYPE_ENV) {
+        put_word(w, env->sym);
+        put_word(w, env->size);
+        for (int i = 0; i < env->size; i++)
+            put_word(w, env->syms[i]);
+        visit_slots(w->stu, gc, put_slot, w);
+        return;
+    }
+
+    put_word(w, sv->type);
+    switch (sv->type) {
+    case SV_INT:
+        put_word(w, sv->val.i);
+        break;
+
+    case SV_FLOAT:
+        put(w, &sv->val.f, sizeof(sv->val.f));
+        break;
+
+    case SV_RATIONAL:
+        put_word(w, sv->val.rational.n);
+        put_word(w, sv->val.rational.d);
+        break;
+
+    case SV_ERR:
+    case SV_STR:
+        put_str(w, sv->val.buf);
+        break;
+
+    case SV_CONS:
+    case SV_STRUCTURE_ACCESS:
+        break;
+
+    case SV_NATIVE_FUNC:
+        put_native_func(w, sv->val.func->func);
+        put_word(w, sv->val.func->arity);
+        put_word(w, sv->val.func->flags);
+        break;
+
+    case SV_NATIVE_CLOS:
+        put_native_func(w, sv->val.clos->func);
+        put_word(w, sv->val.clos->arity);
+        put_word(w, sv->val.clos->bound_num);
+        put_word(w, sv->val.clos->flags);
+        break;
+
+    case SV_LAMBDA:
+        put_word(w, sv->val.ufunc->is_macro);
+        put_word(w, sv->val.ufunc->arity);
+        put_word(w, sv->val.ufunc->size);
+        put_word(w, sv->val.ufunc->num_bound);
+        break;
+
+    case SV_SPECIAL:
+        put_word(w, sv->val.special->type);
+        break;
+
+    case SV_VECTOR:
+        put_word(w, sv->val.vector->length);
+        break;
+
+    case SV_HASH_MAP:
+        /* The number of slots, a key and a value for each entry. */
+        put_word(w, sv->val.hash_map->used * 2);
+        break;
+
+    case SV_STRUCTURE_CONSTRUCTOR:
+        put_word(w, sv->val.structure_constructor);
+        break;
+
+    case SV_REGEX:
+        put_str(w, sv->val.re.spec);
+        put_word(w, sv->val.re.icase);
+        break;
+
+    default:
+        if (sv->type < SV_BUILTIN_TYPE_END)
+            w->error = "cannot save foreign objects";
+        break;
+    }
+    visit_slots(w->stu, gc, put_slot, w);
+}
+
+static void
+put_types(Image_writer *w)
+{
+    Type_registry *reg = &w->stu->type_registry;
+    Sv_vector *fields;
+
+    put_word(w, reg->size);
+    for (unsigned i = 0; i < reg->size; i++) {
+        fields = reg->field_vectors[i]->val.vector;
+        put_ref(w, reg->name_symbol[i]);
+        put_word(w, fields->length);
+        for (long j = 0; j < fields->length; j++)
+            put_ref(w, Vector_at(fields, j));
+    }
+}
+
+/* Queue everything reachable from what is queued, and index it. */
+static void
+collect(Image_writer *w)
+{
+    for (long i = 0; i < w->num_objs; i++)
+        visit_slots(w->stu, w->objs[i], add_slot, w);
+
+    w->sorted = CHECKED_MALLOC((w->num_objs + 1) * sizeof(*w->sorted));
+    for (long i = 0; i < w->num_objs; i++) {
+        GC_UNMARK(w->objs[i]);
+        w->sorted[i].gc = w->objs[i];
+        w->sorted[i].index = i;
+    }
+    qsort(w->sorted, w->num_objs, sizeof(*w->sorted), compare_entries);
+}
+
+/*
+ * Write to a temporary file beside the target, which is renamed into
+ * place once complete so that no reader ever sees part of a file.
+ */
+static int
+open_output(Image_writer *w, const char *file)
+{
+    int fd;
+
+    w->tmp = CHECKED_MALLOC(strlen(file) + sizeof(IMAGE_TMP_SUFFIX));
+    strcpy(w->tmp, file);
+    strcat(w->tmp, IMAGE_TMP_SUFFIX);
+
+    if ((fd = mkstemp(w->tmp)) < 0) {
+        if (!w->quiet)
+            warn("%s: %s", w->what, file);
+        return -1;
+    }
+    if (fchmod(fd, IMAGE_MODE) != 0 || (w->out = fdopen(fd, "w")) == NULL) {
+        if (!w->quiet)
+            warn("%s: %s", w->what, file);
+        close(fd);
+        unlink(w->tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+close_output(Image_writer *w, const char *file)
+{
+    int failed = 1;
+
+    if (w->error) {
+        if (!w->quiet)
+            warnx("%s: %s: %s", w->what, file, w->error);
+        fclose(w->out);
+    } else if (ferror(w->out) | fclose(w->out)
+               || rename(w->tmp, file) != 0) {
+        if (!w->quiet)
+            warn("%s: %s", w->what, file);
+    } else {
+        failed = 0;
+    }
+    if (failed)
+        unlink(w->tmp);
+
+    return failed ? -1 : 0;
+}
+
+static void
+writer_destroy(Image_writer *w)
+{
+    free(w->objs);
+    free(w->sorted);
+    free(w->tmp);
+    free(w->used_syms);
+}
+
+extern int
+Image_save(Stu *stu, const char *file)
+{
+    Image_writer w = { stu, "Image_save" };
+    Type_registry *reg = &stu->type_registry;
+    Image_header header = { IMAGE_MAGIC, IMAGE_VERSION, sizeof(Image_word) };
+    long num_builtins = 0, num_syms = stu->sym_name_to_id->num_entries;
+    int failed;
+
+    /* Find everything reachable from the roots, each object once. */
+    add(&w, (Gc *) stu->main_env);
+    add(&w, (Gc *) stu->mod_include_locations);
+    for (unsigned i = 0; i < reg->size; i++) {
+        add(&w, (Gc *) reg->name_symbol[i]);
+        for (long j = 0; j < reg->field_vectors[i]->val.vector->length; j++)
+            add(&w, (Gc *) Vector_at(reg->field_vectors[i]->val.vector, j));
+    }
+    collect(&w);
+
+    if (open_output(&w, file) != 0) {
+        writer_destroy(&w);
+        return -1;
+    }
+
+    put(&w, &header, sizeof(header));
+
+    while (Builtin_get(num_builtins))
+        num_builtins++;
+    put_word(&w, num_builtins);
+    for (long i = 0; i < num_builtins; i++)
+        put_str(&w, Builtin_get(i)->name);
+
+    put_word(&w, num_syms);
+    for (long i = 0; i < num_syms; i++)
+        put_str(&w, Symtab_get_name(stu, i));
+
+    put_types(&w);
+
+    put_word(&w, w.num_objs);
+    for (long i = 0; i < w.num_objs && !w.error; i++)
+        put_object(&w, w.objs[i]);
+
+    put_ref(&w, stu->main_env);
+    put_ref(&w, stu->mod_include_locations);
+
+    failed = close_output(&w, file);
+    writer_destroy(&w);
+
+    return failed;
+}
+
+static void
+note_symbol(void *arg, void *slot)
+{
+    Image_writer *w = arg;
+    Image_word x = (Image_word) slot_get(slot);
+
+    if (SV_TAG(x) == SV_TAG_SYM)
+        w->used_syms[x >> SV_TAG_BITS] = 1;
+}
+
+static void
+put_source(Image_writer *w, const char *source, const struct stat *st)
+{
+    put_word(w, st->st_mtim.tv_sec);
+    put_word(w, st->st_mtim.tv_nsec);
+    put_word(w, st->st_size);
+    put_str(w, source);
+}
+
+extern int
+Image_save_forms(Stu *stu, const char *file, const char *source,
+                 const struct stat *st, Sv *forms)
+{
+    Image_writer w = { stu, "Image_save_forms", 1 };
+    Image_header header = {
+        IMAGE_FORMS_MAGIC, IMAGE_VERSION, sizeof(Image_word)
+    };
+    long num_syms = stu->sym_name_to_id->num_entries, num_used = 0;
+    int failed;
+
+    add(&w, (Gc *) forms);
+    collect(&w);
+
+    w.used_syms = CHECKED_CALLOC(num_syms + 1, 1);
+    for (long i = 0; i < w.num_objs; i++) {
+        if (GC_TYPE(w.objs[i]) != GC_TYPE_SV
+            || !is_parsed_type(((Sv *) w.objs[i])->type)) {
+            writer_destroy(&w);
+            return -1;
+        }
+        visit_slots(stu, w.objs[i], note_symbol, &w);
+    }
+    for (long i = 0; i < num_syms; i++)
+        num_used += w.used_syms[i];
+
+    if (open_output(&w, file) != 0) {
+        writer_destroy(&w);
+        return -1;
+    }
+
+    put(&w, &header, sizeof(header));
+    put_source(&w, source, st);
+
+    put_word(&w, num_used);
+    for (long i = 0; i < num_syms; i++) {
+        if (w.used_syms[i]) {
+            put_word(&w, i);
+            put_str(&w, Symtab_get_name(stu, i));
+        }
+    }
+
+    put_word(&w, w.num_objs);
+    for (long i = 0; i < w.num_objs; i++)
+        put_object(&w, w.objs[i]);
+
+    put_ref(&w, forms);
+
+    failed = close_output(&w, file);
+    writer_destroy(&w);
+
+    return failed;
+}
+
+static void
+get(Image_reader *r, void *p, size_t n)
+{
+    if (r->bad || (size_t) (r->end - r->cur) < n) {
+        r->bad = 1;
+        memset(p, 0, n);
+    } else {
+        memcpy(p, r->cur, n);
+        r->cur += n;
+    }
+}
+
+static Image_word
+get_word(Image_reader *r)
+{
+    Image_word x;
+
+    get(r, &x, sizeof(x));
+
+    return x;
+}
+
+/* Read a count of things taking at least a word each in what follows. */
+static long
+get_count(Image_reader *r)
+{
+    Image_word n = get_word(r);
+
+    if (n > (size_t) (r->end - r->cur) / sizeof(Image_word)) {
+        r->bad = 1;
+        n = 0;
+    }
+
+    return n;
+}
+
+/* The string is left in the image, and is not terminated. */
+static const char
+*get_str(Image_reader *r, size_t *len)
+{
+    const char *s;
+
+    *len = get_word(r);
+    if (r->bad || *len > (size_t) (r->end - r->cur)) {
+        r->bad = 1;
+        *len = 0;
+        return "";
+    }
+    s = r->cur;
+    r->cur += *len;
+
+    return s;
+}
+
+static char
+*get_payload_str(Image_reader *r)
+{
+    size_t len;
+    const char *s = get_str(r, &len);
+    char *copy = Alloc_allocate_size(r->stu->payload_alloc, len + 1);
+
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+static Sv_native_func_t
+get_native_func(Image_reader *r)
+{
+    const Builtin *b = Builtin_get(get_word(r));
+
+    if (b == NULL) {
+        r->bad = 1;
+        b = Builtin_get(0);
+    }
+
+    return b->func;
+}
+
+static void
+get_slot(void *arg, void *slot)
+{
+    slot_set(slot, (void *) get_word(arg));
+}
+
+static int
+compare_symbols(const void *a, const void *b)
+{
+    long x = ((const Image_symbol *) a)->id;
+    long y = ((const Image_symbol *) b)->id;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+relocate_symbol(Image_reader *r, void *slot)
+{
+    Image_symbol key = { (long) ((Image_word) slot_get(slot) >> SV_TAG_BITS) };
+    Image_symbol *found = bsearch(
+        &key, r->syms, r->num_syms, sizeof(key), compare_symbols);
+
+    if (found == NULL) {
+        r->bad = 1;
+        slot_set(slot, NIL);
+    } else {
+        slot_set(slot, Sv_new_sym_from_id(r->stu, found->new_id));
+    }
+}
+
+static void
+relocate(void *arg, void *slot)
+{
+    Image_reader *r = arg;
+    Image_word x = (Image_word) slot_get(slot);
+    long i;
+
+    if (r->forms && SV_TAG(x) == SV_TAG_SYM) {
+        relocate_symbol(r, slot);
+        return;
+    }
+    if (x == 0 || (x & SV_TAG_MASK))
+        return;
+
+    i = IMAGE_INDEX(x);
+    if (i < 0 || i >= r->num_objs) {
+        r->bad = 1;
+        slot_set(slot, NULL);
+    } else {
+        slot_set(slot, r->objs[i]);
+    }
+}
+
+static Sv
+*new_sv(Stu *stu, Sv_type type)
+{
+    Sv *x = Alloc_allocate(stu->sv_alloc);
+
+    if (x == NULL)
+        err(1, "Image_load");
+    memset(x, 0, sizeof(*x));
+    x->gc.flags = GC_TYPE_SV << GC_TYPE_BITS;
+    x->type = type;
+
+    return x;
+}
+
+static void
+*new_payload(Stu *stu, size_t size)
+{
+    void *p = Alloc_allocate_size(stu->payload_alloc, size);
+
+    return memset(p, 0, size);
+}
+
+/*
+ * Read an object's scalars and allocate it. A bad image still yields an
+ * object which can be freed, so the caller may give up at any point.
+ */
+static Sv
+*get_sv(Image_reader *r)
+{
+    Stu *stu = r->stu;
+    Sv_type type = get_word(r);
+    Sv_native_func_t func;
+    unsigned arity, flags;
+    long n;
+    Sv *x;
+
+    if (r->forms && !is_parsed_type(type)) {
+        r->bad = 1;
+        type = SV_CONS;
+    }
+    x = new_sv(stu, type);
+
+    switch (type) {
+    case SV_INT:
+        x->val.i = get_word(r);
+        break;
+
+    case SV_FLOAT:
+        get(r, &x->val.f, sizeof(x->val.f));
+        break;
+
+    case SV_RATIONAL:
+        x->val.rational.n = get_word(r);
+        x->val.rational.d = get_word(r);
+        break;
+
+    case SV_ERR:
+    case SV_STR:
+        x->val.buf = get_payload_str(r);
+        break;
+
+    case SV_CONS:
+    case SV_STRUCTURE_ACCESS:
+        break;
+
+    case SV_NATIVE_FUNC:
+        func = get_native_func(r);
+        arity = get_word(r);
+        flags = get_word(r);
+        x->val.func = Sv_native_func_new(stu, func, arity, flags);
+        break;
+
+    case SV_NATIVE_CLOS:
+        func = get_native_func(r);
+        arity = get_word(r);
+        n = get_count(r);
+        x->val.clos = new_payload(
+            stu, sizeof(*x->val.clos) + n * sizeof(*x->val.clos->bound_args));
+        x->val.clos->func = func;
+        x->val.clos->arity = arity;
+        x->val.clos->bound_num = n;
+        x->val.clos->flags = get_word(r);
+        break;
+
+    case SV_LAMBDA:
+        x->val.ufunc = Alloc_allocate(stu->sv_ufunc_alloc);
+        memset(x->val.ufunc, 0, sizeof(*x->val.ufunc));
+        x->val.ufunc->is_macro = get_word(r);
+        x->val.ufunc->arity = get_word(r);
+        x->val.ufunc->size = get_word(r);
+        x->val.ufunc->num_bound = get_word(r);
+        break;
+
+    case SV_SPECIAL:
+        x->val.special = Alloc_allocate(stu->sv_special_alloc);
+        x->val.special->type = get_word(r);
+        x->val.special->body = NULL;
+        break;
+
+    case SV_VECTOR:
+        x->val.vector = Vector_new(stu, get_count(r), NULL);
+        break;
+
+    case SV_HASH_MAP:
+        /* Keys may hash by identity, so the index is made afresh. */
+        x->val.hash_map = Hash_map_new(stu, get_count(r) / 2);
+        break;
+
+    case SV_STRUCTURE_CONSTRUCTOR:
+        x->val.structure_constructor = get_word(r);
+        break;
+
+    case SV_REGEX:
+        x->val.re.spec = get_payload_str(r);
+        x->val.re.icase = get_word(r);
+        flags = REG_EXTENDED | (x->val.re.icase ? REG_ICASE : 0);
+        if (regcomp(&x->val.re.compiled, x->val.re.spec, flags) != 0) {
+            /* Keep the spec as a string, which can be freed as usual. */
+            r->bad = 1;
+            x->type = SV_STR;
+            x->val.buf = x->val.re.spec;
+        }
+        break;
+
+    default:
+        if (type >= SV_BUILTIN_TYPE_END
+            && type - SV_BUILTIN_TYPE_END < stu->type_registry.size) {
+            n = Type_field_vector(stu, type)->val.vector->length;
+            x->val.structure = new_payload(stu, n * sizeof(*x->val.structure));
+        } else {
+            r->bad = 1;
+            x->type = SV_CONS;
+        }
+        break;
+    }
+
+    return x;
+}
+
+static Gc
+*get_object(Image_reader *r)
+{
+    Stu *stu = r->stu;
+    Env *env;
+    Gc *gc;
+
+    if (get_word(r) == GC_TYPE_ENV) {
+        env = Alloc_allocate(stu->env_alloc);
+        memset(env, 0, sizeof(*env));
+        env->gc.flags = GC_TYPE_ENV << GC_TYPE_BITS;
+        env->sym = get_word(r);
+        if ((env->size = get_count(r)) > 0) {
+            env->vals = CHECKED_CALLOC(
+                env->size, sizeof(*env->vals) + sizeof(*env->syms));
+            env->syms = (long *) (env->vals + env->size);
+            for (int i = 0; i < env->size; i++)
+                env->syms[i] = get_word(r);
+        }
+        gc = (Gc *) env;
+    } else {
+        gc = (Gc *) get_sv(r);
+    }
+
+    Gc_add_old(stu, gc);
+    visit_slots(stu, gc, get_slot, r);
+
+    return gc;
+}
+
+static int
+get_names_match(Image_reader *r, long n, const char *(*name)(Stu *, long))
+{
+    const char *s, *expected;
+    size_t len;
+    int matched = 1;
+
+    for (long i = 0; i < n; i++) {
+        s = get_str(r, &len);
+        expected = name(r->stu, i);
+        if (!expected || strlen(expected) != len || memcmp(s, expected, len))
+            matched = 0;
+    }
+
+    return matched && !name(r->stu, n);
+}
+
+static const char
+*builtin_name(Stu *stu, long i)
+{
+    const Builtin *b = Builtin_get(i);
+
+    return b ? b->name : NULL;
+}
+
+static void
+get_symbols(Image_reader *r)
+{
+    long n = get_count(r);
+    const char *s;
+    char *name;
+    size_t len;
+
+    for (long i = 0; i < n && !r->bad; i++) {
+        s = get_str(r, &len);
+        name = strndup(s, len);
+        if (Symtab_get_id(r->stu, name) != i)
+            r->bad = 1;
+        free(name);
+    }
+}
+
+static void
+get_type_ref(Image_reader *r)
+{
+    if (r->num_type_refs == r->type_refs_capacity) {
+        r->type_refs_capacity = r->type_refs_capacity
+            ? r->type_refs_capacity * 2 : IMAGE_TYPE_REFS_INITIAL_SIZE;
+        r->type_refs = CHECKED_REALLOC(
+            r->type_refs, r->type_refs_capacity * sizeof(*r->type_refs));
+    }
+    r->type_refs[r->num_type_refs++] = get_word(r);
+}
+
+/*
+ * The types must be registered before any structures are read, but the
+ * names and fields they refer to are only relocated afterwards, so the
+ * types start out empty and are filled in by set_types.
+ */
+static void
+get_types(Image_reader *r)
+{
+    long n = get_count(r), num_fields;
+    Sv *fields;
+
+    for (long i = 0; i < n && !r->bad; i++) {
+        get_type_ref(r);
+        num_fields = get_count(r);
+        fields = new_sv(r->stu, SV_VECTOR);
+        fields->val.vector = Vector_new(r->stu, num_fields, NULL);
+        for (long j = 0; j < num_fields; j++)
+            get_type_ref(r);
+        Gc_add_old(r->stu, (Gc *) fields);
+        Type_new(r->stu, NIL, fields);
+    }
+}
+
+static void
+set_types(Image_reader *r)
+{
+    Type_registry *reg = &r->stu->type_registry;
+    Image_word *ref = r->type_refs;
+    Sv_vector *fields;
+    Sv **field;
+    long n;
+
+    for (unsigned i = 0; i < reg->size; i++) {
+        fields = reg->field_vectors[i]->val.vector;
+        slot_set(&reg->name_symbol[i], (void *) *ref++);
+        relocate(r, &reg->name_symbol[i]);
+        Gc_lock(r->stu, (Gc *) reg->name_symbol[i]);
+        for (long j = 0; j < fields->length; j++) {
+            field = Vector_chunk(fields, j, &n);
+            slot_set(field, (void *) *ref++);
+            relocate(r, field);
+            Gc_lock(r->stu, (Gc *) *field);
+        }
+    }
+}
+
+static int
+read_image(Image_reader *r, const char *file)
+{
+    struct stat st;
+    FILE *in;
+    int ok;
+
+    if ((in = fopen(file, "r")) == NULL || fstat(fileno(in), &st) != 0) {
+        if (!r->quiet)
+            warn("Image_load: %s", file);
+        if (in)
+            fclose(in);
+        return -1;
+    }
+
+    r->buf = CHECKED_MALLOC(st.st_size + 1);
+    ok = fread(r->buf, 1, st.st_size, in) == (size_t) st.st_size;
+    fclose(in);
+    if (!ok) {
+        if (!r->quiet)
+            warnx("Image_load: %s: short read", file);
+        return -1;
+    }
+    r->cur = r->buf;
+    r->end = r->buf + st.st_size;
+
+    return 0;
+}
+
+/* Read and allocate the objects section, then relocate its references. */
+static void
+get_objects(Image_reader *r)
+{
+    long n = get_count(r);
+
+    r->objs = CHECKED_MALLOC((n + 1) * sizeof(*r->objs));
+    for (r->num_objs = 0; r->num_objs < n && !r->bad; r->num_objs++)
+        r->objs[r->num_objs] = get_object(r);
+
+    for (long i = 0; i < r->num_objs && !r->bad; i++)
+        visit_slots(r->stu, r->objs[i], relocate, r);
+}
+
+/*
+ * Load an image into a freshly allocated interpreter which has nothing
+ * registered yet. On failure, whatever was loaded is left to be freed
+ * with the interpreter.
+ */
+extern int
+Image_load(Stu *stu, const char *file)
+{
+    Image_reader r = { stu };
+    Image_header header;
+    Env *main_env;
+    Sv *locations;
+    int failed = 0;
+
+    if (read_image(&r, file) != 0) {
+        failed = 1;
+        goto done;
+    }
+
+    get(&r, &header, sizeof(header));
+    if (r.bad || memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic))) {
+        warnx("Image_load: %s: not an image", file);
+        failed = 1;
+        goto done;
+    }
+    if (header.version != IMAGE_VERSION
+        || header.word_size != sizeof(Image_word)
+        || !get_names_match(&r, get_count(&r), builtin_name)) {
+        warnx("Image_load: %s: written by an incompatible interpreter", file);
+        failed = 1;
+        goto done;
+    }
+
+    get_symbols(&r);
+    get_types(&r);
+
+    get_objects(&r);
+    if (!r.bad)
+        set_types(&r);
+
+    main_env = (Env *) get_word(&r);
+    locations = (Sv *) get_word(&r);
+    relocate(&r, &main_env);
+    relocate(&r, &locations);
+
+    if (r.bad || r.cur != r.end
+        || !GC_IS_REF(locations) || locations->type != SV_VECTOR) {
+        warnx("Image_load: %s: corrupt image", file);
+        failed = 1;
+        goto done;
+    }
+
+    Env_main_set(stu, main_env);
+    stu->mod_include_locations = locations;
+    Gc_lock(stu, (Gc *) stu->mod_include_locations);
+
+done:
+    free(r.buf);
+    free(r.objs);
+    free(r.type_refs);
+
+    return failed ? -1 : 0;
+}
+
+static int
+get_source_matches(Image_reader *r, const char *source, const struct stat *st)
+{
+    long sec = get_word(r), nsec = get_word(r), size = get_word(r);
+    size_t len;
+    const char *s = get_str(r, &len);
+
+    return !r->bad
+        && sec == st->st_mtim.tv_sec && nsec == st->st_mtim.tv_nsec
+        && size == st->st_size
+        && len == strlen(source) && memcmp(s, source, len) == 0;
+}
+
+static void
+get_used_symbols(Image_reader *r)
+{
+    long n = get_count(r), id;
+    const char *s;
+    char *name;
+    size_t len;
+
+    r->syms = CHECKED_MALLOC((n + 1) * sizeof(*r->syms));
+    for (r->num_syms = 0; r->num_syms < n && !r->bad; r->num_syms++) {
+        id = get_word(r);
+        s = get_str(r, &len);
+        if (r->num_syms > 0 && id <= r->syms[r->num_syms - 1].id)
+            r->bad = 1;
+        name = strndup(s, len);
+        r->syms[r->num_syms].id = id;
+        r->syms[r->num_syms].new_id = Symtab_get_id(r->stu, name);
+        free(name);
+    }
+}
+
+static void
+clear_slot(void *arg, void *slot)
+{
+    slot_set(slot, NIL);
+}
+
+/*
+ * Load the forms parsed from source, provided they were saved from the
+ * source as it is now. The forms are not saved in a scope, and anything
+ * read from a bad file is cleared out and left to be collected.
+ */
+extern Sv
+*Image_load_forms(Stu *stu, const char *file, const char *source,
+                  const struct stat *st)
+{
+    Image_reader r = { stu, 1 };
+    Image_header header;
+    Sv *forms = NULL;
+
+    r.forms = 1;
+    if (read_image(&r, file) != 0)
+        goto done;
+
+    get(&r, &header, sizeof(header));
+    if (r.bad || memcmp(header.magic, IMAGE_FORMS_MAGIC, sizeof(header.magic))
+        || header.version != IMAGE_VERSION
+        || header.word_size != sizeof(Image_word)
+        || !get_source_matches(&r, source, st))
+        goto done;
+
+    get_used_symbols(&r);
+    get_objects(&r);
+
+    forms = (Sv *) get_word(&r);
+    relocate(&r, &forms);
+
+    if (r.bad || r.cur != r.end) {
+        for (long i = 0; i < r.num_objs; i++)
+            visit_slots(stu, r.objs[i], clear_slot, NULL);
+        forms = NULL;
+    }
+
+done:
+    free(r.buf);
+    free(r.objs);
+    free(r.syms);
+
+    return forms;
+}
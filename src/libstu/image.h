@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IMAGE_DEFINED
+#define IMAGE_DEFINED
+
+#define IMAGE_MAGIC       "STUIMAGE"
+#define IMAGE_FORMS_MAGIC "STUFORMS"
+#define IMAGE_VERSION     1
+
+struct Stu;
+struct Sv;
+struct stat;
+
+extern int Image_save(struct Stu *, const char *);
+extern int Image_load(struct Stu *, const char *);
+extern int Image_save_forms(struct Stu *, const char *, const char *,
+                            const struct stat *, struct Sv *);
+extern struct Sv *Image_load_forms(struct Stu *, const char *, const char *,
+                                   const struct stat *);
+
+#endif
@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "stu_private.h"
@@ -23,9 +24,13 @@
 #include "sv.h"
 #include "builtins.h"
 #include "gc.h"
+#include "image.h"
 #include "symtab.h"
+#include "utils.h"
 #include "mod.h"
 
+#define MOD_FORMS_SUFFIX ".forms"
+
 static char
 *append_file_to_loc(const char *location, const char *path)
 {
@@ -54,7 +59,7 @@ static char
     char *next = NULL, *result = NULL;
     Sv *locations = stu->mod_include_locations;
     for (int i = 0; i < locations->val.vector->length; i++) {
-        Sv *loc = locations->val.vector->values[i];
+        Sv *loc = Vector_at(locations->val.vector, i);
         next = append_file_to_loc(loc->val.buf, file);
         if (next == NULL) {
             break;
@@ -70,20 +75,150 @@ static char
     return result;
 }
 
+static void
+free_entry(Hash_ent *ent, void *arg)
+{
+    free(ent->v);
+}
+
+extern void
+Mod_cache_init(Stu *stu)
+{
+    stu->mod_cache = Hash_new(free_entry, NULL);
+    stu->mod_paths = Hash_new(free_entry, NULL);
+}
+
+extern void
+Mod_cache_destroy(Stu *stu)
+{
+    Hash_destroy(&stu->mod_cache);
+    Hash_destroy(&stu->mod_paths);
+    free(stu->mod_forms_dir);
+    stu->mod_forms_dir = NULL;
+}
+
+/* Cached modules are roots, as a later import may return them. */
+extern void
+Mod_cache_visit(Stu *stu, void (*action)(Stu *, Gc *))
+{
+    Mod_cache_ent *cached;
+
+    for (Hash_ent *e = Hash_entries(stu->mod_cache); e; e = NEXT_ENTRY(e)) {
+        cached = e->v;
+        action(stu, (Gc *) cached->module);
+    }
+}
+
+/* Paths are resolved against the include locations, so forget them. */
+extern void
+Mod_forget_paths(Stu *stu)
+{
+    Hash_destroy(&stu->mod_paths);
+    stu->mod_paths = Hash_new(free_entry, NULL);
+}
+
+extern void
+Mod_set_forms_dir(Stu *stu, const char *dir)
+{
+    free(stu->mod_forms_dir);
+    stu->mod_forms_dir = dir ? strdup(dir) : NULL;
+}
+
+/*
+ * Find the real path of a file to import, remembering it so that only
+ * the first import of a name searches the include locations.
+ */
+static char
+*real_path(Stu *stu, char *file, struct stat *st)
+{
+    Hash_ent *known = Hash_get(stu->mod_paths, file);
+    char *resolved, *path;
+
+    if (known && stat(known->v, st) == 0)
+        return strdup(known->v);
+
+    if ((resolved = resolve_path(stu, file)) == NULL)
+        return NULL;
+    path = realpath(resolved, NULL);
+    free(resolved);
+    if (path == NULL || stat(path, st) != 0) {
+        free(path);
+        return NULL;
+    }
+    Hash_put(stu->mod_paths, file, strdup(path));
+
+    return path;
+}
+
+/* The forms cache file for a source, named after its mangled path. */
+static char
+*forms_path(Stu *stu, const char *path)
+{
+    char *forms;
+    size_t len;
+
+    if (stu->mod_forms_dir == NULL)
+        return NULL;
+
+    len = strlen(stu->mod_forms_dir);
+    forms = CHECKED_MALLOC(len + strlen(path) + sizeof(MOD_FORMS_SUFFIX) + 1);
+    strcpy(forms, stu->mod_forms_dir);
+    forms[len] = '/';
+    for (const char *p = path; *p; p++)
+        forms[++len] = *p == '/' ? '%' : *p;
+    strcpy(forms + len + 1, MOD_FORMS_SUFFIX);
+
+    return forms;
+}
+
+/* Parse a module, through the forms cache if there is one. */
+static Sv
+*parse_module(Stu *stu, const char *path, const struct stat *st)
+{
+    char *forms_file = forms_path(stu, path);
+    Sv *forms = NULL;
+
+    if (forms_file && (forms = Image_load_forms(stu, forms_file, path, st))) {
+        SCOPE_SAVE(stu, forms);
+    } else {
+        forms = Stu_parse_file(stu, path);
+        if (forms_file)
+            Image_save_forms(stu, forms_file, path, st, forms);
+    }
+    free(forms_file);
+
+    return forms;
+}
+
+static int
+is_current(Mod_cache_ent *cached, const struct stat *st)
+{
+    return cached->mtime.tv_sec == st->st_mtim.tv_sec
+        && cached->mtime.tv_nsec == st->st_mtim.tv_nsec
+        && cached->size == st->st_size;
+}
+
 extern Sv
 *Mod_import_from_file(Stu *stu, Env *base, Sv *file)
 {
-    if (file->type != SV_STR) {
+    if (SV_TYPE(file) != SV_STR) {
         return Sv_new_err(stu, "import needs a string file path");
     }
 
-    char *resolved_path = resolve_path(stu, file->val.buf);
-    if (!resolved_path) {
+    struct stat st;
+    char *path = real_path(stu, file->val.buf, &st);
+    if (!path) {
         return Sv_new_err(stu, "could not resolve file path");
     }
 
-    Sv *forms = Stu_parse_file(stu, resolved_path);
-    free(resolved_path);
+    /* A file which is unchanged since it was imported is not evaluated again. */
+    Hash_ent *found = Hash_get(stu->mod_cache, path);
+    if (found && is_current(found->v, &st)) {
+        free(path);
+        return ((Mod_cache_ent *) found->v)->module;
+    }
+
+    Sv *forms = parse_module(stu, path, &st);
 
     Mod_spec curr_spec, *saved_spec = Mod_current_spec(stu);
     Mod_spec_init(stu, &curr_spec);
@@ -94,6 +229,10 @@ extern Sv
     Env *captured;
     Sv_eval_list(stu, base, forms, &captured);
     if (base == captured) {
+        Mod_spec_destroy(stu, &curr_spec);
+        Mod_set_current_spec(stu, saved_spec);
+        POP_SCOPE(stu);
+        free(path);
         return Sv_new_err(stu, "Cannot import module; nothing bound within");
     }
 
@@ -113,6 +252,15 @@ extern Sv
 
     POP_N_SAVE(stu, module);
 
+    if (SV_TYPE(module) == type) {
+        Mod_cache_ent *cached = CHECKED_MALLOC(sizeof(*cached));
+        cached->mtime = st.st_mtim;
+        cached->size = st.st_size;
+        cached->module = module;
+        Hash_put(stu->mod_cache, path, cached);
+    }
+    free(path);
+
     return module;
 }
 
@@ -17,19 +17,35 @@
 #ifndef MOD_DEFINED
 #define MOD_DEFINED
 
+#include <sys/types.h>
+#include <time.h>
+
 #include "stu_private.h"
 #include "env.h"
 #include "sv.h"
+#include "gc.h"
 #include "hash.h"
 
 typedef struct Mod_spec {
     Sv *name;
 } Mod_spec;
 
+/* An imported module, which stands while its file is unchanged. */
+typedef struct Mod_cache_ent {
+    struct timespec mtime;
+    off_t size;
+    Sv *module;
+} Mod_cache_ent;
+
 extern Mod_spec *Mod_current_spec(Stu *);
 extern void Mod_set_current_spec(Stu *, Mod_spec *);
 extern void Mod_spec_init(Stu *, Mod_spec *);
 extern void Mod_spec_destroy(Stu *, Mod_spec *);
 extern Sv *Mod_import_from_file(Stu *, Env *, Sv *);
+extern void Mod_cache_init(Stu *);
+extern void Mod_cache_destroy(Stu *);
+extern void Mod_cache_visit(Stu *, void (*)(Stu *, Gc *));
+extern void Mod_forget_paths(Stu *);
+extern void Mod_set_forms_dir(Stu *, const char *);
 
 #endif
@@ -17,24 +17,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc/alloc.h"
 #include "env.h"
 #include "native_func.h"
 #include "stu_private.h"
 #include "utils.h"
 
-typedef struct Sv_native_func {
-    Sv_native_func_t func;
-    unsigned arity;
-    unsigned char flags;
-} Sv_native_func;
-
-typedef struct Sv_native_closure {
-    Sv_native_func_t func;
-    unsigned arity, bound_num;
-    unsigned char flags;
-    Sv *bound_args[];
-} Sv_native_closure;
-
 static void
 resize_args(Stu *stu, unsigned size)
 {
@@ -46,7 +34,7 @@ resize_args(Stu *stu, unsigned size)
 extern Sv_native_func
 *Sv_native_func_new(Stu *stu, Sv_native_func_t func, unsigned arity, unsigned char flags)
 {
-    Sv_native_func *f = CHECKED_MALLOC(sizeof(*f));
+    Sv_native_func *f = Alloc_allocate_size(stu->payload_alloc, sizeof(*f));
     f->func = func;
     f->arity = arity;
     f->flags = flags;
@@ -55,6 +43,22 @@ extern Sv_native_func
     return f;
 }
 
+static Sv
+*Native_closure_new(Stu *stu, Sv_native_func_t f, unsigned arity,
+                    unsigned flags, unsigned bound_num)
+{
+    Sv_native_closure *c = Alloc_allocate_size(
+        stu->payload_alloc, sizeof(*c) + bound_num * sizeof(Sv*));
+    c->arity = arity;
+    c->flags = flags;
+    c->func = f;
+    c->bound_num = bound_num;
+    memcpy(c->bound_args, stu->native_func_args, bound_num * sizeof(Sv*));
+    Sv *sv = Sv_new(stu, SV_NATIVE_CLOS);
+    sv->val.clos = c;
+    return sv;
+}
+
 static Sv
 *Native_call(Stu *stu, Env *env, Sv_native_func_t f,
              unsigned arity, unsigned flags, unsigned bound_num,
@@ -71,16 +75,7 @@ static Sv
     }
 
     if (arity > 0) {
-        Sv_native_closure *c = CHECKED_MALLOC(
-            sizeof(*c) + bound_num * sizeof(Sv*));
-        c->arity = arity;
-        c->flags = flags;
-        c->func = f;
-        c->bound_num = bound_num;
-        memcpy(c->bound_args, stu->native_func_args, bound_num * sizeof(Sv*));
-        Sv *sv = Sv_new(stu, SV_NATIVE_CLOS);
-        sv->val.clos = c;
-        return sv;
+        return Native_closure_new(stu, f, arity, flags, bound_num);
     } else {
         if (rest) {
             *arg_array = args;
@@ -92,6 +87,38 @@ static Sv
     }
 }
 
+/* Same as Native_call, but with the arguments in an array. */
+static Sv
+*Native_call_argv(Stu *stu, Env *env, Sv_native_func_t f,
+                  unsigned arity, unsigned flags, unsigned bound_num,
+                  Sv **arg_array, int argc, Sv **argv)
+{
+    int rest = flags & SV_NATIVE_FUNC_REST, i = 0;
+    Sv *args = NIL;
+
+    if (rest)
+        --arity;
+    while (i < argc && arity > 0) {
+        *(arg_array++) = argv[i++];
+        --arity;
+        ++bound_num;
+    }
+
+    if (arity > 0) {
+        return Native_closure_new(stu, f, arity, flags, bound_num);
+    } else {
+        if (rest) {
+            while (argc > i)
+                args = Sv_cons(stu, argv[--argc], args);
+            *arg_array = args;
+            ++bound_num;
+        }
+        else if (i < argc)
+            return Sv_new_err(stu, "Wrong number of arguments");
+        return f(stu, env, stu->native_func_args);
+    }
+}
+
 extern Sv
 *Sv_native_func_call(Stu *stu, Env *env, Sv_native_func *f, Sv *args)
 {
@@ -108,6 +135,22 @@ extern Sv
         stu->native_func_args + f->bound_num, args);
 }
 
+extern Sv
+*Sv_native_func_call_argv(Stu *stu, Env *env, Sv_native_func *f, int argc, Sv **argv)
+{
+    return Native_call_argv(
+        stu, env, f->func, f->arity, f->flags, 0, stu->native_func_args, argc, argv);
+}
+
+extern Sv
+*Sv_native_closure_call_argv(Stu *stu, Env *env, Sv_native_closure *f, int argc, Sv **argv)
+{
+    memcpy(stu->native_func_args, f->bound_args, f->bound_num * sizeof(Sv*));
+    return Native_call_argv(
+        stu, env, f->func, f->arity, f->flags, f->bound_num,
+        stu->native_func_args + f->bound_num, argc, argv);
+}
+
 extern Sv
 *Sv_native_func_register(Stu *stu, const char *name, Sv_native_func_t f, unsigned args, unsigned flags)
 {
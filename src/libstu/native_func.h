@@ -27,13 +27,26 @@ typedef struct Stu Stu;
 typedef struct Env Env;
 typedef struct Sv Sv;
 
-typedef struct Sv_native_func Sv_native_func;
-typedef struct Sv_native_closure Sv_native_closure;
 typedef Sv *(*Sv_native_func_t)(Stu *, Env *, Sv **);
 
+typedef struct Sv_native_func {
+    Sv_native_func_t func;
+    unsigned arity;
+    unsigned char flags;
+} Sv_native_func;
+
+typedef struct Sv_native_closure {
+    Sv_native_func_t func;
+    unsigned arity, bound_num;
+    unsigned char flags;
+    Sv *bound_args[];
+} Sv_native_closure;
+
 extern Sv_native_func *Sv_native_func_new(Stu *, Sv_native_func_t, unsigned, unsigned char);
 extern Sv *Sv_native_func_call(Stu *,  Env *, Sv_native_func *, Sv *);
 extern Sv *Sv_native_closure_call(Stu *, Env *, Sv_native_closure *, Sv *);
+extern Sv *Sv_native_func_call_argv(Stu *, Env *, Sv_native_func *, int, Sv **);
+extern Sv *Sv_native_closure_call_argv(Stu *, Env *, Sv_native_closure *, int, Sv **);
 extern Sv *Sv_native_func_register(Stu *, const char *, Sv_native_func_t, unsigned, unsigned);
 extern int Sv_native_func_is_macro(Sv_native_func *);
 
@@ -17,22 +17,52 @@
 %{
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <err.h>
 
 #include "gc.h"
 #include "sv.h"
 #include "env.h"
 #include "stu_private.h"
+#include "special_form.h"
+%}
+
+%code requires {
+struct Stu;
+struct Parser;
+}
+
+%code provides {
+/*
+ * The forms read by yyparse are consed onto forms, so they come out in
+ * reverse. With one_form set, yyparse returns after each top-level form
+ * instead, keeping the lookahead token it had to read to finish the form
+ * for the next call; done is set once the end of input has been seen.
+ */
+typedef struct Parser {
+    Sv *forms;
+    int one_form;
+    int done;
+    int pending;
+    YYSTYPE pending_val;
+    char *pending_str;
+} Parser;
+
+extern void yyerror(struct Stu *, Parser *, void *, char const *);
+extern int yyparse(struct Stu *, Parser *, void *);
+}
 
-extern int yylex(void);
-extern void yyerror(struct Stu *, Sv **, char const *);
-extern int yyparse(struct Stu *, Sv **);
+%code {
+extern int yylex(YYSTYPE *, void *);
+static void save_lookahead(Parser *, int, YYSTYPE *);
 
-void yyerror (struct Stu *stu, Sv **list, char const *s)
+void yyerror (struct Stu *stu, Parser *parser, void *scanner, char const *s)
 {
     warnx("%s", s);
 }
-%}
+}
+
+%define api.pure full
 
 %union {
     long i;
@@ -48,20 +78,39 @@ void yyerror (struct Stu *stu, Sv **list, char const *s)
 %token <str> STRING SYMBOL RE_SPEC RE_SPEC_I
 %token <rational> RATIONAL
 
-%type <sv> list vector sexp forms atom elements
+%type <sv> list vector sexp atom elements
+
+%initial-action {
+    if (parser->pending) {
+        yychar = parser->pending;
+        yylval = parser->pending_val;
+        parser->pending = 0;
+    }
+}
 
 %start stu
 %parse-param { struct Stu *stu }
-%parse-param { Sv **list }
+%parse-param { struct Parser *parser }
+%parse-param { void *scanner }
+%lex-param { void *scanner }
 
 %%
 
 stu:
-    | forms                 { *list = Sv_cons(stu, $1, *list); }
+    | forms
     ;
 
-forms: forms sexp           { *list = Sv_cons(stu, $1, *list); $$ = $2; }
-    | sexp                  { $$ = $1; }
+forms: forms form
+    | form
+    ;
+
+form: sexp                  {
+                                parser->forms = Sv_cons(stu, $1, parser->forms);
+                                if (parser->one_form) {
+                                    save_lookahead(parser, yychar, &yylval);
+                                    YYACCEPT;
+                                }
+                            }
     ;
 
 vector: '[' ']'             { $$ = Sv_new_vector(stu, NIL); }
@@ -81,7 +130,7 @@ sexp: atom                  { $$ = $1; }
     | list                  { $$ = $1; }
     | vector                { $$ = $1; }
     | sexp FIELD_ACCESSOR sexp         { $$ = Sv_new_structure_access(stu, $1, $3); }
-    | '\'' sexp             { $$ = Sv_cons(stu, Sv_new_sym(stu, "quote"), Sv_cons(stu, $2, NIL)); }
+    | '\'' sexp             { $$ = Sv_cons(stu, Sv_new_sym_from_id(stu, SPECIAL_FORM_QUOTE), Sv_cons(stu, $2, NIL)); }
     | '`' sexp              { $$ = Sv_new_special(stu, SV_SPECIAL_BACKQUOTE, $2); }
     | ',' '@' sexp          { $$ = Sv_new_special(stu, SV_SPECIAL_COMMA_SPREAD, $3); }
     | ','  sexp             { $$ = Sv_new_special(stu, SV_SPECIAL_COMMA, $2); }
@@ -98,3 +147,29 @@ atom: INTEGER               { $$ = Sv_new_int(stu, $1); }
     ;
 
 %%
+
+/*
+ * Keep the token read past the end of a form for the next call. String
+ * values point into the scanner's buffer, which will have moved on by
+ * then, so these are copied.
+ */
+static void
+save_lookahead(Parser *parser, int token, YYSTYPE *val)
+{
+    if (token == YYEOF) {
+        parser->done = 1;
+    } else if (token > 0) {
+        parser->pending = token;
+        parser->pending_val = *val;
+        switch (token) {
+        case STRING:
+        case SYMBOL:
+        case RE_SPEC:
+        case RE_SPEC_I:
+            free(parser->pending_str);
+            parser->pending_str = strdup(val->str);
+            parser->pending_val.str = parser->pending_str;
+            break;
+        }
+    }
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "call_stack.h"
+#include "hash.h"
+#include "profile.h"
+#include "stu_private.h"
+#include "utils.h"
+
+#define PROFILE_BUF_INITIAL_SIZE 256
+
+/*
+ * Samples are driven by SIGPROF, which is delivered to the process, so
+ * only one interpreter may be profiled at a time. The handler does no
+ * more than count a tick against it. The call stack may be part way
+ * through changing when the signal arrives, so the ticks are taken as
+ * samples at the next call or return, when the stack is consistent.
+ * Each sample is counted against its stack, collapsed into a line of
+ * frame names from the outermost in, as flame graph tools expect.
+ */
+static Stu *volatile profiled = NULL;
+static struct sigaction saved_action;
+
+static void
+on_sigprof(int sig)
+{
+    Stu *stu = profiled;
+
+    if (stu)
+        stu->profile_ticks++;
+}
+
+static int
+set_timer(int hz)
+{
+    struct itimerval timer;
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz ? 1000000 / hz : 0;
+    timer.it_value = timer.it_interval;
+
+    return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+extern int
+Profile_start(Stu *stu, int hz)
+{
+    struct sigaction action;
+
+    if (profiled)
+        return profiled == stu ? 0 : -1;
+
+    if (hz <= 0 || hz > 1000000)
+        hz = PROFILE_DEFAULT_HZ;
+
+    if (stu->profile_samples == NULL)
+        stu->profile_samples = Hash_new(NULL, NULL);
+    stu->profile_ticks = 0;
+    profiled = stu;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &saved_action) != 0) {
+        profiled = NULL;
+        return -1;
+    }
+    if (set_timer(hz) != 0) {
+        sigaction(SIGPROF, &saved_action, NULL);
+        profiled = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Append a frame name, keeping clear of the separators. */
+static void
+append_name(Stu *stu, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (stu->profile_buf_len + len + 2 > stu->profile_buf_size) {
+        while (stu->profile_buf_len + len + 2 > stu->profile_buf_size) {
+            stu->profile_buf_size = stu->profile_buf_size
+                ? stu->profile_buf_size * 2 : PROFILE_BUF_INITIAL_SIZE;
+        }
+        stu->profile_buf = CHECKED_REALLOC(
+            stu->profile_buf, stu->profile_buf_size);
+    }
+
+    if (stu->profile_buf_len > 0)
+        stu->profile_buf[stu->profile_buf_len++] = ';';
+    for (size_t i = 0; i < len; i++) {
+        stu->profile_buf[stu->profile_buf_len++] =
+            strchr("; \t\n", name[i]) ? '_' : name[i];
+    }
+    stu->profile_buf[stu->profile_buf_len] = '\0';
+}
+
+extern void
+Profile_sample(Stu *stu)
+{
+    long ticks = stu->profile_ticks;
+    Hash_ent *found;
+
+    stu->profile_ticks = 0;
+    if (stu->profile_samples == NULL)
+        return;
+
+    stu->profile_buf_len = 0;
+    append_name(stu, PROFILE_TOP_LEVEL);
+    for (long i = 0; i < stu->call_stack_depth; i++)
+        append_name(stu, Call_stack_frame_name(stu, i));
+
+    if ((found = Hash_get(stu->profile_samples, stu->profile_buf)) != NULL) {
+        found->v = (void *) ((long) found->v + ticks);
+    } else {
+        Hash_put(stu->profile_samples, stu->profile_buf, (void *) ticks);
+    }
+}
+
+/* Stop sampling, writing out the samples if out is given. */
+extern void
+Profile_stop(Stu *stu, FILE *out)
+{
+    if (profiled == stu) {
+        set_timer(0);
+        sigaction(SIGPROF, &saved_action, NULL);
+        profiled = NULL;
+    }
+    stu->profile_ticks = 0;
+
+    if (out && stu->profile_samples) {
+        for (Hash_ent *e = Hash_entries(stu->profile_samples); e;
+             e = NEXT_ENTRY(e)) {
+            fprintf(out, "%s %ld\n", e->k, (long) e->v);
+        }
+    }
+
+    Hash_destroy(&stu->profile_samples);
+    free(stu->profile_buf);
+    stu->profile_buf = NULL;
+    stu->profile_buf_len = stu->profile_buf_size = 0;
+}
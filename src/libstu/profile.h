@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PROFILE_DEFINED
+#define PROFILE_DEFINED
+
+#include <stdio.h>
+
+#define PROFILE_DEFAULT_HZ 99
+#define PROFILE_TOP_LEVEL  "<TOPLEVEL>"
+
+/* Take any samples which are due, at a point the call stack is whole. */
+#define PROFILE_CHECK(s)                        \
+    do {                                        \
+        if ((s)->profile_ticks)                 \
+            Profile_sample((s));                \
+    } while (0)
+
+struct Stu;
+
+extern int Profile_start(struct Stu *, int);
+extern void Profile_stop(struct Stu *, FILE *);
+extern void Profile_sample(struct Stu *);
+
+#endif
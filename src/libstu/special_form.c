@@ -31,19 +31,19 @@
 static Sv
 *quote(Stu *stu, Env *env, Sv *args)
 {
-    if (args->type != SV_CONS || CDR(args) != NIL)
+    if (SV_TYPE(args) != SV_CONS || CDR(args) != NIL)
         return Sv_new_err(stu, "quote requires a single argument");
     return CAR(args);
 }
 
 static int
 is_def_pattern(Sv *sv) {
-    switch (sv->type) {
+    switch (SV_TYPE(sv)) {
     case SV_SYM:
          return 1;
     case SV_VECTOR:
         for (long i = 0; i < sv->val.vector->length; ++i)
-            if (!is_def_pattern(sv->val.vector->values[i]))
+            if (!is_def_pattern(Vector_at(sv->val.vector, i)))
                 return 0;
         return 1;
     case SV_NIL:
@@ -58,36 +58,39 @@ is_def_pattern(Sv *sv) {
 static Sv
 *bind_def_pattern(Stu *stu, Sv *lhs, Sv *rhs) {
     Sv *res = NULL;
-    switch (lhs->type) {
+    switch (SV_TYPE(lhs)) {
     case SV_SYM:
         Env_capture(stu, lhs, rhs);
         /*
          * If we installed a lambda, also install in the lambda's env so
          * it can call itself.
          */
-        if (rhs->type == SV_LAMBDA)
+        if (SV_TYPE(rhs) == SV_LAMBDA) {
             rhs->val.ufunc->env = Env_put(stu, rhs->val.ufunc->env, lhs, rhs);
+            GC_WRITE(stu, rhs, rhs->val.ufunc->env);
+        }
         return NIL;
     case SV_NIL:
-        if (rhs->type == SV_NIL)
+        if (SV_TYPE(rhs) == SV_NIL)
             return NIL;
         return Sv_new_err(stu, "'def' expected nil but got something else");
     case SV_CONS:
-        if (rhs->type != SV_CONS)
+        if (SV_TYPE(rhs) != SV_CONS)
             return Sv_new_err(stu, "'def' expected a cons cell as a result");
         res = bind_def_pattern(stu, CAR(lhs), CAR(rhs));
-        if (res->type != SV_NIL)
+        if (SV_TYPE(res) != SV_NIL)
             /* Return early in case something went wrong */
             return res;
         return bind_def_pattern(stu, CDR(lhs), CDR(rhs));
     case SV_VECTOR:
-        if (rhs->type != SV_VECTOR)
+        if (SV_TYPE(rhs) != SV_VECTOR)
             return Sv_new_err(stu, "'def' expected a vector as a result");
         if (lhs->val.vector->length != rhs->val.vector->length)
             return Sv_new_err(stu, "'def' mismatch in vector lengths");
         for (long i = 0; i < lhs->val.vector->length; ++i) {
-            res = bind_def_pattern(stu, lhs->val.vector->values[i], rhs->val.vector->values[i]);
-            if (res->type != SV_NIL)
+            res = bind_def_pattern(
+                stu, Vector_at(lhs->val.vector, i), Vector_at(rhs->val.vector, i));
+            if (SV_TYPE(res) != SV_NIL)
                 /* Return early in case something went wrong */
                 return res;
         }
@@ -101,7 +104,7 @@ static Sv
 *def(Stu *stu, Env *env, Sv *args)
 {
     Sv *y = NULL, *z = NULL;
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "'def' args is not a cons");
 
     y = CAR(args);
@@ -121,11 +124,11 @@ static Sv
 static Sv
 *defmod(Stu *stu, Env *env, Sv *args)
 {
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "'defmod' args is not a cons");
 
     Sv *name = CAR(args);
-    if (name->type != SV_SYM)
+    if (SV_TYPE(name) != SV_SYM)
         return Sv_new_err(stu, "'defmod' expects a symbol as the first arg");
 
     Mod_spec *mod = Mod_current_spec(stu);
@@ -135,24 +138,41 @@ static Sv
     return NIL;
 }
 
+/*
+ * Returns 1 if the formals are a valid lambda list, 0 if it contains
+ * something other than symbols and -1 if it is not a list at all.
+ */
+static int
+check_formals(Sv *formals)
+{
+    Sv *cur = NULL;
+
+    if (SV_TYPE(formals) == SV_CONS || IS_NIL(formals)) {
+        while (!IS_NIL(formals) && SV_TYPE(formals) == SV_CONS && (cur = CAR(formals))) {
+            if (SV_TYPE(cur) != SV_SYM)
+                return 0;
+            formals = CDR(formals);
+        }
+        return 1;
+    }
+
+    return -1;
+}
+
 static Sv
 *lambda(Stu *stu, Env *env, Sv *args)
 {
     Sv *formals = NULL, *cur = NULL;
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "'lambda' args is not a cons");
 
     /* All formals should be symbols. */
-    formals = CAR(args);
-    if (formals->type == SV_CONS || IS_NIL(formals)) {
-        while (!IS_NIL(formals) && formals->type == SV_CONS && (cur = CAR(formals))) {
-            if (cur->type != SV_SYM) {
-                return Sv_new_err(
-                    stu, "'lambda' formals need to be symbols");
-            }
-            formals = CDR(formals);
-        }
-    } else {
+    switch (check_formals(CAR(args))) {
+    case 0:
+        return Sv_new_err(
+            stu, "'lambda' formals need to be symbols");
+
+    case -1:
         return Sv_new_err(
             stu, "'lambda' needs a list of symbols as the first argument");
     }
@@ -166,7 +186,7 @@ static Sv
 static Sv
 *defun(Stu *stu, Env *env, Sv *args)
 {
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "'defun' args is not a cons");
 
     Sv *name = CAR(args);
@@ -181,17 +201,17 @@ static Sv
 static Sv
 *deftype(Stu *stu, Env *env, Sv *args)
 {
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "deftype args is not a cons");
 
     Sv *type_name = CAR(args);
 
-    if (type_name->type != SV_SYM)
+    if (SV_TYPE(type_name) != SV_SYM)
         return Sv_new_err(stu, "deftype first argument is not a symbol");
 
     Sv *field_vector = Sv_new_vector(stu, CDR(args));
 
-    if (field_vector->type == SV_ERR)
+    if (SV_TYPE(field_vector) == SV_ERR)
         /* Return error in case something went wrong */
         return field_vector;
 
@@ -205,11 +225,11 @@ static Sv
 static Sv
 *defmacro(Stu *stu, Env *env, Sv *args)
 {
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "'defmacro' args is not a cons");
 
     Sv *name = CAR(args);
-    if (!name || name->type != SV_SYM)
+    if (!name || SV_TYPE(name) != SV_SYM)
         return Sv_new_err(stu, "'defmacro' needs a symbol as the first argument");
 
     Sv *lamb = lambda(stu, env, CDR(args));
@@ -223,26 +243,12 @@ static Sv
 static Sv
 *stu_if(Stu *stu, Env *env, Sv *args)
 {
-    if (args->type != SV_CONS)
-        return Sv_new_err(stu, "'if' args is not a cons");
-
-    Sv *cond = CAR(args);
-    Sv *clauses = CDR(args);
-
-    if (clauses->type != SV_CONS)
-        return Sv_new_err(stu, "'if' clauses is not a cons");
+    Sv *x = NULL;
 
-    Sv *first = CAR(clauses), *second = CDR(clauses);
-
-    cond = Sv_eval(stu, env, cond);
-    if (!cond || cond->type != SV_BOOL)
-        return Sv_new_err(stu, "'if' condition must evaluate to a bool");
+    if (Special_form_if_branch(stu, env, args, &x))
+        return Sv_eval(stu, env, x);
 
-    if (cond->val.i) {
-        return Sv_eval(stu, env, first);
-    } else {
-        return IS_NIL(second) ? second : Sv_eval(stu, env, CAR(second));
-    }
+    return x;
 }
 
 static Sv
@@ -253,17 +259,17 @@ static Sv
 
 static Sv
 *open(Stu *stu, Env *env, Sv *args) {
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "'open' args is not a cons");
     if (!IS_NIL(CDR(args)))
         return Sv_new_err(stu, "'open' should only have one argument");
     Sv *x = Sv_eval(stu, env, CAR(args));
-    if (x->type < SV_BUILTIN_TYPE_END)
+    if (SV_TYPE(x) < SV_BUILTIN_TYPE_END)
         return Sv_new_err(stu, "Value to be opened must be a structure");
-    Sv_vector *fields = Type_field_vector(stu, x->type)->val.vector;
+    Sv_vector *fields = Type_field_vector(stu, SV_TYPE(x))->val.vector;
     Sv **values = x->val.structure;
     for (long i = 0; i < fields->length; ++i)
-        Env_capture(stu, fields->values[i], values[i]);
+        Env_capture(stu, Vector_at(fields, i), values[i]);
     return NIL;
 }
 
@@ -311,8 +317,67 @@ Special_form_register_symbols(Stu *stu)
 extern Special_form_f
 Special_form_get_f(Stu *stu, Sv *sv)
 {
-    long i = sv->val.i;
+    long i = SV_I(sv);
     if (i < SYM_STRINGS_SIZE)
         return funcs[i];
     return NULL;
 }
+
+extern int
+Special_form_is_def_pattern(Sv *sv)
+{
+    return sv && is_def_pattern(sv);
+}
+
+extern int
+Special_form_is_formals(Sv *formals)
+{
+    return formals && check_formals(formals) == 1;
+}
+
+extern Sv
+*Special_form_bind_def(Stu *stu, Sv *pattern, Sv *val)
+{
+    return bind_def_pattern(stu, pattern, val);
+}
+
+/*
+ * Evaluate the condition of an if form with arguments args. Returns 1
+ * with the clause to evaluate next in x, otherwise 0 with the value of
+ * the whole form in x.
+ */
+extern int
+Special_form_if_branch(Stu *stu, Env *env, Sv *args, Sv **x)
+{
+    if (SV_TYPE(args) != SV_CONS) {
+        *x = Sv_new_err(stu, "'if' args is not a cons");
+        return 0;
+    }
+
+    Sv *cond = CAR(args);
+    Sv *clauses = CDR(args);
+
+    if (SV_TYPE(clauses) != SV_CONS) {
+        *x = Sv_new_err(stu, "'if' clauses is not a cons");
+        return 0;
+    }
+
+    Sv *first = CAR(clauses), *second = CDR(clauses);
+
+    cond = Sv_eval(stu, env, cond);
+    if (!cond || SV_TYPE(cond) != SV_BOOL) {
+        *x = Sv_new_err(stu, "'if' condition must evaluate to a bool");
+        return 0;
+    }
+
+    if (SV_I(cond)) {
+        *x = first;
+        return 1;
+    } else if (IS_NIL(second)) {
+        *x = second;
+        return 0;
+    } else {
+        *x = CAR(second);
+        return 1;
+    }
+}
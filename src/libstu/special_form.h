@@ -23,7 +23,24 @@ typedef struct Stu Stu;
 
 typedef Sv *(*Special_form_f)(Stu *, Env *, Sv*);
 
+/* Symbol ids reserved for the special forms. */
+#define SPECIAL_FORM_QUOTE     1
+#define SPECIAL_FORM_DEF       2
+#define SPECIAL_FORM_DEFTYPE   3
+#define SPECIAL_FORM_DEFMACRO  4
+#define SPECIAL_FORM_DEFUN     5
+#define SPECIAL_FORM_LAMBDA    6
+#define SPECIAL_FORM_LAMBDA_U  7
+#define SPECIAL_FORM_IF        8
+#define SPECIAL_FORM_TRY       9
+#define SPECIAL_FORM_OPEN      10
+#define SPECIAL_FORM_DEFMOD    11
+
 extern void Special_form_register_symbols(Stu *);
 extern Special_form_f Special_form_get_f(Stu *, Sv *);
+extern int Special_form_is_def_pattern(Sv *);
+extern int Special_form_is_formals(Sv *);
+extern Sv *Special_form_bind_def(Stu *, Sv *, Sv *);
+extern int Special_form_if_branch(Stu *, Env *, Sv *, Sv **);
 
 #endif
@@ -24,16 +24,22 @@
 #include "alloc/alloc.h"
 #include "env.h"
 #include "builtins.h"
+#include "call_stack.h"
 #include "gc.h"
 #include "sv.h"
 #include "try.h"
-#include "lexer.h"
 #include "parser.h"
+#include "lexer.h"
 #include "special_form.h"
 #include "symtab.h"
 #include "hash.h"
+#include "image.h"
+#include "mod.h"
+#include "profile.h"
 #include "stu_private.h"
 #include "utils.h"
+#include "compile.h"
+#include "vm.h"
 
 #define VALIDATOR_STACK_SIZE 256
 #define FORM_VALID    1
@@ -41,14 +47,14 @@
 #define FORM_PARTIAL -1
 
 /*
- * NIL singleton object. This object is shared among multiple
- * stu interpreter instances.
+ * NIL is an immediate shared among multiple stu interpreter instances;
+ * this is kept for callers which refer to it by name.
  */
-Sv *Sv_nil = NULL;
-int Sv_interpreters = 0;
+Sv *const Sv_nil = SV_NIL_IMM;
 
-extern Stu
-*Stu_new(void)
+/* Allocate an interpreter with nothing yet registered. */
+static Stu
+*Stu_alloc(int allocator)
 {
     enum Alloc_type default_alloc;
     Stu *stu = CHECKED_CALLOC(1, sizeof(*stu));;
@@ -61,35 +67,53 @@ extern Stu
 #else
 #  error "no memory allocator defined!"
 #endif
+    if (allocator == STU_ALLOC_SYSTEM)
+        default_alloc = ALLOC_TYPE_SYS;
+    else if (allocator == STU_ALLOC_SLAB)
+        default_alloc = ALLOC_TYPE_SLAB;
     stu->sv_alloc = Alloc_new(stu, sizeof(Sv), default_alloc);
     stu->env_alloc = Alloc_new(stu, sizeof(Env), default_alloc);
     stu->sv_special_alloc = Alloc_new(stu, sizeof(Sv_special), default_alloc);
     stu->sv_ufunc_alloc = Alloc_new(stu, sizeof(Sv_ufunc), default_alloc);
-    stu->gc_scope_alloc = Alloc_new(stu, sizeof(Scope), default_alloc);
+    stu->code_alloc = Alloc_new(stu, sizeof(Code), default_alloc);
+    stu->payload_alloc = Alloc_new_classes(stu, default_alloc);
+
+    stu->eval_mode = STU_EVAL_VM;
+    if (yylex_init(&stu->scanner))
+        err(1, "Stu_new");
+    Gc_set_heap_limit(stu, HEAP_LIMIT);
 
     stu->last_exception = NIL;
 
-    stu->sym_num_ids = HASH_SIZE;
+    stu->sym_num_ids = SYMTAB_INITIAL_SIZE;
 
     Type_registry_init(&stu->type_registry);
-
-    PUSH_SCOPE(stu);
     Symtab_init(stu);
+    Mod_cache_init(stu);
 
-    stu->call_stack = NIL;
+    return stu;
+}
 
-    /* Setup NIL singleton outside of allocators and GC. */
-    if (Sv_nil == NULL) {
-        Sv_nil = CHECKED_CALLOC(1, sizeof(*Sv_nil));
-        Sv_nil->type = SV_NIL;
-    }
-    Env_main_put(stu, Sv_new_sym(stu, "nil"), Sv_nil);
-    Sv_interpreters += 1;
+extern Stu
+*Stu_new(void)
+{
+    return Stu_new_with_allocator(STU_ALLOC_DEFAULT);
+}
+
+extern Stu
+*Stu_new_with_allocator(int allocator)
+{
+    Stu *stu = Stu_alloc(allocator);
+
+    PUSH_SCOPE(stu);
+
+    Env_main_put(stu, Sv_new_sym(stu, "nil"), NIL);
 
     /* Ensure nil and all special form symbols get the ids we expect */
-    if (Symtab_get_id(stu, "nil") != 0)
+    if (Symtab_get_id(stu, "nil") != SYM_NIL)
         err(1, "stu_new");
     Special_form_register_symbols(stu);
+    Symtab_register_symbols(stu);
 
     stu->mod_include_locations = Sv_new_vector(stu, NIL);
     Gc_lock(stu, (Gc *) stu->mod_include_locations);
@@ -100,6 +124,23 @@ extern Stu
     return stu;
 }
 
+extern Stu
+*Stu_new_from_image(const char *file)
+{
+    Stu *stu = Stu_alloc(STU_ALLOC_DEFAULT);
+
+    if (Image_load(stu, file) != 0)
+        Stu_destroy(&stu);
+
+    return stu;
+}
+
+extern int
+Stu_save_image(Stu *stu, const char *file)
+{
+    return Image_save(stu, file);
+}
+
 extern void
 Stu_destroy(Stu **stu)
 {
@@ -110,21 +151,26 @@ Stu_destroy(Stu **stu)
 
     s = *stu;
     if (s) {
-        Sv_interpreters -= 1;
-        if (Sv_interpreters <= 0) {
-            free(Sv_nil);
-            Sv_nil = NULL;
-            Sv_interpreters = 0;
-        }
+        Profile_stop(s, NULL);
         Symtab_destroy(s);
+        Mod_cache_destroy(s);
         Gc_sweep(s, 1);
         Alloc_destroy(&(s->sv_alloc));
         Alloc_destroy(&(s->env_alloc));
         Alloc_destroy(&(s->sv_special_alloc));
         Alloc_destroy(&(s->sv_ufunc_alloc));
-        Alloc_destroy(&(s->gc_scope_alloc));
+        Alloc_destroy(&(s->code_alloc));
+        Alloc_destroy(&(s->payload_alloc));
+        Vm_destroy(s);
+        yylex_destroy(s->scanner);
+        Call_stack_destroy(s);
+        free(s->gc_roots);
+        free(s->gc_scopes);
+        free(s->gc_mark_stack);
         Type_registry_release(&s->type_registry);
         free(s->native_func_args);
+        free(s->macro_syms);
+        free(s->main_index);
         free(s);
     }
 
@@ -157,12 +203,19 @@ void Stu_add_include_path(Stu *stu, const char *path)
 
     Gc_lock(stu, (Gc *) stu->mod_include_locations);
     POP_SCOPE(stu);
+
+    Mod_forget_paths(stu);
 }
 
-extern Sv
-*Stu_parse_file(Stu *stu, const char *file)
+extern void
+Stu_set_module_cache(Stu *stu, const char *dir)
+{
+    Mod_set_forms_dir(stu, dir);
+}
+
+static FILE
+*open_input(const char *file)
 {
-    Sv *list = NIL;
     FILE *in;
 
     if (!file || !strcmp(file, "-")) {
@@ -171,9 +224,18 @@ extern Sv
         err(1, "Parse_file: %s", file);
     }
 
-    YY_BUFFER_STATE bp = yy_create_buffer(in, YY_BUF_SIZE);
-    yy_switch_to_buffer(bp);
-    switch (yyparse(stu, &list)) {
+    return in;
+}
+
+extern Sv
+*Stu_parse_file(Stu *stu, const char *file)
+{
+    Parser parser = { NIL };
+    FILE *in = open_input(file);
+
+    YY_BUFFER_STATE bp = yy_create_buffer(in, YY_BUF_SIZE, stu->scanner);
+    yy_switch_to_buffer(bp, stu->scanner);
+    switch (yyparse(stu, &parser, stu->scanner)) {
     case 2:
         errx(1, "Parser memory allocation error");
         break;
@@ -181,27 +243,27 @@ extern Sv
 
     if (in && in != stdin)
         fclose(in);
-    yy_delete_buffer(bp);
+    yy_delete_buffer(bp, stu->scanner);
 
-    return Sv_reverse(stu, list);
+    return Sv_reverse(stu, parser.forms);
 }
 
 extern Sv
 *Stu_parse_buf(Stu *stu, const char *buf)
 {
-    Sv *list = NIL;
+    Parser parser = { NIL };
 
     if (buf) {
-        YY_BUFFER_STATE bp = yy_scan_string(buf);
-        switch (yyparse(stu, &list)) {
+        YY_BUFFER_STATE bp = yy_scan_string(buf, stu->scanner);
+        switch (yyparse(stu, &parser, stu->scanner)) {
         case 2:
             errx(1, "Parser memory allocation error");
             break;
         }
-        yy_delete_buffer(bp);
+        yy_delete_buffer(bp, stu->scanner);
     }
 
-    return Sv_reverse(stu, list);
+    return Sv_reverse(stu, parser.forms);
 }
 
 static Sv
@@ -223,10 +285,111 @@ static Sv
     return result;
 }
 
+/*
+ * Bind whatever env adds on top of base in the main environment, oldest
+ * first, returning the main environment. The bindings are made again
+ * rather than adopting env, as anything bound directly in the main
+ * environment meanwhile, such as a macro, is not in env.
+ */
+static Env
+*keep_bindings(Stu *stu, Env *env, Env *base)
+{
+    Env *cur, **added = NULL;
+    long n = 0, capacity = 0;
+
+    for (cur = env; cur && cur != base; cur = cur->prev) {
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            added = CHECKED_REALLOC(added, capacity * sizeof(*added));
+        }
+        added[n++] = cur;
+    }
+
+    PUSH_N_SAVE(stu, env);
+    while (n-- > 0) {
+        cur = added[n];
+        if (cur->size > 0) {
+            for (int i = 0; i < cur->size; i++)
+                Env_main_put(stu, Sv_new_sym_from_id(stu, cur->syms[i]), cur->vals[i]);
+        } else {
+            Env_main_put(stu, Sv_new_sym_from_id(stu, cur->sym), cur->val);
+        }
+    }
+    POP_SCOPE(stu);
+    free(added);
+
+    return Env_main(stu);
+}
+
+/*
+ * Files are read a top-level form at a time, each form being evaluated
+ * and left to the collector before the next is parsed, so neither the
+ * whole program nor the garbage of its earlier forms is kept while a
+ * long file or pipe is run. The bindings made are kept in the main
+ * environment if keep is set.
+ */
+static Sv
+*eval_file(Stu *stu, const char *file, int keep)
+{
+    Parser parser = { NIL, 1 };
+    Env *env = Env_main(stu), *base;
+    Sv *result = NIL, *value;
+    FILE *in = open_input(file);
+
+    YY_BUFFER_STATE bp = yy_create_buffer(in, YY_BUF_SIZE, stu->scanner);
+
+    PUSH_SCOPE(stu);
+    while (!parser.done) {
+        PUSH_SCOPE(stu);
+
+        /* An import in the last form will have switched buffers. */
+        yy_switch_to_buffer(bp, stu->scanner);
+        parser.forms = NIL;
+        if (yyparse(stu, &parser, stu->scanner) == 2)
+            errx(1, "Parser memory allocation error");
+
+        if (IS_NIL(parser.forms)) {
+            POP_SCOPE(stu);
+            break;
+        }
+
+        base = env;
+        value = Try_eval_list(
+            stu, env, parser.forms, Try_default_catch_handler, NULL, &env);
+        if (keep)
+            env = keep_bindings(stu, env, base);
+
+        /* Keep only this result and the environment it left. */
+        POP_SCOPE(stu);
+        POP_SCOPE(stu);
+        PUSH_N_SAVE(stu, value);
+        SCOPE_SAVE(stu, env);
+        result = value;
+    }
+
+    if (!IS_NIL(result)) {
+        Gc_lock(stu, (Gc *) result);
+    }
+    POP_SCOPE(stu);
+
+    if (in && in != stdin)
+        fclose(in);
+    yy_delete_buffer(bp, stu->scanner);
+    free(parser.pending_str);
+
+    return result;
+}
+
 extern Sv
 *Stu_eval_file(Stu *stu, const char *file)
 {
-    return eval(stu, file, Stu_parse_file, Env_main(stu), NULL);
+    return eval_file(stu, file, 0);
+}
+
+extern void
+Stu_load_file(Stu *stu, const char *file)
+{
+    Stu_release_val(stu, eval_file(stu, file, 1));
 }
 
 extern Sv
@@ -258,11 +421,11 @@ Stu_is_valid_form(Stu *stu, const char *buf)
 {
     int valid = FORM_VALID, tok = 0, top = -1;
     char stack[VALIDATOR_STACK_SIZE], opposite;
+    YYSTYPE lval;
 
     if (buf) {
-        YY_BUFFER_STATE bp = yy_scan_string(buf);
-        yy_switch_to_buffer(bp);
-        while (tok = yylex()) {
+        YY_BUFFER_STATE bp = yy_scan_string(buf, stu->scanner);
+        while ((tok = yylex(&lval, stu->scanner))) {
             switch (tok) {
             case '(':
             case '[':
@@ -290,7 +453,7 @@ Stu_is_valid_form(Stu *stu, const char *buf)
         }
 
     done:
-        yy_delete_buffer(bp);
+        yy_delete_buffer(bp, stu->scanner);
     }
 
     if (valid && top >= 0) {
@@ -324,3 +487,61 @@ Stu_dump_stats(Stu *stu, FILE *out)
     Gc_dump_stats(stu, out);
     POP_SCOPE(stu);
 }
+
+static void
+get_alloc_metrics(Alloc *alloc, StuAllocMetrics *metrics)
+{
+    metrics->allocs = alloc->allocs;
+    metrics->releases = alloc->releases;
+    metrics->bytes = alloc->heap_bytes;
+}
+
+extern void
+Stu_get_metrics(Stu *stu, StuMetrics *metrics)
+{
+    get_alloc_metrics(stu->sv_alloc, &metrics->values);
+    get_alloc_metrics(stu->env_alloc, &metrics->envs);
+    get_alloc_metrics(stu->sv_special_alloc, &metrics->specials);
+    get_alloc_metrics(stu->sv_ufunc_alloc, &metrics->lambdas);
+    get_alloc_metrics(stu->code_alloc, &metrics->code);
+    get_alloc_metrics(stu->payload_alloc, &metrics->payloads);
+    metrics->heap_bytes = Gc_heap_bytes(stu);
+    metrics->objects = stu->stats_gc_managed_objects;
+    metrics->gc_allocs = stu->stats_gc_allocs;
+    metrics->gc_frees = stu->stats_gc_frees;
+    metrics->gc_collections = stu->stats_gc_collections;
+    metrics->gc_major_collections = stu->stats_gc_major_collections;
+    metrics->gc_pause_ns = stu->stats_gc_pause_ns;
+    metrics->gc_pause_max_ns = stu->stats_gc_pause_max_ns;
+    metrics->scope_depth = Gc_scope_stack_size(stu);
+    metrics->scope_depth_max = stu->stats_gc_scope_depth_max;
+    metrics->env_lookups = stu->stats_env_lookups;
+    metrics->env_lookup_steps = stu->stats_env_lookup_steps;
+    metrics->calls = stu->stats_calls;
+    metrics->macro_expansions = stu->stats_macro_expansions;
+    metrics->exceptions = stu->stats_exceptions;
+}
+
+extern int
+Stu_profile_start(Stu *stu, int hz)
+{
+    return Profile_start(stu, hz);
+}
+
+extern void
+Stu_profile_stop(Stu *stu, FILE *out)
+{
+    Profile_stop(stu, out);
+}
+
+extern void
+Stu_set_eval_mode(Stu *stu, int mode)
+{
+    stu->eval_mode = mode;
+}
+
+extern void
+Stu_set_heap_limit(Stu *stu, size_t limit)
+{
+    Gc_set_heap_limit(stu, limit);
+}
@@ -17,6 +17,7 @@
 #ifndef STU_DEFINED
 #define STU_DEFINED
 
+#include <stdint.h>
 #include <stdio.h>
 
 /**
@@ -85,12 +86,121 @@ typedef struct Stu Stu;
 /**
  * =head2 NIL
  *
- * The singleton NIL object. This object is initialized in the first call
- * to I<Stu_new>; any subsequent calls will make use of the same instance.
+ * The NIL object. NIL is an immediate value rather than an allocated
+ * object, so it is valid before the first call to I<Stu_new> and is the
+ * same for every interpreter. I<Sv_nil> holds the same value and is
+ * constant, so it is safe to read from any thread.
  *
  */
-extern StuVal *Sv_nil;
-#define NIL Sv_nil
+extern StuVal *const Sv_nil;
+#define NIL ((StuVal *) 0x04)
+
+/**
+ * =head2 StuAllocMetrics
+ *
+ * The number of blocks handed out and released by one of an
+ * interpreter's memory allocators, and the bytes it holds from the
+ * system.
+ *
+ */
+typedef struct StuAllocMetrics {
+    uint64_t allocs;
+    uint64_t releases;
+    uint64_t bytes;
+} StuAllocMetrics;
+
+/**
+ * =head2 StuMetrics
+ *
+ * Counters describing the work an interpreter has done since it was
+ * created, filled in by I<Stu_get_metrics>:
+ *
+ * =over 4
+ *
+ * =item I<values>, I<envs>, I<specials>, I<lambdas>, I<code>, I<payloads>
+ *
+ * The allocators of values, environments, special forms, lambdas,
+ * compiled code and variable sized data.
+ *
+ * =item I<heap_bytes>, I<objects>
+ *
+ * The bytes held by all allocators, and the number of live objects.
+ *
+ * =item I<gc_allocs>, I<gc_frees>
+ *
+ * Garbage collected objects created and freed.
+ *
+ * =item I<gc_collections>, I<gc_major_collections>
+ *
+ * Collections made, and how many of those were of the whole heap.
+ *
+ * =item I<gc_pause_ns>, I<gc_pause_max_ns>
+ *
+ * The total and longest time spent in a collection, in nanoseconds.
+ *
+ * =item I<scope_depth>, I<scope_depth_max>
+ *
+ * The current and greatest depth of the garbage collector's scope stack.
+ *
+ * =item I<env_lookups>, I<env_lookup_steps>
+ *
+ * Symbols looked up by name, and the environment bindings or frames
+ * visited doing so.
+ *
+ * =item I<calls>, I<macro_expansions>, I<exceptions>
+ *
+ * Functions called, macros expanded, and exceptions thrown.
+ *
+ * =back
+ *
+ */
+typedef struct StuMetrics {
+    StuAllocMetrics values;
+    StuAllocMetrics envs;
+    StuAllocMetrics specials;
+    StuAllocMetrics lambdas;
+    StuAllocMetrics code;
+    StuAllocMetrics payloads;
+    uint64_t heap_bytes;
+    uint64_t objects;
+    uint64_t gc_allocs;
+    uint64_t gc_frees;
+    uint64_t gc_collections;
+    uint64_t gc_major_collections;
+    uint64_t gc_pause_ns;
+    uint64_t gc_pause_max_ns;
+    uint64_t scope_depth;
+    uint64_t scope_depth_max;
+    uint64_t env_lookups;
+    uint64_t env_lookup_steps;
+    uint64_t calls;
+    uint64_t macro_expansions;
+    uint64_t exceptions;
+} StuMetrics;
+
+/**
+ * =head2 Evaluation modes
+ *
+ * By default forms are compiled to bytecode and run on a stack based
+ * virtual machine (I<STU_EVAL_VM>). The original tree-walking evaluator
+ * is still available by selecting I<STU_EVAL_TREE>.
+ *
+ */
+#define STU_EVAL_VM   0
+#define STU_EVAL_TREE 1
+
+/**
+ * =head2 Allocators
+ *
+ * Interpreters use the memory allocator chosen when B<libstu> was
+ * configured (I<STU_ALLOC_DEFAULT>), unless created with the system
+ * allocator (I<STU_ALLOC_SYSTEM>) or the slab allocator
+ * (I<STU_ALLOC_SLAB>) instead.
+ *
+ */
+#define STU_ALLOC_DEFAULT 0
+#define STU_ALLOC_SYSTEM  1
+#define STU_ALLOC_SLAB    2
 
 /**
  * =head1 FUNCTIONS
@@ -104,9 +214,52 @@ extern StuVal *Sv_nil;
  *
  * Create and initialize an interpreter instance.
  *
+ * Interpreters share no mutable state, each having its own scanner and
+ * parser, so separate instances may be created, used and destroyed on
+ * different threads at once. A single instance must only be used by one
+ * thread at a time.
+ *
  */
 extern Stu *Stu_new(void);
 
+/**
+ * =head2 Stu *Stu_new_with_allocator(int I<allocator>)
+ *
+ * Create and initialize an interpreter instance which uses the given
+ * memory allocator, being one of the I<STU_ALLOC_*> values above.
+ *
+ */
+extern Stu *Stu_new_with_allocator(int);
+
+/**
+ * =head2 Stu *Stu_new_from_image(const char *I<file>)
+ *
+ * Create an interpreter from an image written by I<Stu_save_image>. The
+ * new interpreter starts with the builtins, definitions, types and
+ * include locations it was saved with, without evaluating anything.
+ *
+ * Images are only portable between identical builds of B<libstu>. NULL
+ * is returned, with a warning, if I<file> cannot be read or was not
+ * written by a matching build.
+ *
+ */
+extern Stu *Stu_new_from_image(const char *);
+
+/**
+ * =head2 int Stu_save_image(Stu *I<stu>, const char *I<file>)
+ *
+ * Write everything reachable from the main environment of I<stu> to an
+ * image in I<file>, so that later interpreters can be started in that
+ * state with I<Stu_new_from_image>. Compiled code is not saved, and is
+ * recompiled as the functions are called.
+ *
+ * Returns 0 on success, or -1 with a warning if the file could not be
+ * written or the environment holds a foreign object, which cannot be
+ * saved.
+ *
+ */
+extern int Stu_save_image(Stu *, const char *);
+
 /**
  * =head2 void Stu_destroy(Stu **I<stu>)
  *
@@ -123,9 +276,22 @@ extern void Stu_destroy(Stu **);
  * when the result is no longer required it must be released via a call
  * to the I<Stu_release_val> function.
  *
+ * The file is read and evaluated one top-level form at a time, so a
+ * I<file> of "-" (or NULL) may be a pipe which is still being written.
+ *
  */
 extern StuVal *Stu_eval_file(Stu *, const char *);
 
+/**
+ * =head2 void Stu_load_file(Stu *I<stu>, const char *I<file>)
+ *
+ * Eval a NUL-terminated file path as with I<Stu_eval_file>, discarding
+ * the result but keeping the definitions it made in the main
+ * environment, so that they are visible to whatever is evaluated next.
+ *
+ */
+extern void Stu_load_file(Stu *, const char *);
+
 /**
  * =head2 StuVal *Stu_eval_buf(Stu *I<stu>, const char *I<buf>)
  *
@@ -204,6 +370,18 @@ extern void Stu_dump_val(Stu *, StuVal *, FILE *);
  */
 extern void Stu_add_include_path(Stu *, const char *);
 
+/**
+ * =head2 void Stu_set_module_cache(Stu *I<stu>, const char *I<dir>)
+ *
+ * Cache the parsed forms of I<import>ed module files in the directory
+ * I<dir>, which must already exist, so that later interpreters need not
+ * parse a module again until its file changes. A NULL I<dir> stops the
+ * caching. Within an interpreter, importing an unchanged file again
+ * always returns the same module without evaluating it again.
+ *
+ */
+extern void Stu_set_module_cache(Stu *, const char *);
+
 /**
  * =head2 void Stu_dump_stats(Stu *I<stu>, FILE *I<out>)
  *
@@ -212,6 +390,59 @@ extern void Stu_add_include_path(Stu *, const char *);
  */
 extern void Stu_dump_stats(Stu *, FILE *);
 
+/**
+ * =head2 void Stu_get_metrics(Stu *I<stu>, StuMetrics *I<metrics>)
+ *
+ * Fill in I<metrics> with the current counters of I<stu>. The same
+ * counters are returned to programs by the I<runtime-stats> builtin.
+ *
+ */
+extern void Stu_get_metrics(Stu *, StuMetrics *);
+
+/**
+ * =head2 int Stu_profile_start(Stu *I<stu>, int I<hz>)
+ *
+ * Start sampling the call stack of I<stu> about I<hz> times a second of
+ * CPU time, or a default rate if I<hz> is zero. The samples are driven
+ * by I<SIGPROF>, so only one interpreter in a process may be profiled
+ * at a time, and the signal must not otherwise be in use. Returns 0 on
+ * success, or -1 if the profiler could not be started.
+ *
+ */
+extern int Stu_profile_start(Stu *, int);
+
+/**
+ * =head2 void Stu_profile_stop(Stu *I<stu>, FILE *I<out>)
+ *
+ * Stop profiling I<stu>, and write the samples taken to I<out> unless
+ * it is NULL. Each line is a call stack of function names separated by
+ * semicolons, outermost first, followed by the number of samples taken
+ * in it, which is the collapsed format read by flame graph tools.
+ *
+ */
+extern void Stu_profile_stop(Stu *, FILE *);
+
+/**
+ * =head2 void Stu_set_eval_mode(Stu *I<stu>, int I<mode>)
+ *
+ * Select how subsequent evaluations are performed, either I<STU_EVAL_VM>
+ * or I<STU_EVAL_TREE>.
+ *
+ */
+extern void Stu_set_eval_mode(Stu *, int);
+
+/**
+ * =head2 void Stu_set_heap_limit(Stu *I<stu>, size_t I<limit>)
+ *
+ * Set a soft limit of I<limit> bytes on the interpreter's heap, or zero
+ * for no limit. Once the heap grows past it a full collection is made
+ * straight away. The heap may still grow beyond the limit if that much
+ * data remains reachable. The default is set by B<HEAP_LIMIT> at build
+ * time.
+ *
+ */
+extern void Stu_set_heap_limit(Stu *, size_t);
+
 /**
  * =head1 AUTHOR
  *
@@ -19,15 +19,18 @@
 #define STU_PRIVATE_DEFINED
 
 #include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
 
+#include "stu.h"
 #include "types.h"
 
-struct Scope;
 struct Env;
 struct Hash;
 struct Sv;
 struct Alloc;
 struct Mod_spec;
+struct Vm_frame;
 
 /*
  * Main stu interpreter structure.
@@ -38,58 +41,157 @@ typedef struct Stu {
     struct Alloc *env_alloc;
     struct Alloc *sv_special_alloc;
     struct Alloc *sv_ufunc_alloc;
-    struct Alloc *gc_scope_alloc;
-
-    /* GC structures. */
-    struct Scope *gc_scope_stack;
-
-    /* Entry points of interpreter gc-managed structure list. */
+    struct Alloc *code_alloc;
+    struct Alloc *payload_alloc;
+
+    /*
+     * GC structures. Objects saved in a scope are kept on the root stack,
+     * and each scope records the size of the root stack when it began.
+     */
+    struct Gc **gc_roots;
+    long gc_roots_size;
+    long gc_roots_capacity;
+    long *gc_scopes;
+    int gc_scopes_size;
+    int gc_scopes_capacity;
+
+    /* Objects waiting to have their children traced. */
+    struct Gc **gc_mark_stack;
+    long gc_mark_stack_size;
+    long gc_mark_stack_capacity;
+
+    /*
+     * Entry points of interpreter gc-managed structure lists. New objects
+     * are young and are promoted to the old list once they survive a
+     * collection.
+     */
     struct Gc *gc_head;
     struct Gc *gc_tail;
+    struct Gc *gc_old_head;
+    struct Gc *gc_old_tail;
     int gc_allocs;
+    long gc_old_count;
+    long gc_old_live;
+
+    /* Soft limit on the heap in bytes, or zero for none. */
+    size_t gc_heap_limit;
+    size_t gc_heap_trigger;
+    long gc_allocs_since_major;
+
+    /* Old objects which may point to young ones. */
+    struct Gc **gc_remembered;
+    long gc_remembered_size;
+    long gc_remembered_capacity;
+    int gc_young_child;
 
     /* Store the last try marker/checkpoint. */
     jmp_buf *last_try_marker;
     struct Sv *last_exception;
 
-    /* GC stats. */
-    int stats_gc_managed_objects;
-    int stats_gc_collections;
-    int stats_gc_frees;
-    int stats_gc_allocs;
-    int stats_gc_cleaned;
-    int stats_gc_scope_pushes;
-    int stats_gc_scope_pops;
+    /* GC stats, with pause times in nanoseconds. */
+    long stats_gc_managed_objects;
+    uint64_t stats_gc_collections;
+    uint64_t stats_gc_major_collections;
+    uint64_t stats_gc_frees;
+    uint64_t stats_gc_allocs;
+    uint64_t stats_gc_cleaned;
+    uint64_t stats_gc_scope_pushes;
+    uint64_t stats_gc_scope_pops;
+    uint64_t stats_gc_scope_depth_max;
+    uint64_t stats_gc_pause_ns;
+    uint64_t stats_gc_pause_max_ns;
+
+    /* Evaluation stats. */
+    uint64_t stats_env_lookups;
+    uint64_t stats_env_lookup_steps;
+    uint64_t stats_calls;
+    uint64_t stats_macro_expansions;
+    uint64_t stats_exceptions;
 
     /* Native functions */
     struct Sv **native_func_args;
     unsigned native_func_args_capacity;
 
     /* Call stack. */
-    struct Sv *call_stack;
+    struct Sv **call_stack;
+    long call_stack_depth;
+    long call_stack_size;
+
+    /*
+     * Profiler ticks not yet taken as samples, the number of samples of
+     * each collapsed call stack, and space for collapsing the stack.
+     */
+    volatile sig_atomic_t profile_ticks;
+    struct Hash *profile_samples;
+    char *profile_buf;
+    size_t profile_buf_len;
+    size_t profile_buf_size;
 
     /* Types data */
     struct Type_registry type_registry;
 
+    /* Type of the structures made by runtime-stats, once registered. */
+    Sv_type metrics_type;
+
     /* Main environment. */
     struct Env *main_env;
 
+    /*
+     * Main environment bindings indexed by symbol id. Only bindings with
+     * a sequence number of at least main_index_base are indexed, and
+     * main_index_floor is the binding below the oldest of them.
+     */
+    struct Env **main_index;
+    long main_index_size;
+    long main_index_base;
+    long main_seq;
+    struct Env *main_index_floor;
+
+    /* Bumped by anything that binds a global, invalidating lookup caches. */
+    long env_version;
+
     /* Env capture pointers. */
     struct Env *env_capture_head;
     struct Env *env_capture_tail;
 
+    /* Evaluation strategy, see STU_EVAL_VM and STU_EVAL_TREE. */
+    int eval_mode;
+
+    /* Bumped whenever a macro may have changed, invalidating compiled code. */
+    long macro_epoch;
+
+    /* Flags symbol ids which have ever been bound to a macro. */
+    unsigned char *macro_syms;
+    long macro_syms_size;
+
+    /* Virtual machine value and frame stacks. */
+    struct Sv **vm_stack;
+    long vm_sp;
+    long vm_stack_size;
+    struct Vm_frame *vm_frames;
+    long vm_fp;
+    long vm_frames_size;
+
     /* Module configuration. */
     struct Sv *mod_include_locations;
     struct Mod_spec *current_module;
 
+    /*
+     * Imported modules by real path, the real path of each file name
+     * imported, and where parsed module forms are cached, if anywhere.
+     */
+    struct Hash *mod_cache;
+    struct Hash *mod_paths;
+    char *mod_forms_dir;
+
     /* Symbol table structures. */
     struct Hash *sym_name_to_id;
     char **sym_id_to_name;
     long sym_num_ids;
-} Stu;
 
-extern struct Sv *Sv_nil;
-#define NIL Sv_nil
+    /* Reentrant flex scanner shared by every parse in this interpreter. */
+    void *scanner;
+} Stu;
 
 /* Internal helper functions. */
 extern struct Sv *Stu_parse_buf(Stu *, const char *);
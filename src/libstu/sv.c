@@ -32,6 +32,24 @@
 #include "symtab.h"
 #include "utils.h"
 #include "call_stack.h"
+#include "vm.h"
+
+/* Lambda calls with up to this many arguments are bound from the stack. */
+#define SV_CALL_ARGS 16
+
+/* A lambda call in tail position, left for Sv_call to make. */
+typedef struct Tail_call {
+    Sv *f;
+    Sv *args;
+    Sv *name;
+} Tail_call;
+
+static Sv *eval_tail(Stu *, Env *, Sv *, Tail_call *);
+
+/* Types of the immediate tags, indexed by the low pointer bits. */
+const Sv_type Sv_imm_types[SV_TAG_MASK + 1] = {
+    SV_NIL, SV_INT, SV_SYM, SV_INT, SV_NIL, SV_INT, SV_BOOL, SV_INT
+};
 
 extern Sv
 *Sv_new(Stu *stu, Sv_type type)
@@ -51,6 +69,9 @@ extern Sv
 extern Sv
 *Sv_new_int(Stu *stu, long i)
 {
+    if (i >= SV_FIXNUM_MIN && i <= SV_FIXNUM_MAX)
+        return SV_FIXNUM(i);
+
     Sv *x = Sv_new(stu, SV_INT);
     x->val.i = i;
     return x;
@@ -92,34 +113,37 @@ extern Sv
 extern Sv
 *Sv_new_bool(Stu *stu, short i)
 {
-    Sv *x = Sv_new(stu, SV_BOOL);
-    x->val.i = (int) i;
-    return x;
+    return i ? SV_TRUE : SV_FALSE;
+}
+
+/* Copy a string into the payload allocator. */
+static char
+*payload_strdup(Stu *stu, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = Alloc_allocate_size(stu->payload_alloc, len);
+
+    return memcpy(copy, str, len);
 }
 
 extern Sv
 *Sv_new_str(Stu *stu, const char *str)
 {
     Sv *x = Sv_new(stu, SV_STR);
-    if ((x->val.buf = strdup(str)) == NULL)
-        err(1, "Sv_new_str");
+    x->val.buf = payload_strdup(stu, str);
     return x;
 }
 
 extern Sv
 *Sv_new_sym(Stu *stu, const char *sym)
 {
-    Sv *x = Sv_new(stu, SV_SYM);
-    x->val.i = Symtab_get_id(stu, sym);
-    return x;
+    return SV_IMM(Symtab_get_id(stu, sym), SV_TAG_SYM);
 }
 
 extern Sv
 *Sv_new_sym_from_id(Stu *stu, long id)
 {
-    Sv *x = Sv_new(stu, SV_SYM);
-    x->val.i = id;
-    return x;
+    return SV_IMM(id, SV_TAG_SYM);
 }
 
 extern Sv
@@ -161,6 +185,14 @@ extern Sv
     f->formals = formals;
     f->body = body;
     f->is_macro = 0;
+    f->size = Sv_formals_size(stu, formals, &f->arity);
+    f->bound = NULL;
+    f->num_bound = 0;
+    f->scope = NULL;
+    f->expanded = NULL;
+    f->expanded_epoch = 0;
+    f->code = NULL;
+    f->proto = NULL;
     x->val.ufunc = f;
 
     return x;
@@ -171,7 +203,7 @@ extern Sv
 {
     long count = 0;
     for (Sv *tmp = sv; !IS_NIL(tmp); tmp = CDR(tmp))
-        if (tmp->type == SV_CONS) {
+        if (SV_TYPE(tmp) == SV_CONS) {
             if (count == LONG_MAX)
                 return Sv_new_err(stu, "Vector exceeds maximum allowed size");
             ++count;
@@ -180,13 +212,36 @@ extern Sv
         }
 
     Sv *x = Sv_new(stu, SV_VECTOR);
-    Sv_vector *vec = CHECKED_MALLOC(sizeof(*vec) + count * sizeof(Sv*));
+    Sv_vector *vec = Vector_new(stu, count, NULL);
+    Sv **values = NULL;
+    long n = 0;
 
     x->val.vector = vec;
-    vec->length = count;
-    long i = 0;
-    for (Sv *tmp = sv; !IS_NIL(tmp); tmp = CDR(tmp), ++i)
-        vec->values[i] = CAR(tmp);
+    for (long i = 0; i < count; ++i, sv = CDR(sv), --n) {
+        if (n == 0)
+            values = Vector_chunk(vec, i, &n);
+        *values++ = CAR(sv);
+    }
+
+    return x;
+}
+
+extern Sv
+*Sv_new_vector_from_array(struct Stu *stu, long count, Sv **values)
+{
+    Sv *x = Sv_new(stu, SV_VECTOR);
+
+    x->val.vector = Vector_new(stu, count, values);
+
+    return x;
+}
+
+extern Sv
+*Sv_new_hash_map(struct Stu *stu)
+{
+    Sv *x = Sv_new(stu, SV_HASH_MAP);
+
+    x->val.hash_map = Hash_map_new(stu, 0);
 
     return x;
 }
@@ -197,13 +252,13 @@ extern Sv
     Sv_vector *field_vector = Type_field_vector(stu, type)->val.vector;
 
     Sv *x = Sv_new(stu, type);
-    Sv **fields =
-        CHECKED_MALLOC(field_vector->length * sizeof(Sv*));
+    Sv **fields = Alloc_allocate_size(
+        stu->payload_alloc, field_vector->length * sizeof(Sv*));
     x->val.structure = fields;
 
     Sv *tmp = value_list;
     for (long i = 0; i < field_vector->length; ++i, tmp = CDR(tmp)) {
-        if (tmp->type != SV_CONS)
+        if (SV_TYPE(tmp) != SV_CONS)
             return Sv_new_err(stu, "Record argument is not a proper list");
         if (IS_NIL(tmp))
             return Sv_new_err(stu, "Not enough arguments for structure");
@@ -225,7 +280,7 @@ extern Sv
 extern Sv
 *Sv_new_structure_access(struct Stu *stu, Sv *structure, Sv *field) {
     Sv *x = Sv_new(stu, SV_STRUCTURE_ACCESS);
-    if (field->type != SV_SYM)
+    if (SV_TYPE(field) != SV_SYM)
         return Sv_new_err(stu, "Field access field is not a symbol");
     x->val.reg[SV_CAR_REG] = structure;
     x->val.reg[SV_CDR_REG] = field;
@@ -249,8 +304,7 @@ extern Sv
     int flags = icase ? REG_ICASE : 0;
     if (regcomp(&(x->val.re.compiled), re, (flags | REG_EXTENDED)) != 0)
         err(1, "Sv_new_re");
-    if ((x->val.re.spec = strdup(re)) == NULL)
-        err(1, "Sv_new_re");
+    x->val.re.spec = payload_strdup(stu, re);
     return x;
 }
 
@@ -264,7 +318,7 @@ Sv_destroy(Stu *stu, Sv **sv)
         case SV_ERR:
         case SV_STR:
             if ((*sv)->val.buf) {
-                free((*sv)->val.buf);
+                Alloc_release(stu->payload_alloc, (*sv)->val.buf);
                 (*sv)->val.buf = NULL;
             }
             break;
@@ -281,6 +335,11 @@ Sv_destroy(Stu *stu, Sv **sv)
                 (*sv)->val.ufunc->env = NULL;
                 (*sv)->val.ufunc->formals = NULL;
                 (*sv)->val.ufunc->body = NULL;
+                (*sv)->val.ufunc->code = NULL;
+                (*sv)->val.ufunc->proto = NULL;
+                (*sv)->val.ufunc->bound = NULL;
+                (*sv)->val.ufunc->scope = NULL;
+                (*sv)->val.ufunc->expanded = NULL;
                 Alloc_release(stu->sv_ufunc_alloc, (*sv)->val.ufunc);
                 (*sv)->val.ufunc = NULL;
             }
@@ -296,20 +355,25 @@ Sv_destroy(Stu *stu, Sv **sv)
             break;
 
         case SV_NATIVE_FUNC:
-            free((*sv)->val.func);
+            Alloc_release(stu->payload_alloc, (*sv)->val.func);
             (*sv)->val.func = NULL;
             break;
 
         case SV_NATIVE_CLOS:
-            free((*sv)->val.clos);
+            Alloc_release(stu->payload_alloc, (*sv)->val.clos);
             (*sv)->val.clos = NULL;
             break;
 
         case SV_VECTOR:
-            free((*sv)->val.vector);
+            Vector_release(stu, (*sv)->val.vector);
             (*sv)->val.vector = NULL;
             break;
 
+        case SV_HASH_MAP:
+            Hash_map_destroy(stu, (*sv)->val.hash_map);
+            (*sv)->val.hash_map = NULL;
+            break;
+
         case SV_FOREIGN:
             if ((*sv)->val.foreign.destructor != NULL) {
                 (*sv)->val.foreign.destructor((*sv)->val.foreign.obj);
@@ -321,14 +385,14 @@ Sv_destroy(Stu *stu, Sv **sv)
         case SV_REGEX:
             regfree(&((*sv)->val.re.compiled));
             if ((*sv)->val.re.spec != NULL) {
-                free((*sv)->val.re.spec);
+                Alloc_release(stu->payload_alloc, (*sv)->val.re.spec);
                 (*sv)->val.re.spec = NULL;
             }
             break;
 
         default:
             if ((*sv)->type >= SV_BUILTIN_TYPE_END) {
-                free((*sv)->val.structure);
+                Alloc_release(stu->payload_alloc, (*sv)->val.structure);
                 (*sv)->val.structure = NULL;
             }
             break;
@@ -346,7 +410,7 @@ Sv_cons_dump(Stu *stu, Sv *sv, FILE *out)
     Sv *cdr = CDR(sv);
     Sv_dump(stu, car, out);
     if (!IS_NIL(cdr)) {
-        switch (cdr->type) {
+        switch (SV_TYPE(cdr)) {
         case SV_CONS:
             fprintf(out, " ");
             Sv_cons_dump(stu, cdr, out);
@@ -363,10 +427,13 @@ Sv_cons_dump(Stu *stu, Sv *sv, FILE *out)
 extern void
 Sv_dump(Stu *stu, Sv *sv, FILE *out)
 {
+    Sv *formals = NULL;
+    int i;
+
     if (sv) {
-        switch (sv->type) {
+        switch (SV_TYPE(sv)) {
         case SV_SYM:
-            fprintf(out, "%s", Symtab_get_name(stu, sv->val.i));
+            fprintf(out, "%s", Symtab_get_name(stu, SV_I(sv)));
             break;
 
         case SV_ERR:
@@ -404,7 +471,7 @@ Sv_dump(Stu *stu, Sv *sv, FILE *out)
             break;
 
         case SV_INT:
-            fprintf(out, "%ld", sv->val.i);
+            fprintf(out, "%ld", SV_I(sv));
             break;
 
         case SV_FLOAT:
@@ -416,7 +483,7 @@ Sv_dump(Stu *stu, Sv *sv, FILE *out)
             break;
 
         case SV_BOOL:
-            fprintf(out, "%s", sv->val.i ? "#t" : "#f");
+            fprintf(out, "%s", SV_I(sv) ? "#t" : "#f");
             break;
 
         case SV_NATIVE_FUNC:
@@ -429,14 +496,19 @@ Sv_dump(Stu *stu, Sv *sv, FILE *out)
 
         case SV_LAMBDA:
             if (sv->val.ufunc) {
+                /* Only show the formals a partial application still needs. */
+                formals = sv->val.ufunc->formals;
+                for (i = 0; i < sv->val.ufunc->num_bound; i++)
+                    formals = CDR(formals);
+
                 PUSH_SCOPE(stu);
                 Sv_dump(
                     stu, Sv_cons(
                         stu,
-                        Sv_new_sym(stu, "λ"),
+                        Sv_new_sym_from_id(stu, SPECIAL_FORM_LAMBDA_U),
                         Sv_cons(
                             stu,
-                            sv->val.ufunc->formals,
+                            formals,
                             sv->val.ufunc->body)), out);
                 POP_SCOPE(stu);
             }
@@ -449,17 +521,31 @@ Sv_dump(Stu *stu, Sv *sv, FILE *out)
         case SV_VECTOR:
             fprintf(out, "[");
             if (sv->val.vector->length > 0) {
-                Sv_dump(stu, sv->val.vector->values[0], out);
+                Sv_dump(stu, Vector_at(sv->val.vector, 0), out);
                 for (long i = 1; i < sv->val.vector->length; ++i) {
                     fprintf(out, " ");
-                    Sv_dump(stu, sv->val.vector->values[i], out);
+                    Sv_dump(stu, Vector_at(sv->val.vector, i), out);
                 }
             }
             fprintf(out, "]");
             break;
 
+        case SV_HASH_MAP:
+            fprintf(out, "<hash");
+            for (long i = 0; i < sv->val.hash_map->used; ++i) {
+                Hash_map_ent *e = &sv->val.hash_map->entries[i];
+                if (e->key != NULL) {
+                    fprintf(out, " ");
+                    Sv_dump(stu, e->key, out);
+                    fprintf(out, " ");
+                    Sv_dump(stu, e->value, out);
+                }
+            }
+            fprintf(out, ">");
+            break;
+
         case SV_STRUCTURE_CONSTRUCTOR:
-            fprintf(out, "<constructor %s>", Type_name_string(stu, sv->type));
+            fprintf(out, "<constructor %s>", Type_name_string(stu, SV_TYPE(sv)));
             break;
 
         case SV_STRUCTURE_ACCESS:
@@ -477,29 +563,18 @@ Sv_dump(Stu *stu, Sv *sv, FILE *out)
             break;
 
         default:
-            fprintf(out, "<structure %s>", Type_name_string(stu, sv->type));
+            fprintf(out, "<structure %s>", Type_name_string(stu, SV_TYPE(sv)));
             break;
         }
     }
 }
 
-static Sv
-*Sv_copy_sym(Stu *stu, Sv *x)
-{
-    Sv *y = Sv_new(stu, SV_SYM);
-    y->val.i = x->val.i;
-    return y;
-}
-
+/* Vectors are never changed in place, so a copy shares all of x. */
 static Sv
 *Sv_copy_vector(Stu *stu, Sv *x)
 {
-    Sv_vector *vec = x->val.vector;
-    size_t size = sizeof(Sv_vector) + vec->length * sizeof(Sv*);
-    Sv_vector *vec_copy = CHECKED_MALLOC(size);
-    memcpy(vec_copy, vec, size);
     Sv *copy = Sv_new(stu, SV_VECTOR);
-    copy->val.vector = vec_copy;
+    copy->val.vector = Vector_share(stu, x->val.vector);
     return copy;
 }
 
@@ -508,15 +583,18 @@ extern Sv
 {
     if (IS_NIL(y)) return x;
 
-    Sv_vector *vec = x->val.vector;
-    size_t new_size = sizeof(Sv_vector) + (vec->length + 1) * sizeof(Sv *);
-    Sv_vector *new_vec = CHECKED_MALLOC(new_size);
-    new_vec->length = vec->length + 1;
-    memcpy(new_vec->values, vec->values, (vec->length * sizeof(Sv *)));
-    new_vec->values[new_vec->length - 1] = y;
+    Sv *z = Sv_new(stu, SV_VECTOR);
+    z->val.vector = Vector_push(stu, x->val.vector, y);
+
+    return z;
+}
 
+/* A new vector like x, but with y at index i, which must be in range. */
+extern Sv
+*Sv_vector_set(Stu *stu, Sv *x, long i, Sv *y)
+{
     Sv *z = Sv_new(stu, SV_VECTOR);
-    z->val.vector = new_vec;
+    z->val.vector = Vector_set(stu, x->val.vector, i, y);
 
     return z;
 }
@@ -525,9 +603,9 @@ extern Sv
 *Sv_copy_structure(Stu *stu, Sv *x) {
     long length = Type_field_vector(stu, x->type)->val.vector->length;
     Sv *copy = Sv_new(stu, x->type);
-    Sv **fields = CHECKED_MALLOC(length * sizeof(Sv*));
+    Sv **fields = Alloc_allocate_size(stu->payload_alloc, length * sizeof(Sv*));
     copy->val.structure = fields;
-    memcpy(fields, x->val.structure, length);
+    memcpy(fields, x->val.structure, length * sizeof(Sv*));
     return copy;
 }
 
@@ -538,16 +616,11 @@ extern Sv
     int i;
     Sv *y = NULL;
 
+    if (SV_IS_IMM(x))
+        return x;
+
     if (x) {
         switch (x->type) {
-        case SV_NIL:
-            y = x;
-            break;
-
-        case SV_SYM:
-            y = Sv_copy_sym(stu, x);
-            break;
-
         case SV_ERR:
             if (x->val.buf)
                 y = Sv_new_err(stu, x->val.buf);
@@ -581,14 +654,17 @@ extern Sv
             y = Sv_new_rational(stu, x->val.rational.n, x->val.rational.d);
             break;
 
-        case SV_BOOL:
-            y = Sv_new_bool(stu, (short) x->val.i);
-            break;
-
         case SV_LAMBDA:
             if (x->val.ufunc) {
                 y = Sv_new_lambda(
                     stu, x->val.ufunc->env, x->val.ufunc->formals, x->val.ufunc->body);
+                y->val.ufunc->code = x->val.ufunc->code;
+                y->val.ufunc->proto = x->val.ufunc->proto;
+                y->val.ufunc->bound = x->val.ufunc->bound;
+                y->val.ufunc->num_bound = x->val.ufunc->num_bound;
+                y->val.ufunc->scope = x->val.ufunc->scope;
+                y->val.ufunc->expanded = x->val.ufunc->expanded;
+                y->val.ufunc->expanded_epoch = x->val.ufunc->expanded_epoch;
             }
             break;
 
@@ -624,15 +700,24 @@ extern Sv
     return z;
 }
 
+/*
+ * Only the newest cell is kept in scope, as it reaches the rest; a scope
+ * holding every cell would be rescanned by each collection on the way.
+ */
 extern Sv
 *Sv_reverse(Stu *stu, Sv *x)
 {
     Sv *y = NIL;
 
-    while (!IS_NIL(x) && x->type == SV_CONS) {
+    PUSH_SCOPE(stu);
+    while (!IS_NIL(x) && SV_TYPE(x) == SV_CONS) {
         y = Sv_cons(stu, CAR(x), y);
         x = CDR(x);
+        POP_SCOPE(stu);
+        PUSH_SCOPE(stu);
+        SCOPE_SAVE(stu, y);
     }
+    POP_N_SAVE(stu, y);
 
     return y;
 }
@@ -645,7 +730,7 @@ extern Sv
     if (!x)
         return x;
 
-    if (x->type != SV_CONS)
+    if (SV_TYPE(x) != SV_CONS)
         return Sv_cons(stu, x, NIL);
 
     while (!IS_NIL(x) && (y = CAR(x))) {
@@ -659,60 +744,179 @@ extern Sv
 extern Sv
 *Sv_expand_1(Stu *stu, Sv *x)
 {
-    if (!x || x->type != SV_CONS)
+    if (!x || SV_TYPE(x) != SV_CONS)
         return x;
 
-    Sv *head = CAR(x);
-    Sv *macro;
-
-    if (head->type != SV_SYM)
-        return x;
-
-    macro = Env_main_get(stu, head);
-    if (!IS_MACRO(macro))
+    Sv *macro = Env_main_macro(stu, CAR(x));
+    if (macro == NULL)
         return x;
 
+    stu->stats_macro_expansions++;
     return Sv_call(stu, stu->main_env, macro, CDR(x));
 }
 
 extern Sv
 *Sv_expand(Stu *stu, Sv *x)
 {
-    Sv *head;
-
     do {
         x = Sv_expand_1(stu, x);
-        head = CAR(x);
-    } while (IS_MACRO(Env_main_get(stu, head)));
+    } while (x && SV_TYPE(x) == SV_CONS && Env_main_macro(stu, CAR(x)));
+
+    return x;
+}
+
+static Sv *expand_all(Stu *, Sv *);
+
+static void
+append(Stu *stu, Sv **head, Sv **last, Sv *x)
+{
+    Sv *y = Sv_cons(stu, x, NIL);
+
+    if (*last) {
+        (*last)->val.reg[SV_CDR_REG] = y;
+    } else {
+        *head = y;
+    }
+    *last = y;
+}
+
+/*
+ * Expand each form in a list, only copying the list if any of them
+ * changed. A defmacro may change how the forms after it expand, so they
+ * are left for when they are evaluated.
+ */
+static Sv
+*expand_forms(Stu *stu, Sv *forms)
+{
+    Sv *head = NULL, *last = NULL, *cur, *prev, *form, *y;
+    short copied = 0;
+
+    for (cur = forms; !IS_NIL(cur) && SV_TYPE(cur) == SV_CONS; cur = CDR(cur)) {
+        form = CAR(cur);
+        if (form && SV_TYPE(form) == SV_CONS && CAR(form) && SV_TYPE(CAR(form)) == SV_SYM
+            && SV_I(CAR(form)) == SPECIAL_FORM_DEFMACRO)
+        {
+            break;
+        }
+
+        y = expand_all(stu, form);
+        if (y != form && !copied) {
+            for (prev = forms; prev != cur; prev = CDR(prev))
+                append(stu, &head, &last, CAR(prev));
+            copied = 1;
+        }
+        if (copied)
+            append(stu, &head, &last, y);
+    }
+
+    if (!copied)
+        return forms;
+
+    last->val.reg[SV_CDR_REG] = cur;
+
+    return head;
+}
+
+/* Expand all macros in a form, including those in nested forms. */
+static Sv
+*expand_all(Stu *stu, Sv *x)
+{
+    Sv *head, *args, *rest, *y;
+
+    x = Sv_expand(stu, x);
+    if (!x || SV_TYPE(x) != SV_CONS)
+        return x;
+
+    head = CAR(x);
+    args = CDR(x);
+
+    if (!head || SV_TYPE(head) != SV_SYM || SV_I(head) > SPECIAL_FORM_DEFMOD)
+        return expand_forms(stu, x);
+
+    switch (SV_I(head)) {
+    case SPECIAL_FORM_LAMBDA:
+    case SPECIAL_FORM_LAMBDA_U:
+    case SPECIAL_FORM_DEF:
+        /* Everything after the formals or pattern is evaluated. */
+        if (SV_TYPE(args) == SV_CONS && (y = expand_forms(stu, CDR(args))) != CDR(args))
+            return Sv_cons(stu, head, Sv_cons(stu, CAR(args), y));
+        break;
+
+    case SPECIAL_FORM_DEFUN:
+        rest = CDR(args);
+        if (SV_TYPE(args) == SV_CONS && rest && SV_TYPE(rest) == SV_CONS
+            && (y = expand_forms(stu, CDR(rest))) != CDR(rest))
+        {
+            return Sv_cons(stu, head, Sv_cons(
+                stu, CAR(args), Sv_cons(stu, CAR(rest), y)));
+        }
+        break;
+
+    case SPECIAL_FORM_IF:
+    case SPECIAL_FORM_TRY:
+        if ((y = expand_forms(stu, args)) != args)
+            return Sv_cons(stu, head, y);
+        break;
+
+    default:
+        break;
+    }
 
     return x;
 }
 
+/*
+ * Fetch the body of a lambda with all of its macros expanded, expanding
+ * it on first use so the tree-walker doesn't expand the same forms on
+ * every call. The result is discarded if any macros have changed since.
+ */
+static Sv
+*expanded_body(Stu *stu, Sv *f)
+{
+    Sv_ufunc *ufunc = f->val.ufunc;
+
+    if (ufunc->expanded == NULL || ufunc->expanded_epoch != stu->macro_epoch) {
+        PUSH_SCOPE(stu);
+        ufunc->expanded = expand_forms(stu, ufunc->body);
+        GC_WRITE(stu, f, ufunc->expanded);
+        ufunc->expanded_epoch = stu->macro_epoch;
+        POP_SCOPE(stu);
+    }
+
+    return ufunc->expanded;
+}
+
 extern void
 *Sv_get_foreign_obj(Stu *stu, Sv *x)
 {
-    return x->type == SV_FOREIGN ? x->val.foreign.obj : NULL;
+    return SV_TYPE(x) == SV_FOREIGN ? x->val.foreign.obj : NULL;
 }
 
 static Sv
 *Sv_eval_vector(Stu *stu, Env *env, Sv *x)
 {
-    Sv *copy = Sv_copy(stu, x);
-    Sv_vector *vec = copy->val.vector;
-    for (long i = 0; i < vec->length; ++i)
-        vec->values[i] = Sv_eval(stu, env, vec->values[i]);
-    return copy;
+    long length = x->val.vector->length, n = 0;
+    Sv *y = Sv_new(stu, SV_VECTOR), **values = NULL;
+
+    y->val.vector = Vector_new(stu, length, NULL);
+    for (long i = 0; i < length; ++i, --n) {
+        if (n == 0)
+            values = Vector_chunk(y->val.vector, i, &n);
+        *values++ = Sv_eval(stu, env, Vector_at(x->val.vector, i));
+    }
+
+    return y;
 }
 
 static Sv
 *Sv_eval_structure_access(Stu *stu, Env *env, Sv *x)
 {
     Sv *structure = Sv_eval(stu, env, x->val.reg[SV_CAR_REG]);
-    if (IS_NIL(structure) || structure->type == SV_ERR) {
+    if (IS_NIL(structure) || SV_TYPE(structure) == SV_ERR) {
         return structure;
     }
     Sv *field = x->val.reg[SV_CDR_REG];
-    return structure->val.structure[Type_field_index(stu, structure->type, field)];
+    return structure->val.structure[Type_field_index(stu, SV_TYPE(structure), field)];
 }
 
 extern Sv
@@ -723,18 +927,42 @@ extern Sv
     if (!x)
         return x;
 
-    PUSH_SCOPE(stu);
-    switch (x->type) {
+    if (stu->eval_mode == STU_EVAL_VM) {
+        switch (SV_TYPE(x)) {
+        case SV_SPECIAL:
+        case SV_CONS:
+        case SV_VECTOR:
+        case SV_STRUCTURE_ACCESS:
+            return Vm_eval(stu, env, x);
+        }
+    }
+
+    switch (SV_TYPE(x)) {
     case SV_SYM:
         /*
          * If the symbol exists but it's value is NULL, then it is
          * the empty list.
          */
-        if ((y = Env_get(env, x)) == NULL && !Env_exists(env, x)) {
+        if ((y = Env_get(stu, env, x)) == NULL && !Env_exists(stu, env, x)) {
             y = Sv_new_err(stu, "possibly unknown symbol");
         }
+        SCOPE_SAVE(stu, y);
+        return y;
+
+    case SV_SPECIAL:
+    case SV_CONS:
+    case SV_VECTOR:
+    case SV_STRUCTURE_ACCESS:
         break;
 
+    default:
+        /* Atoms evaluate to themselves, and need no scope of their own. */
+        SCOPE_SAVE(stu, x);
+        return x;
+    }
+
+    PUSH_SCOPE(stu);
+    switch (SV_TYPE(x)) {
     case SV_SPECIAL:
         y = Sv_eval_special(stu, env, x);
         break;
@@ -750,18 +978,28 @@ extern Sv
     case SV_STRUCTURE_ACCESS:
         y = Sv_eval_structure_access(stu, env, x);
         break;
-
-    default:
-        y = x;
-        break;
     }
     POP_N_SAVE(stu, y);
 
     return y;
 }
 
-extern Sv
-*Sv_eval_list(Stu *stu, Env *env, Sv *x, Env **new_env)
+/* Keep a pending tail call alive in the current scope. */
+static void
+tail_call_save(Stu *stu, Tail_call *tail)
+{
+    if (tail && tail->f) {
+        SCOPE_SAVE(stu, tail->f);
+        SCOPE_SAVE(stu, tail->args);
+    }
+}
+
+/*
+ * Evaluate a body of forms. If tail is supplied, a lambda call made by
+ * the last form is left in tail for the caller to make instead.
+ */
+static Sv
+*eval_list(Stu *stu, Env *env, Sv *x, Env **new_env, Tail_call *tail)
 {
     if (IS_NIL(x)) return x;
 
@@ -769,13 +1007,17 @@ extern Sv
     Sv *last_result = NIL;
     Sv *cur = CAR(x);
 
-    Env *tail, *head;
-    Env_capture_save(stu, &tail, &head);
-    PUSH_N_SAVE(stu, head);
+    Env *capture_tail, *capture_head;
+    Env_capture_save(stu, &capture_tail, &capture_head);
+    PUSH_N_SAVE(stu, capture_head);
 
     while (!IS_NIL(cur)) {
         Env_capture_reset(stu);
-        last_result = Sv_eval(stu, next_env, cur);
+        if (tail && IS_NIL(CADR(x))) {
+            last_result = eval_tail(stu, next_env, cur, tail);
+        } else {
+            last_result = Sv_eval(stu, next_env, cur);
+        }
         next_env = Env_capture_rebase(stu, next_env);
         SCOPE_SAVE(stu, next_env);
 
@@ -783,8 +1025,9 @@ extern Sv
         cur = CAR(x);
     }
 
-    Env_capture_restore(stu, tail, head);
+    Env_capture_restore(stu, capture_tail, capture_head);
     POP_N_SAVE(stu, last_result);
+    tail_call_save(stu, tail);
 
     /* Save updated environment in the new head scope stack. */
     if (new_env != NULL) {
@@ -795,6 +1038,12 @@ extern Sv
     return last_result;
 }
 
+extern Sv
+*Sv_eval_list(Stu *stu, Env *env, Sv *x, Env **new_env)
+{
+    return eval_list(stu, env, x, new_env, NULL);
+}
+
 extern Sv
 *Sv_eval_special(Stu *stu, Env *env, Sv *x)
 {
@@ -803,10 +1052,10 @@ extern Sv
 
     switch (special->type) {
     case SV_SPECIAL_BACKQUOTE:
-        if (body->type == SV_SYM) {
+        if (SV_TYPE(body) == SV_SYM) {
             return Sv_eval_sexp(stu, env,
-                Sv_cons(stu, Sv_new_sym(stu, "quote"), Sv_cons(stu, body, NIL)));
-        } else if (body->type == SV_CONS) {
+                Sv_cons(stu, Sv_new_sym_from_id(stu, SPECIAL_FORM_QUOTE), Sv_cons(stu, body, NIL)));
+        } else if (SV_TYPE(body) == SV_CONS) {
             return Sv_eval_special_cons(stu, env, body);
         } else {
             return body;
@@ -831,7 +1080,7 @@ extern Sv
 
     Sv *head = CAR(x);
 
-    if (head->type == SV_SPECIAL) {
+    if (SV_TYPE(head) == SV_SPECIAL) {
         Sv_special *special = head->val.special;
 
         switch (special->type) {
@@ -841,9 +1090,9 @@ extern Sv
                 Sv_eval_special_cons(stu, env, CDR(x)));
 
         case SV_SPECIAL_COMMA_SPREAD:
-            if (special->body->type == SV_SYM || special->body->type == SV_CONS) {
+            if (SV_TYPE(special->body) == SV_SYM || SV_TYPE(special->body) == SV_CONS) {
                 Sv *val = Sv_eval(stu, env, special->body);
-                if (!IS_NIL(val) && val->type == SV_CONS) {
+                if (!IS_NIL(val) && SV_TYPE(val) == SV_CONS) {
                     return val;
                 } else {
                     return Sv_new_err(stu, "spread operator applied to atom");
@@ -856,7 +1105,7 @@ extern Sv
         case SV_SPECIAL_BACKQUOTE:
             return Sv_new_err(stu, "backquote is not permitted inside of other backquote");
         }
-    } else if (head->type == SV_CONS)  {
+    } else if (SV_TYPE(head) == SV_CONS)  {
         return Sv_cons(
             stu, Sv_eval_special_cons(stu, env, head), Sv_eval_special_cons(stu, env, CDR(x)));
     } else {
@@ -866,19 +1115,33 @@ extern Sv
     return Sv_new_err(stu, "Got confused inside of backquoted list");
 }
 
-extern Sv
-*Sv_eval_sexp(Stu *stu, Env *env, Sv *x)
+/*
+ * Evaluate an s-expression. If tail is supplied the form is in tail
+ * position, so a lambda call is left in tail rather than made here and
+ * NULL is returned.
+ */
+static Sv
+*eval_sexp(Stu *stu, Env *env, Sv *x, Tail_call *tail)
 {
     Sv *cur = NULL, *y = NULL, *z = NULL;
     Special_form_f special = NULL;
+    int special_tail = 0;
     cur = x = Sv_expand(stu, x);
 
-    if (x->type != SV_CONS)
+    if (SV_TYPE(x) != SV_CONS)
         return Sv_eval(stu, env, x);
 
     z = CAR(cur);
 
-    if (z->type == SV_SYM && ((special = Special_form_get_f(stu, z)) != NULL)) {
+    if (tail && SV_TYPE(z) == SV_SYM && SV_I(z) == SPECIAL_FORM_IF) {
+        /* Both clauses of an if are in tail position. */
+        Call_stack_push(stu, z);
+        special_tail = Special_form_if_branch(stu, env, CDR(cur), &y);
+        Call_stack_pop(stu);
+        return special_tail ? eval_tail(stu, env, y, tail) : y;
+    }
+
+    if (SV_TYPE(z) == SV_SYM && ((special = Special_form_get_f(stu, z)) != NULL)) {
         Call_stack_push(stu, z);
         y = special(stu, env, CDR(cur));
         Call_stack_pop(stu);
@@ -887,7 +1150,7 @@ extern Sv
 
     /* Evaluate all arguments. */
     while (!IS_NIL(cur)) {
-        if (cur->type == SV_CONS) {
+        if (SV_TYPE(cur) == SV_CONS) {
             y = Sv_cons(stu, Sv_eval(stu, env, CAR(cur)), y);
             cur = CDR(cur);
         } else {
@@ -900,12 +1163,20 @@ extern Sv
 
     /* The car should now be a function. */
     if (y)
-        switch (y->type) {
+        switch (SV_TYPE(y)) {
+        case SV_LAMBDA:
+            if (tail) {
+                tail->f = y;
+                tail->args = CDR(x);
+                tail->name = SV_TYPE(z) == SV_SYM ? z : y;
+                return NULL;
+            }
+            /* Fall through. */
+
         case SV_NATIVE_FUNC:
         case SV_NATIVE_CLOS:
-        case SV_LAMBDA:
         case SV_STRUCTURE_CONSTRUCTOR:
-            if (z->type == SV_SYM) {
+            if (SV_TYPE(z) == SV_SYM) {
                 Call_stack_push(stu, z);
             } else {
                 Call_stack_push(stu, y);
@@ -921,65 +1192,256 @@ extern Sv
     return Sv_new_err(stu, "first element is not a function");
 }
 
+extern Sv
+*Sv_eval_sexp(Stu *stu, Env *env, Sv *x)
+{
+    return eval_sexp(stu, env, x, NULL);
+}
+
+/* Evaluate a form in tail position, see eval_sexp. */
+static Sv
+*eval_tail(Stu *stu, Env *env, Sv *x, Tail_call *tail)
+{
+    Sv *y = NULL;
+
+    if (!x || SV_TYPE(x) != SV_CONS || stu->eval_mode == STU_EVAL_VM)
+        return Sv_eval(stu, env, x);
+
+    PUSH_SCOPE(stu);
+    y = eval_sexp(stu, env, x, tail);
+    POP_N_SAVE(stu, y);
+    tail_call_save(stu, tail);
+
+    return y;
+}
+
 extern Sv
 *Sv_call(Stu *stu, Env *env, Sv *f, Sv *a)
 {
-    short varargs = 0;
-    Env *call_env;
-    Sv *formals, *formal, *arg, *partial, *args = a;
-    formals = formal = arg = partial = NULL;
+    Env *call_env = NULL;
+    Sv *result = NULL, *cur, *buf[SV_CALL_ARGS], **argv = buf;
+    Tail_call tail;
+    int argc = 0, traced = 0;
 
     if (!f)
         return f;
 
-    if (f->type == SV_NATIVE_FUNC)
+    stu->stats_calls++;
+    if (SV_TYPE(f) == SV_NATIVE_FUNC)
         return Sv_native_func_call(stu, env, f->val.func, a);
 
-    if (f->type == SV_NATIVE_CLOS)
+    if (SV_TYPE(f) == SV_NATIVE_CLOS)
         return Sv_native_closure_call(stu, env, f->val.clos, a);
 
-    if (f->type == SV_STRUCTURE_CONSTRUCTOR)
+    if (SV_TYPE(f) == SV_STRUCTURE_CONSTRUCTOR)
         return Sv_new_structure(stu, f->val.structure_constructor, a);
 
-    if (f->type == SV_LAMBDA) {
-        /* Bind the formals to the arguments. */
-        formals = f->val.ufunc->formals;
-        call_env = f->val.ufunc->env;
+    if (SV_TYPE(f) == SV_LAMBDA) {
+        PUSH_SCOPE(stu);
+        for (;;) {
+            for (argc = 0, cur = a; !IS_NIL(cur); cur = CDR(cur))
+                argc++;
+            if (argc > SV_CALL_ARGS)
+                argv = CHECKED_MALLOC(argc * sizeof(*argv));
+            for (argc = 0, cur = a; !IS_NIL(cur); cur = CDR(cur))
+                argv[argc++] = CAR(cur);
+
+            result = Sv_bind_argv(stu, f, argc, argv, &call_env);
+            if (argv != buf) {
+                free(argv);
+                argv = buf;
+            }
 
-        while (!IS_NIL(formals) && (formal = CAR(formals))) {
-            if (!varargs && formal->type == SV_SYM && formal->val.i == Symtab_get_id(stu, "&")) {
-                varargs = 1;
-            } else {
-                /* Get the next arg. */
-                if (args && (arg = CAR(args))) {
-                    if (varargs) {
-                        call_env = Env_put(stu, call_env, formal, Sv_list(stu, args));
-                        break;
-                    } else {
-                        call_env = Env_put(stu, call_env, formal, arg);
-                    }
-                } else if (varargs) {
-                    /* Variable args not supplied. */
-                    call_env = Env_put(stu, call_env, formal, NULL);
-                    break;
-                } else {
-                    /* No more arguments to consume. */
-                    partial = Sv_copy(stu, f);
-                    partial->val.ufunc->formals = formals;
-                    partial->val.ufunc->env = call_env;
-                    break;
-                }
-                args = CDR(args);
+            if (result) {
+                /* A partial application. */
+                break;
+            } else if (stu->eval_mode == STU_EVAL_VM) {
+                result = Vm_run(stu, call_env, Vm_code(stu, f));
+                break;
             }
-            formals = CDR(formals);
-        }
 
-        if (partial) {
-            return partial;
-        } else {
-            return Sv_eval_list(stu, call_env, f->val.ufunc->body, NULL);
+            tail.f = NULL;
+            result = eval_list(stu, call_env, expanded_body(stu, f), NULL, &tail);
+            if (tail.f == NULL)
+                break;
+
+            /*
+             * Make the call left by the last form here, so a chain of
+             * tail calls runs in constant stack and scope depth.
+             */
+            traced = Call_stack_push_tail(stu, tail.name, traced + 1) - 1;
+            stu->stats_calls++;
+            f = tail.f;
+            a = tail.args;
+            POP_SCOPE(stu);
+            PUSH_SCOPE(stu);
+            SCOPE_SAVE(stu, f);
+            SCOPE_SAVE(stu, a);
         }
+
+        while (traced-- > 0)
+            Call_stack_pop(stu);
+        POP_N_SAVE(stu, result);
+
+        return result;
     }
 
     return Sv_new_err(stu, "can only call functions");
 }
+
+/*
+ * Call f with the argc arguments in argv, for natives calling back into
+ * stu code. Natives and compiled lambdas take argv as it is; the tree
+ * walker needs an argument list, so one is made for it.
+ */
+extern Sv
+*Sv_call_argv(Stu *stu, Env *env, Sv *f, int argc, Sv **argv)
+{
+    Env *call_env = NULL;
+    Sv *result = NIL;
+
+    if (!f)
+        return f;
+
+    switch (SV_TYPE(f)) {
+    case SV_NATIVE_FUNC:
+        stu->stats_calls++;
+        return Sv_native_func_call_argv(stu, env, f->val.func, argc, argv);
+
+    case SV_NATIVE_CLOS:
+        stu->stats_calls++;
+        return Sv_native_closure_call_argv(stu, env, f->val.clos, argc, argv);
+
+    case SV_LAMBDA:
+        if (stu->eval_mode != STU_EVAL_VM)
+            break;
+        stu->stats_calls++;
+        PUSH_SCOPE(stu);
+        if ((result = Sv_bind_argv(stu, f, argc, argv, &call_env)) == NULL)
+            result = Vm_run(stu, call_env, Vm_code(stu, f));
+        POP_N_SAVE(stu, result);
+        return result;
+
+    default:
+        break;
+    }
+
+    while (argc > 0)
+        result = Sv_cons(stu, argv[--argc], result);
+
+    return Sv_call(stu, env, f, result);
+}
+
+/*
+ * Count the call frame slots needed to bind formals, storing the
+ * number that precede any varargs formal in arity. A varargs formal
+ * takes one more slot, and anything after it is never bound.
+ */
+extern int
+Sv_formals_size(Stu *stu, Sv *formals, int *arity)
+{
+    long amp = SYM_AMP;
+    Sv *formal = NULL;
+
+    for (*arity = 0; !IS_NIL(formals) && (formal = CAR(formals)); formals = CDR(formals)) {
+        if (SV_TYPE(formal) == SV_SYM && SV_I(formal) == amp)
+            return *arity + (IS_NIL(CDR(formals)) || !CADR(formals) ? 0 : 1);
+        (*arity)++;
+    }
+
+    return *arity;
+}
+
+/*
+ * Find the call frame slot bound to the symbol id sym, or -1 if none of
+ * the formals bind it. Later formals shadow earlier ones.
+ */
+extern int
+Sv_formals_index(Stu *stu, Sv *formals, long sym)
+{
+    long amp = SYM_AMP;
+    int arity, size = Sv_formals_size(stu, formals, &arity), i, index = -1;
+    short varargs = 0;
+    Sv *formal = NULL;
+
+    for (i = 0; i < size && (formal = CAR(formals)); formals = CDR(formals)) {
+        if (!varargs && i == arity && SV_TYPE(formal) == SV_SYM && SV_I(formal) == amp) {
+            varargs = 1;
+            continue;
+        }
+        if (SV_TYPE(formal) == SV_SYM && SV_I(formal) == sym)
+            index = i;
+        i++;
+    }
+
+    return index;
+}
+
+/*
+ * Bind the formals of lambda f to the argc arguments in argv, storing
+ * the environment to evaluate the body in via call_env. All formals are
+ * bound together in a single call frame, after any arguments supplied
+ * to a partial application. A NULL argument counts as missing, and if
+ * there are not enough arguments a partially applied copy of f is
+ * returned instead, otherwise NULL.
+ */
+extern Sv
+*Sv_bind_argv(Stu *stu, Sv *f, int argc, Sv **argv, Env **call_env)
+{
+    Sv_ufunc *ufunc = f->val.ufunc;
+    Sv_vector *bound = ufunc->bound ? ufunc->bound->val.vector : NULL;
+    Sv *formals = ufunc->formals, *formal = NULL, *partial = NULL, *rest = NIL;
+    Sv *buf[SV_CALL_ARGS], **args = buf;
+    int supplied, nb = ufunc->num_bound, i, j;
+    Env *frame = NULL;
+
+    /* Only the arguments up to the first missing one are used. */
+    for (supplied = 0; supplied < argc && argv[supplied]; supplied++);
+
+    if (nb + supplied < ufunc->arity) {
+        /* Not enough arguments to call f, so remember them for later. */
+        if (nb + supplied > SV_CALL_ARGS)
+            args = CHECKED_MALLOC((nb + supplied) * sizeof(*args));
+        for (i = 0; i < nb; i++)
+            args[i] = Vector_at(bound, i);
+        for (i = 0; i < supplied; i++)
+            args[nb + i] = argv[i];
+
+        partial = Sv_copy(stu, f);
+        partial->val.ufunc->bound = Sv_new_vector_from_array(stu, nb + supplied, args);
+        partial->val.ufunc->num_bound = nb + supplied;
+        if (args != buf)
+            free(args);
+
+        return partial;
+    }
+
+    if (ufunc->size == 0) {
+        *call_env = ufunc->env;
+        return NULL;
+    }
+
+    frame = Env_new_frame(stu, ufunc->env, ufunc->size);
+    for (i = 0; i < ufunc->size; formals = CDR(formals)) {
+        formal = CAR(formals);
+        if (i == ufunc->arity) {
+            /* Skip the varargs marker. */
+            formal = CADR(formals);
+            if (i - nb < supplied) {
+                for (j = supplied; j > i - nb; j--)
+                    rest = Sv_cons(stu, argv[j - 1], rest);
+                frame->vals[i] = rest;
+            }
+            frame->syms[i] = SV_I(formal);
+            break;
+        }
+
+        frame->syms[i] = SV_I(formal);
+        frame->vals[i] = i < nb ? Vector_at(bound, i) : argv[i - nb];
+        i++;
+    }
+
+    *call_env = frame;
+
+    return NULL;
+}
@@ -18,21 +18,56 @@
 #ifndef SV_DEFINED
 #define SV_DEFINED
 
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <regex.h>
 
 #include "gc.h"
+#include "hash_map.h"
 #include "types.h"
+#include "vector.h"
 
 #define SV_CONS_REGISTERS 2
 #define SV_CAR_REG 0
 #define SV_CDR_REG 1
 
-#define IS_NIL(sv)   ((sv) && (sv)->type == SV_NIL ? 1 : ((sv) ? 0 : 1))
-#define IS_MACRO(sv) ((sv) && (((sv)->type == SV_LAMBDA && ((sv)->val.ufunc->is_macro)) \
-                               || ((sv)->type == SV_NATIVE_FUNC && Sv_native_func_is_macro(sv->val.func))))
-#define CAR(sv)      ((sv) && (sv)->type == SV_CONS ? (sv)->val.reg[SV_CAR_REG] : NULL)
-#define CDR(sv)      ((sv) && (sv)->type == SV_CONS ? (sv)->val.reg[SV_CDR_REG] : NULL)
+/*
+ * Integers, booleans, nil and symbols are immediates carried in the
+ * pointer itself, using the low bits left free by heap alignment. An odd
+ * pointer is a fixnum; the other tags hold a symbol id or boolean above
+ * the tag bits, or mark nil. Integers too wide for a fixnum are boxed.
+ */
+#define SV_TAG_MASK   GC_IMM_MASK
+#define SV_TAG_BITS   3
+#define SV_TAG_INT    0x01
+#define SV_TAG_SYM    0x02
+#define SV_TAG_NIL    0x04
+#define SV_TAG_BOOL   0x06
+#define SV_TAG(sv)    ((uintptr_t) (sv) & SV_TAG_MASK)
+#define SV_IS_IMM(sv) (SV_TAG(sv) != 0)
+#define SV_IS_REF(sv) GC_IS_REF(sv)
+#define SV_IMM(v, t)  ((struct Sv *) (((uintptr_t) (v) << SV_TAG_BITS) | (t)))
+#define SV_FIXNUM(v)  ((struct Sv *) (((uintptr_t) (v) << 1) | SV_TAG_INT))
+#define SV_FIXNUM_MAX (LONG_MAX >> 1)
+#define SV_FIXNUM_MIN (-SV_FIXNUM_MAX - 1)
+#define SV_NIL_IMM    ((struct Sv *) SV_TAG_NIL)
+#define SV_TRUE       SV_IMM(1, SV_TAG_BOOL)
+#define SV_FALSE      SV_IMM(0, SV_TAG_BOOL)
+
+/* Type and integer payload of any value, immediate or boxed. */
+#define SV_TYPE(sv)   (SV_IS_IMM(sv) ? Sv_imm_types[SV_TAG(sv)] : (sv)->type)
+#define SV_I(sv)      (SV_TAG(sv) & SV_TAG_INT                           \
+                       ? (long) ((intptr_t) (sv) >> 1)                   \
+                       : (SV_IS_IMM(sv)                                  \
+                          ? (long) ((intptr_t) (sv) >> SV_TAG_BITS)      \
+                          : (sv)->val.i))
+
+#define IS_NIL(sv)   ((sv) == NULL || (sv) == SV_NIL_IMM)
+#define IS_MACRO(sv) (SV_IS_REF(sv) && (((sv)->type == SV_LAMBDA && ((sv)->val.ufunc->is_macro)) \
+                                        || ((sv)->type == SV_NATIVE_FUNC && Sv_native_func_is_macro(sv->val.func))))
+#define CAR(sv)      (SV_IS_REF(sv) && (sv)->type == SV_CONS ? (sv)->val.reg[SV_CAR_REG] : NULL)
+#define CDR(sv)      (SV_IS_REF(sv) && (sv)->type == SV_CONS ? (sv)->val.reg[SV_CDR_REG] : NULL)
 #define CADR(sv)     ((sv) ? CAR(CDR((sv))) : NULL)
 #define CADDR(sv)    ((sv) ? CAR(CDR(CDR((sv)))) : NULL)
 
@@ -56,7 +91,8 @@ typedef unsigned Sv_type;
 #define SV_STRUCTURE_CONSTRUCTOR 15
 #define SV_FOREIGN 16
 #define SV_REGEX 17
-#define SV_BUILTIN_TYPE_END 18
+#define SV_HASH_MAP 18
+#define SV_BUILTIN_TYPE_END 19
 
 enum Sv_special_type {
     SV_SPECIAL_COMMA,
@@ -69,19 +105,37 @@ struct Gc;
 struct Env;
 struct Sv;
 struct Stu;
+struct Code;
 
 typedef struct Sv *(*Sv_native_func_t)(struct Stu *, struct Env *, struct Sv **);
 
-typedef struct Sv_vector {
-    long length;
-    struct Sv *values[];
-} Sv_vector;
-
 typedef struct Sv_ufunc {
     struct Env *env;
     struct Sv *formals;
     struct Sv *body;
     short  is_macro;
+
+    /*
+     * Call frame layout; arity formals precede any varargs formal, and
+     * size counts the slots for both.
+     */
+    int arity;
+    int size;
+
+    /* Arguments already supplied to a partial application, as a vector. */
+    struct Sv *bound;
+    int num_bound;
+
+    /* Formals of the enclosing lambdas, innermost first. */
+    struct Sv *scope;
+
+    /* Body with its macros expanded, valid while macro_epoch is unchanged. */
+    struct Sv *expanded;
+    long expanded_epoch;
+
+    /* Compiled body, shared with the lambda this one was created from. */
+    struct Code *code;
+    struct Sv *proto;
 } Sv_ufunc;
 
 typedef struct Sv_special {
@@ -119,6 +173,7 @@ union Sv_val {
     struct Sv *reg[SV_CONS_REGISTERS];
     struct Sv_ufunc *ufunc;
     struct Sv_vector *vector;
+    struct Hash_map *hash_map;
     struct Sv_foreign foreign;
     struct Sv_re re;
     struct Sv **structure;
@@ -132,6 +187,8 @@ typedef struct Sv {
     union Sv_val val;
 } Sv;
 
+extern const Sv_type Sv_imm_types[];
+
 extern Sv *Sv_new(struct Stu *, Sv_type);
 extern Sv *Sv_new_int(struct Stu *, long);
 extern Sv *Sv_new_float(struct Stu *, double);
@@ -145,6 +202,8 @@ extern Sv *Sv_new_native_func(struct Stu *, Sv_native_func_t, unsigned, unsigned
 extern Sv *Sv_new_lambda(struct Stu *, struct Env *, Sv *, Sv *);
 extern Sv *Sv_new_special(struct Stu *, enum Sv_special_type type, Sv *body);
 extern Sv *Sv_new_vector(struct Stu *, Sv *);
+extern Sv *Sv_new_vector_from_array(struct Stu *, long, Sv **);
+extern Sv *Sv_new_hash_map(struct Stu *);
 extern Sv *Sv_new_structure(struct Stu *, Sv_type, Sv *);
 extern Sv *Sv_new_structure_constructor(struct Stu *, Sv_type);
 extern Sv *Sv_new_structure_access(struct Stu *, Sv *, Sv *);
@@ -161,6 +220,7 @@ extern Sv *Sv_expand(struct Stu *, Sv *);
 extern Sv *Sv_expand_1(struct Stu *, Sv *);
 extern void *Sv_get_foreign_obj(struct Stu *, Sv *);
 extern Sv *Sv_vector_append(struct Stu *, Sv *, Sv *);
+extern Sv *Sv_vector_set(struct Stu *, Sv *, long, Sv *);
 
 extern Sv *Sv_eval(struct Stu *, struct Env *, Sv *);
 extern Sv *Sv_eval_list(struct Stu *, struct Env *, Sv *, struct Env **);
@@ -168,5 +228,9 @@ extern Sv *Sv_eval_special(struct Stu *, struct Env *, Sv *);
 extern Sv *Sv_eval_special_cons(struct Stu *, struct Env *, Sv *);
 extern Sv *Sv_eval_sexp(struct Stu *, struct Env *, Sv *);
 extern Sv *Sv_call(struct Stu *, struct Env *, Sv *, Sv *);
+extern Sv *Sv_call_argv(struct Stu *, struct Env *, Sv *, int, Sv **);
+extern int Sv_formals_size(struct Stu *, Sv *, int *);
+extern int Sv_formals_index(struct Stu *, Sv *, long);
+extern Sv *Sv_bind_argv(struct Stu *, Sv *, int, Sv **, struct Env **);
 
 #endif
@@ -15,6 +15,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <err.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -23,6 +24,23 @@
 #include "symtab.h"
 #include "utils.h"
 
+static const char *reserved_names[] = {
+    "&",
+    "symbol",
+    "integer",
+    "float",
+    "rational",
+    "boolean",
+    "string",
+    "cons",
+    "regex",
+    "function",
+    "vector",
+    "hash"
+};
+
+#define NUM_RESERVED_NAMES (sizeof(reserved_names) / sizeof(*reserved_names))
+
 extern void
 Symtab_init(Stu *stu)
 {
@@ -32,6 +50,15 @@ Symtab_init(Stu *stu)
         sizeof(*(stu->sym_id_to_name)));
 }
 
+/* Give the reserved symbols the ids expected of them. */
+extern void
+Symtab_register_symbols(Stu *stu)
+{
+    for (long i = 0; i < NUM_RESERVED_NAMES; i++)
+        if (Symtab_get_id(stu, reserved_names[i]) != SYM_AMP + i)
+            err(1, "Symtab_register_symbols");
+}
+
 extern
 void Symtab_destroy(Stu *stu)
 {
@@ -17,11 +17,33 @@
 #ifndef SYMTAB_DEFINED
 #define SYMTAB_DEFINED
 
+#define SYMTAB_INITIAL_SIZE 128
+
+/*
+ * Symbol ids reserved at startup, after nil and the special forms (whose
+ * table ends with the empty symbol, 12), so that they can be used
+ * without looking up their names.
+ */
+#define SYM_NIL          0
+#define SYM_AMP          13
+#define SYM_SYMBOL       14
+#define SYM_INTEGER      15
+#define SYM_FLOAT        16
+#define SYM_RATIONAL     17
+#define SYM_BOOLEAN      18
+#define SYM_STRING       19
+#define SYM_CONS         20
+#define SYM_REGEX        21
+#define SYM_FUNCTION     22
+#define SYM_VECTOR       23
+#define SYM_HASH         24
+
 struct Stu;
 
 extern long Symtab_get_id(struct Stu *, const char *);
 extern char *Symtab_get_name(struct Stu *, long);
 extern void Symtab_init(struct Stu *);
+extern void Symtab_register_symbols(struct Stu *);
 extern void Symtab_destroy(struct Stu *);
 
 #endif
@@ -23,22 +23,38 @@
 #include "try.h"
 #include "sv.h"
 #include "gc.h"
+#include "special_form.h"
+
+typedef Sv *(*Try_eval_f)(Stu *stu, Env *env, void *x, Env **updated);
 
 static Sv
-*try(Stu *stu, Env *env, Sv *to_eval, Sv *(*catch)(Stu *stu, Sv *e, Env *env, void *arg),
-     void *catch_arg, Sv *(*eval)(Stu *stu, Env *env, Sv *x, Env **updated), Env **updated)
+*try(Stu *stu, Env *env, void *to_eval, Sv *(*catch)(Stu *stu, Sv *e, Env *env, void *arg),
+     void *catch_arg, Try_eval_f eval, Env **updated)
 {
     Sv *result = NIL;
     int jmp_res = 0;
     jmp_buf curr_marker;
+    Env *capture_tail, *capture_head;
 
     volatile int try_scope_stack_pos = Gc_scope_stack_size(stu);
+    volatile long try_vm_sp = stu->vm_sp, try_vm_fp = stu->vm_fp;
+    volatile long try_call_stack_depth = stu->call_stack_depth;
     jmp_buf *prev_marker = stu->last_try_marker;
     stu->last_try_marker = &curr_marker;
+    Env_capture_save(stu, &capture_tail, &capture_head);
 
     if ((jmp_res = setjmp(curr_marker)) == 0) {
         result = eval(stu, env, to_eval, updated);
     } else {
+        /*
+         * Discard the virtual machine frames, call stack entries and
+         * captured bindings of everything between the try and the throw.
+         */
+        stu->vm_sp = try_vm_sp;
+        stu->vm_fp = try_vm_fp;
+        stu->call_stack_depth = try_call_stack_depth;
+        Env_capture_restore(stu, capture_tail, capture_head);
+
         /*
          * We have "caught" an exception, so invoke the supplied catch
          * routine with the exception as an argument.
@@ -52,11 +68,7 @@ static Sv
          * and the throw, and let the garbage collector re-claim the
          * objects.
          */
-        int curr_scope_stack_pos = Gc_scope_stack_size(stu);
-        int to_unwind = curr_scope_stack_pos - try_scope_stack_pos;
-        for (int i = to_unwind; i > 0; i--) {
-            POP_SCOPE(stu);
-        }
+        Gc_scope_restore(stu, try_scope_stack_pos);
 
         /*
          * Sv_eval saves the result in the parent scope for us, however
@@ -86,7 +98,7 @@ static Sv
     Sv *handler = Sv_cons(
         stu, catch_lambda, Sv_cons(
             stu, Sv_cons(
-                stu, Sv_new_sym(stu, "quote"), Sv_cons(
+                stu, Sv_new_sym_from_id(stu, SPECIAL_FORM_QUOTE), Sv_cons(
                     stu, exception, NIL)), NIL));
     return Sv_eval(stu, env, handler);
 }
@@ -94,7 +106,7 @@ static Sv
 extern Sv
 *Try_eval_stu_catch(Stu *stu, Env *env, Sv *args)
 {
-    if (args->type != SV_CONS)
+    if (SV_TYPE(args) != SV_CONS)
         return Sv_new_err(stu, "'try' args is not a cons");
 
     Sv *to_eval = CAR(args);
@@ -105,11 +117,30 @@ extern Sv
 }
 
 static inline Sv
-*eval_ignore_updated_env(Stu *stu, Env *env, Sv *x, Env **updated)
+*eval_ignore_updated_env(Stu *stu, Env *env, void *x, Env **updated)
 {
     return Sv_eval(stu, env, x);
 }
 
+static inline Sv
+*eval_list(Stu *stu, Env *env, void *x, Env **updated)
+{
+    return Sv_eval_list(stu, env, x, updated);
+}
+
+/* Temporarily holds the callback passed to Try_run. */
+typedef struct Try_runner {
+    Sv *(*run)(Stu *, Env *, void *);
+    void *arg;
+} Try_runner;
+
+static inline Sv
+*run_ignore_updated_env(Stu *stu, Env *env, void *x, Env **updated)
+{
+    Try_runner *runner = x;
+    return runner->run(stu, env, runner->arg);
+}
+
 extern Sv
 *Try_eval(Stu *stu, Env *env, Sv *to_eval, Sv *(*catch)(Stu *, Sv *, Env *, void *), void *catch_arg)
 {
@@ -120,7 +151,15 @@ extern Sv
 *Try_eval_list(Stu *stu, Env *env, Sv *to_eval, Sv *(*catch)(Stu *, Sv *, Env *, void *),
                void *catch_arg, Env **updated)
 {
-    return try(stu, env, to_eval, catch, catch_arg, Sv_eval_list, updated);
+    return try(stu, env, to_eval, catch, catch_arg, eval_list, updated);
+}
+
+extern Sv
+*Try_run(Stu *stu, Env *env, Sv *(*run)(Stu *, Env *, void *), void *run_arg,
+         Sv *(*catch)(Stu *, Sv *, Env *, void *), void *catch_arg)
+{
+    Try_runner runner = { run, run_arg };
+    return try(stu, env, &runner, catch, catch_arg, run_ignore_updated_env, NULL);
 }
 
 extern Sv
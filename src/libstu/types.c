@@ -62,7 +62,7 @@ Type_new(Stu *stu, Sv *name, Sv *fields)
     Gc_lock(stu, (Gc *) name);
     Gc_lock(stu, (Gc *) fields);
     for (long i = 0; i < fields->val.vector->length; ++i)
-        Gc_lock(stu, (Gc *) fields->val.vector->values[i]);
+        Gc_lock(stu, (Gc *) Vector_at(fields->val.vector, i));
 
     long index = reg->size++;
     reg->name_symbol[index] = name;
@@ -80,7 +80,9 @@ extern Sv
 extern const char
 *Type_name_string(Stu *stu, Sv_type t)
 {
-    return Symtab_get_name(stu, Type_name_symbol(stu, t)->val.i);
+    Sv *name = Type_name_symbol(stu, t);
+
+    return Symtab_get_name(stu, SV_I(name));
 }
 
 extern Sv
@@ -93,9 +95,9 @@ extern long
 Type_field_index(Stu *stu, Sv_type t, Sv *field)
 {
     Sv_vector *vec = Type_field_vector(stu, t)->val.vector;
-    long sym_val = field->val.i;
+    long sym_val = SV_I(field);
     for (long i = 0; i < vec->length; ++i)
-        if (sym_val == vec->values[i]->val.i)
+        if (sym_val == SV_I(Vector_at(vec, i)))
             return i;
     return vec->length;
 }
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "alloc/alloc.h"
+#include "stu_private.h"
+#include "utils.h"
+#include "vector.h"
+
+/* The index of the first value in the tail. */
+#define TAIL_OFFSET(vec) \
+    ((vec)->length <= VECTOR_WIDTH ? 0 : (((vec)->length - 1) >> VECTOR_BITS) << VECTOR_BITS)
+
+static Sv_vector_node
+*node_new(Stu *stu, long size)
+{
+    size_t bytes = sizeof(Sv_vector_node) + size * sizeof(void *);
+    Sv_vector_node *node = Alloc_allocate_size(stu->payload_alloc, bytes);
+
+    memset(node, 0, bytes);
+    node->refs = 1;
+
+    return node;
+}
+
+/* Release a node level bits above the values, and its children. */
+static void
+node_release(Stu *stu, Sv_vector_node *node, int level)
+{
+    if (node == NULL || --node->refs > 0)
+        return;
+
+    if (level > 0)
+        for (int i = 0; i < VECTOR_WIDTH; i++)
+            node_release(stu, node->slots[i], level - VECTOR_BITS);
+    Alloc_release(stu->payload_alloc, node);
+}
+
+/* Copy the first size slots of a node into a new node of new_size. */
+static Sv_vector_node
+*node_copy(Stu *stu, Sv_vector_node *node, int level, long size, long new_size)
+{
+    Sv_vector_node *copy = node_new(stu, new_size), *child;
+
+    if (node != NULL) {
+        memcpy(copy->slots, node->slots, size * sizeof(void *));
+        if (level > 0)
+            for (long i = 0; i < size; i++)
+                if ((child = copy->slots[i]) != NULL)
+                    child->refs++;
+    }
+
+    return copy;
+}
+
+static Sv_vector
+*vector_new(Stu *stu, long length, int shift,
+            Sv_vector_node *root, Sv_vector_node *tail)
+{
+    Sv_vector *vec = Alloc_allocate_size(stu->payload_alloc, sizeof(*vec));
+
+    vec->length = length;
+    vec->shift = shift;
+    vec->root = root;
+    vec->tail = tail;
+
+    return vec;
+}
+
+/*
+ * Make a vector of length values, or of empty slots if values is NULL.
+ * The full leaves are made first, then each level above them until one
+ * node is left for the root.
+ */
+extern Sv_vector
+*Vector_new(Stu *stu, long length, struct Sv **values)
+{
+    Sv_vector *vec = vector_new(stu, length, VECTOR_BITS, NULL, NULL);
+    long offset = TAIL_OFFSET(vec), n = offset >> VECTOR_BITS, i;
+    Sv_vector_node **nodes = NULL, *node = NULL, *child;
+
+    if (length > 0) {
+        vec->tail = node_new(stu, length - offset);
+        if (values)
+            memcpy(vec->tail->slots, values + offset, (length - offset) * sizeof(void *));
+    }
+    if (n == 0)
+        return vec;
+
+    nodes = CHECKED_MALLOC(n * sizeof(*nodes));
+    for (i = 0; i < n; i++) {
+        nodes[i] = node_new(stu, VECTOR_WIDTH);
+        if (values)
+            memcpy(nodes[i]->slots, values + (i << VECTOR_BITS),
+                   VECTOR_WIDTH * sizeof(void *));
+    }
+
+    for (vec->shift = VECTOR_BITS;; vec->shift += VECTOR_BITS) {
+        for (i = 0; i < n; i++) {
+            child = nodes[i];
+            if ((i & VECTOR_MASK) == 0)
+                nodes[i >> VECTOR_BITS] = node = node_new(stu, VECTOR_WIDTH);
+            node->slots[i & VECTOR_MASK] = child;
+        }
+        n = (n + VECTOR_MASK) >> VECTOR_BITS;
+        if (n == 1)
+            break;
+    }
+    vec->root = nodes[0];
+    free(nodes);
+
+    return vec;
+}
+
+/* Make another vector with the same values, sharing all of its nodes. */
+extern Sv_vector
+*Vector_share(Stu *stu, Sv_vector *vec)
+{
+    if (vec->root)
+        vec->root->refs++;
+    if (vec->tail)
+        vec->tail->refs++;
+
+    return vector_new(stu, vec->length, vec->shift, vec->root, vec->tail);
+}
+
+extern void
+Vector_release(Stu *stu, Sv_vector *vec)
+{
+    node_release(stu, vec->root, vec->shift);
+    node_release(stu, vec->tail, 0);
+    Alloc_release(stu->payload_alloc, vec);
+}
+
+/* The leaf holding the value at index i, which must be in range. */
+static Sv_vector_node
+*leaf_for(Sv_vector *vec, long i)
+{
+    Sv_vector_node *node = vec->root;
+
+    if (i >= TAIL_OFFSET(vec))
+        return vec->tail;
+    for (int level = vec->shift; level > 0; level -= VECTOR_BITS)
+        node = node->slots[(i >> level) & VECTOR_MASK];
+
+    return node;
+}
+
+extern struct Sv
+*Vector_at(Sv_vector *vec, long i)
+{
+    long offset = TAIL_OFFSET(vec);
+
+    if (i >= offset)
+        return vec->tail->slots[i - offset];
+
+    return leaf_for(vec, i)->slots[i & VECTOR_MASK];
+}
+
+/*
+ * The values from index i to the end of its leaf, which are next to
+ * each other, storing how many there are in n. This is for walking a
+ * whole vector without a lookup per value. Values may only be stored
+ * through it in a vector just made by Vector_new.
+ */
+extern struct Sv
+**Vector_chunk(Sv_vector *vec, long i, long *n)
+{
+    long offset = TAIL_OFFSET(vec);
+
+    if (i >= offset) {
+        *n = vec->length - i;
+        return (struct Sv **) vec->tail->slots + (i - offset);
+    }
+    *n = VECTOR_WIDTH - (i & VECTOR_MASK);
+
+    return (struct Sv **) leaf_for(vec, i)->slots + (i & VECTOR_MASK);
+}
+
+/*
+ * Copy the path down to where a full tail goes as the last leaf of the
+ * trie below node, which may be missing, taking the copy of the tail.
+ */
+static Sv_vector_node
+*push_leaf(Stu *stu, Sv_vector_node *node, int level, long i, Sv_vector_node *leaf)
+{
+    Sv_vector_node *copy = node_copy(stu, node, level, VECTOR_WIDTH, VECTOR_WIDTH);
+    long sub = (i >> level) & VECTOR_MASK;
+
+    if (level == VECTOR_BITS) {
+        copy->slots[sub] = leaf;
+    } else {
+        node_release(stu, copy->slots[sub], level - VECTOR_BITS);
+        copy->slots[sub] = push_leaf(
+            stu, node ? node->slots[sub] : NULL, level - VECTOR_BITS, i, leaf);
+    }
+
+    return copy;
+}
+
+extern Sv_vector
+*Vector_push(Stu *stu, Sv_vector *vec, struct Sv *x)
+{
+    long offset = TAIL_OFFSET(vec), size = vec->length - offset;
+    Sv_vector_node *root = vec->root, *tail;
+    int shift = vec->shift;
+
+    if (vec->length == 0 || size < VECTOR_WIDTH) {
+        tail = node_copy(stu, vec->tail, 0, size, size + 1);
+        tail->slots[size] = x;
+        if (root)
+            root->refs++;
+        return vector_new(stu, vec->length + 1, shift, root, tail);
+    }
+
+    /* The tail is full, so it moves into the trie as it is. */
+    vec->tail->refs++;
+    if ((vec->length >> VECTOR_BITS) > (1L << shift)) {
+        root = node_new(stu, VECTOR_WIDTH);
+        root->slots[0] = vec->root;
+        vec->root->refs++;
+        shift += VECTOR_BITS;
+        root->slots[1] = push_leaf(stu, NULL, shift - VECTOR_BITS, offset, vec->tail);
+    } else {
+        root = push_leaf(stu, root, shift, offset, vec->tail);
+    }
+
+    tail = node_new(stu, 1);
+    tail->slots[0] = x;
+
+    return vector_new(stu, vec->length + 1, shift, root, tail);
+}
+
+/* Copy the path down to index i below node, storing x there. */
+static Sv_vector_node
+*set_value(Stu *stu, Sv_vector_node *node, int level, long i, struct Sv *x)
+{
+    Sv_vector_node *copy = node_copy(stu, node, level, VECTOR_WIDTH, VECTOR_WIDTH);
+    long sub = (i >> level) & VECTOR_MASK;
+
+    if (level == 0) {
+        copy->slots[sub] = x;
+    } else {
+        node_release(stu, copy->slots[sub], level - VECTOR_BITS);
+        copy->slots[sub] = set_value(stu, node->slots[sub], level - VECTOR_BITS, i, x);
+    }
+
+    return copy;
+}
+
+/* Make another vector with x at index i, which must be in range. */
+extern Sv_vector
+*Vector_set(Stu *stu, Sv_vector *vec, long i, struct Sv *x)
+{
+    long offset = TAIL_OFFSET(vec), size = vec->length - offset;
+    Sv_vector_node *root = vec->root, *tail = vec->tail;
+
+    if (i >= offset) {
+        tail = node_copy(stu, tail, 0, size, size);
+        tail->slots[i - offset] = x;
+        if (root)
+            root->refs++;
+    } else {
+        root = set_value(stu, root, vec->shift, i, x);
+        tail->refs++;
+    }
+
+    return vector_new(stu, vec->length, vec->shift, root, tail);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef VECTOR_DEFINED
+#define VECTOR_DEFINED
+
+#define VECTOR_BITS  5
+#define VECTOR_WIDTH (1 << VECTOR_BITS)
+#define VECTOR_MASK  (VECTOR_WIDTH - 1)
+
+struct Stu;
+struct Sv;
+
+/*
+ * A trie node, holding either child nodes or, at the bottom, values.
+ * Nodes are never changed once built, so versions of a vector share
+ * them; refs counts the vectors and nodes pointing at each one.
+ */
+typedef struct Sv_vector_node {
+    long refs;
+    void *slots[];
+} Sv_vector_node;
+
+/*
+ * A persistent vector. All but the last few values are in a trie of
+ * VECTOR_WIDTH way nodes whose root is shift bits above the values;
+ * the rest are in the tail, which has a slot for each. Appending and
+ * updating copy at most one node per level, sharing the others.
+ */
+typedef struct Sv_vector {
+    long length;
+    int shift;
+    Sv_vector_node *root;
+    Sv_vector_node *tail;
+} Sv_vector;
+
+extern Sv_vector *Vector_new(struct Stu *, long, struct Sv **);
+extern Sv_vector *Vector_share(struct Stu *, Sv_vector *);
+extern void Vector_release(struct Stu *, Sv_vector *);
+extern struct Sv *Vector_at(Sv_vector *, long);
+extern struct Sv **Vector_chunk(Sv_vector *, long, long *);
+extern Sv_vector *Vector_push(struct Stu *, Sv_vector *, struct Sv *);
+extern Sv_vector *Vector_set(struct Stu *, Sv_vector *, long, struct Sv *);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+
+#include "call_stack.h"
+#include "compile.h"
+#include "env.h"
+#include "gc.h"
+#include "native_func.h"
+#include "special_form.h"
+#include "stu_private.h"
+#include "sv.h"
+#include "try.h"
+#include "utils.h"
+#include "vm.h"
+
+#define VM_INITIAL_STACK  256
+#define VM_INITIAL_FRAMES 64
+
+#define FRAME (stu->vm_frames + stu->vm_fp - 1)
+#define TOP   (stu->vm_stack[stu->vm_sp - 1])
+#define FETCH (*pc++)
+
+/* Catch handler of a compiled try form. */
+typedef struct Vm_handler {
+    Code *code;
+    Sv *name;
+} Vm_handler;
+
+static inline void
+push(Stu *stu, Sv *x)
+{
+    if (stu->vm_sp == stu->vm_stack_size) {
+        stu->vm_stack_size = stu->vm_stack_size
+            ? stu->vm_stack_size * 2 : VM_INITIAL_STACK;
+        stu->vm_stack = CHECKED_REALLOC(
+            stu->vm_stack, stu->vm_stack_size * sizeof(*stu->vm_stack));
+    }
+    stu->vm_stack[stu->vm_sp++] = x;
+}
+
+static void
+push_frame(Stu *stu, Code *code, Env *env, int traced)
+{
+    Vm_frame *frame;
+
+    if (stu->vm_fp == stu->vm_frames_size) {
+        stu->vm_frames_size = stu->vm_frames_size
+            ? stu->vm_frames_size * 2 : VM_INITIAL_FRAMES;
+        stu->vm_frames = CHECKED_REALLOC(
+            stu->vm_frames, stu->vm_frames_size * sizeof(*stu->vm_frames));
+    }
+
+    frame = stu->vm_frames + stu->vm_fp++;
+    frame->code = code;
+    frame->env = env;
+    frame->pc = 0;
+    frame->base = stu->vm_sp;
+    frame->traced = traced;
+    frame->capture_tail = frame->capture_head = NULL;
+    if (code->body)
+        Env_capture_save(stu, &frame->capture_tail, &frame->capture_head);
+}
+
+/*
+ * Replace the current frame with a call to the lambda body code, bound
+ * in env. The caller's capture state is kept, and the call stack entry
+ * for name is made part of the frame being replaced.
+ */
+static void
+tail_frame(Stu *stu, Code *code, Env *env, Sv *name)
+{
+    Vm_frame *frame = FRAME;
+
+    if (frame->code->body) {
+        Env_capture_restore(stu, frame->capture_tail, frame->capture_head);
+    } else {
+        Env_capture_save(stu, &frame->capture_tail, &frame->capture_head);
+    }
+
+    frame->traced = Call_stack_push_tail(stu, name, frame->traced);
+    frame->code = code;
+    frame->env = env;
+    frame->pc = 0;
+    stu->vm_sp = frame->base;
+}
+
+static int
+is_callable(Sv *f)
+{
+    if (f)
+        switch (SV_TYPE(f)) {
+        case SV_NATIVE_FUNC:
+        case SV_NATIVE_CLOS:
+        case SV_LAMBDA:
+        case SV_STRUCTURE_CONSTRUCTOR:
+            return 1;
+        }
+
+    return 0;
+}
+
+/* Call anything callable with the arguments in argv. */
+static Sv
+*apply(Stu *stu, Env *env, Sv *f, int argc, Sv **argv)
+{
+    Env *call_env = NULL;
+    Sv *x = NIL;
+
+    switch (SV_TYPE(f)) {
+    case SV_LAMBDA:
+        if ((x = Sv_bind_argv(stu, f, argc, argv, &call_env)) != NULL)
+            return x;
+        return Vm_run(stu, call_env, Vm_code(stu, f));
+
+    case SV_NATIVE_FUNC:
+        return Sv_native_func_call_argv(stu, env, f->val.func, argc, argv);
+
+    case SV_NATIVE_CLOS:
+        return Sv_native_closure_call_argv(stu, env, f->val.clos, argc, argv);
+
+    default:
+        while (argc > 0)
+            x = Sv_cons(stu, argv[--argc], x);
+        return Sv_new_structure(stu, f->val.structure_constructor, x);
+    }
+}
+
+/*
+ * Look up sym for an OP_LOOKUP. The call frames on top of env are
+ * searched directly; past them the bindings only change along with the
+ * env version, so what is found there is cached against the first
+ * binding reached.
+ */
+static inline Sv
+*lookup(Stu *stu, Env *env, Sv *sym, Code *code, Code_cache *cache)
+{
+    Env *anchor = env;
+    Sv *x = NULL;
+    long id = SV_I(sym);
+
+    for (; anchor && anchor->size > 0; anchor = anchor->prev) {
+        for (int i = anchor->size - 1; i >= 0; i--) {
+            if (anchor->syms[i] == id)
+                return anchor->vals[i];
+        }
+    }
+
+    if (anchor && anchor == cache->anchor && cache->version == stu->env_version)
+        return cache->val;
+
+    /*
+     * If the symbol exists but it's value is NULL, then it is
+     * the empty list.
+     */
+    if ((x = Env_get(stu, anchor, sym)) != NULL) {
+        cache->anchor = anchor;
+        cache->val = x;
+        cache->version = stu->env_version;
+        GC_WRITE(stu, code, anchor);
+        GC_WRITE(stu, code, x);
+    } else if (!Env_exists(stu, anchor, sym)) {
+        PUSH_SCOPE(stu);
+        x = Sv_new_err(stu, "possibly unknown symbol");
+        POP_SCOPE(stu);
+    }
+
+    return x;
+}
+
+static Sv
+*run_code(Stu *stu, Env *env, void *code)
+{
+    return Vm_run(stu, env, code);
+}
+
+static Sv
+*catch_handler(Stu *stu, Sv *e, Env *env, void *arg)
+{
+    Vm_handler *handler = arg;
+    Sv *f = Vm_run(stu, env, handler->code), *x = NULL;
+
+    if (!is_callable(f))
+        return Sv_new_err(stu, "first element is not a function");
+
+    Call_stack_push(stu, handler->name ? handler->name : f);
+    x = apply(stu, env, f, 1, &e);
+    Call_stack_pop(stu);
+
+    return x;
+}
+
+static Sv
+*run(Stu *stu, long base)
+{
+    Code *code = NULL, *body = NULL;
+    Env *env = NULL, *call_env = NULL;
+    Sv *f = NULL, *x = NULL, *name = NULL;
+    Vm_handler handler;
+    const int *pc = NULL;
+    long i;
+    int op, n, k;
+
+resume:
+    code = FRAME->code;
+    env = FRAME->env;
+    pc = code->ops + FRAME->pc;
+
+    for (;;) {
+        switch (op = FETCH) {
+        case OP_CONST:
+            push(stu, code->consts[FETCH]);
+            break;
+
+        case OP_LOOKUP:
+            x = code->consts[FETCH];
+            push(stu, lookup(stu, env, x, code, code->caches + FETCH));
+            break;
+
+        case OP_LOCAL:
+            n = FETCH;
+            k = FETCH;
+            push(stu, Env_get_local(env, n, k, code->consts[FETCH]));
+            break;
+
+        case OP_POP:
+            stu->vm_sp--;
+            break;
+
+        case OP_RESET:
+            Env_capture_reset(stu);
+            break;
+
+        case OP_SEQ:
+            FRAME->env = env = Env_capture_rebase(stu, env);
+            Env_capture_reset(stu);
+            stu->vm_sp--;
+            break;
+
+        case OP_CALL:
+        case OP_TAILCALL:
+            n = FETCH;
+            k = FETCH;
+            i = stu->vm_sp - n - 1;
+            f = stu->vm_stack[i];
+
+            if (!is_callable(f)) {
+                PUSH_SCOPE(stu);
+                x = Sv_new_err(stu, "first element is not a function");
+                POP_SCOPE(stu);
+                stu->vm_sp = i;
+                push(stu, x);
+                break;
+            }
+
+            PUSH_SCOPE(stu);
+            stu->stats_calls++;
+            name = k >= 0 ? code->consts[k] : f;
+            if (SV_TYPE(f) == SV_LAMBDA
+                && (x = Sv_bind_argv(stu, f, n, stu->vm_stack + i + 1, &call_env)) == NULL)
+            {
+                if (op == OP_TAILCALL) {
+                    tail_frame(stu, Vm_code(stu, f), call_env, name);
+                } else {
+                    /* Run the body in a new frame. */
+                    Call_stack_push(stu, name);
+                    FRAME->pc = pc - code->ops;
+                    stu->vm_sp = i;
+                    push_frame(stu, Vm_code(stu, f), call_env, 1);
+                }
+                POP_SCOPE(stu);
+                goto resume;
+            } else if (SV_TYPE(f) != SV_LAMBDA) {
+                Call_stack_push(stu, name);
+                x = apply(stu, env, f, n, stu->vm_stack + i + 1);
+                Call_stack_pop(stu);
+            }
+            POP_SCOPE(stu);
+            stu->vm_sp = i;
+            push(stu, x);
+            break;
+
+        case OP_RETURN:
+            x = stu->vm_stack[--stu->vm_sp];
+            if (code->body)
+                Env_capture_restore(stu, FRAME->capture_tail, FRAME->capture_head);
+            while (FRAME->traced-- > 0)
+                Call_stack_pop(stu);
+            stu->vm_sp = FRAME->base;
+            if (--stu->vm_fp == base)
+                return x;
+            push(stu, x);
+            goto resume;
+
+        case OP_JUMP:
+            pc = code->ops + pc[0];
+            break;
+
+        case OP_BRANCH:
+            x = stu->vm_stack[--stu->vm_sp];
+            if (!x || SV_TYPE(x) != SV_BOOL) {
+                PUSH_SCOPE(stu);
+                x = Sv_new_err(stu, "'if' condition must evaluate to a bool");
+                POP_SCOPE(stu);
+                push(stu, x);
+                pc = code->ops + pc[1];
+            } else if (!SV_I(x)) {
+                pc = code->ops + pc[0];
+            } else {
+                pc += 2;
+            }
+            break;
+
+        case OP_LAMBDA:
+            x = code->consts[FETCH];
+            PUSH_SCOPE(stu);
+            f = Sv_new_lambda(stu, env, x->val.ufunc->formals, x->val.ufunc->body);
+            f->val.ufunc->proto = x;
+            f->val.ufunc->code = x->val.ufunc->code;
+            POP_SCOPE(stu);
+            push(stu, f);
+            break;
+
+        case OP_DEF:
+            x = code->consts[FETCH];
+            PUSH_SCOPE(stu);
+            f = Special_form_bind_def(stu, x, TOP);
+            POP_SCOPE(stu);
+            TOP = f;
+            break;
+
+        case OP_SPECIAL:
+            x = code->consts[FETCH];
+            PUSH_SCOPE(stu);
+            Call_stack_push(stu, CAR(x));
+            f = Special_form_get_f(stu, CAR(x))(stu, env, CDR(x));
+            Call_stack_pop(stu);
+            POP_SCOPE(stu);
+            push(stu, f);
+            break;
+
+        case OP_EVAL:
+            x = code->consts[FETCH];
+            PUSH_SCOPE(stu);
+            switch (SV_TYPE(x)) {
+            case SV_CONS:
+                f = Sv_eval_sexp(stu, env, x);
+                break;
+
+            case SV_SPECIAL:
+                f = Sv_eval_special(stu, env, x);
+                break;
+
+            default:
+                f = Sv_eval(stu, env, x);
+                break;
+            }
+            POP_SCOPE(stu);
+            push(stu, f);
+            break;
+
+        case OP_VECTOR:
+            n = FETCH;
+            PUSH_SCOPE(stu);
+            x = Sv_new_vector_from_array(stu, n, stu->vm_stack + stu->vm_sp - n);
+            POP_SCOPE(stu);
+            stu->vm_sp -= n;
+            push(stu, x);
+            break;
+
+        case OP_FIELD:
+            x = code->consts[FETCH];
+            f = TOP;
+            if (!IS_NIL(f) && SV_TYPE(f) != SV_ERR)
+                TOP = f->val.structure[Type_field_index(stu, SV_TYPE(f), x)];
+            break;
+
+        case OP_TRY:
+            body = code->codes[FETCH];
+            handler.code = code->codes[FETCH];
+            handler.name = (k = FETCH) >= 0 ? code->consts[k] : NULL;
+            PUSH_SCOPE(stu);
+            x = Try_run(stu, env, run_code, body, catch_handler, &handler);
+            POP_SCOPE(stu);
+            push(stu, x);
+            break;
+
+        case OP_FRAME_PUSH:
+            PUSH_SCOPE(stu);
+            Call_stack_push(stu, code->consts[FETCH]);
+            POP_SCOPE(stu);
+            break;
+
+        case OP_FRAME_POP:
+            Call_stack_pop(stu);
+            break;
+        }
+    }
+
+    /* Not reached. */
+    return NIL;
+}
+
+extern void
+Vm_destroy(Stu *stu)
+{
+    free(stu->vm_stack);
+    free(stu->vm_frames);
+    stu->vm_stack = NULL;
+    stu->vm_frames = NULL;
+    stu->vm_sp = stu->vm_stack_size = 0;
+    stu->vm_fp = stu->vm_frames_size = 0;
+}
+
+extern void
+Vm_visit_roots(Stu *stu, void (*action)(Stu *, Gc *))
+{
+    for (long i = 0; i < stu->vm_sp; i++)
+        action(stu, (Gc *) stu->vm_stack[i]);
+
+    for (long i = 0; i < stu->vm_fp; i++) {
+        action(stu, (Gc *) stu->vm_frames[i].code);
+        action(stu, (Gc *) stu->vm_frames[i].env);
+        action(stu, (Gc *) stu->vm_frames[i].capture_head);
+    }
+}
+
+/*
+ * Fetch the compiled body of a lambda, compiling it on first use. The
+ * result is shared with every closure made from the same lambda form,
+ * and is recompiled if any macros have been (re)defined since.
+ */
+extern Code
+*Vm_code(Stu *stu, Sv *f)
+{
+    Sv_ufunc *ufunc = f->val.ufunc;
+    Sv_ufunc *proto = ufunc->proto ? ufunc->proto->val.ufunc : ufunc;
+    Code *code = ufunc->code;
+
+    if (code == NULL || code->epoch != stu->macro_epoch) {
+        code = proto->code;
+        if (code == NULL || code->epoch != stu->macro_epoch) {
+            code = Compile_body(
+                stu, ufunc->body, Sv_cons(stu, ufunc->formals, proto->scope));
+            proto->code = code;
+            GC_WRITE(stu, ufunc->proto ? ufunc->proto : f, code);
+        }
+        ufunc->code = code;
+        GC_WRITE(stu, f, code);
+    }
+
+    return code;
+}
+
+extern Sv
+*Vm_run(Stu *stu, Env *env, Code *code)
+{
+    Sv *x = NULL;
+    long base = stu->vm_fp;
+
+    push_frame(stu, code, env, 0);
+    x = run(stu, base);
+    SCOPE_SAVE(stu, x);
+
+    return x;
+}
+
+extern Sv
+*Vm_eval(Stu *stu, Env *env, Sv *x)
+{
+    Sv *y = NULL;
+
+    PUSH_SCOPE(stu);
+    y = Vm_run(stu, env, Compile_expr(stu, x));
+    POP_N_SAVE(stu, y);
+
+    return y;
+}
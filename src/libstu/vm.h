@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2018 Mikey Austin <mikey@jackiemclean.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef VM_DEFINED
+#define VM_DEFINED
+
+#include "gc.h"
+
+/* Forward declarations. */
+struct Stu;
+struct Env;
+struct Sv;
+struct Code;
+
+/* An activation record of a running code object. */
+typedef struct Vm_frame {
+    struct Code *code;
+    struct Env *env;
+    int pc;
+    long base;
+
+    /* Number of call stack entries to pop on return. */
+    int traced;
+
+    /* Capture state of the caller, restored on return. */
+    struct Env *capture_tail;
+    struct Env *capture_head;
+} Vm_frame;
+
+extern void Vm_destroy(struct Stu *);
+extern void Vm_visit_roots(struct Stu *, void (*)(struct Stu *, Gc *));
+extern struct Code *Vm_code(struct Stu *, struct Sv *);
+extern struct Sv *Vm_run(struct Stu *, struct Env *, struct Code *);
+extern struct Sv *Vm_eval(struct Stu *, struct Env *, struct Sv *);
+
+#endif
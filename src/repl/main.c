@@ -14,6 +14,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -24,18 +25,33 @@
 
 #include "prompt.h"
 
+#define OPTIONS "rl:f:dL:ti:o:C:p:"
+
 extern char *optarg;
 extern int optind, opterr, optopt;
 
 int
 main(int argc, char **argv)
 {
-    char *input = NULL;
-    int option = 0, repl = 0, files = 0, debug = 0;
+    char *input = NULL, *image = NULL, *profile = NULL;
+    int option = 0, repl = 0, files = 0, debug = 0, status = 0;
     StuVal *result = NULL;
-    Stu *stu = Stu_new();
+    Stu *stu = NULL;
+    FILE *out;
+
+    /* An image replaces the usual startup, so is found before the rest. */
+    opterr = 0;
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+        if (option == 'i')
+            image = optarg;
+    }
+    opterr = 1;
+    optind = 1;
+
+    if ((stu = image ? Stu_new_from_image(image) : Stu_new()) == NULL)
+        return 1;
 
-    while ((option = getopt(argc, argv, "rl:f:dL:")) != -1) {
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
         switch (option) {
         case 'f':
             files = 1;
@@ -47,14 +63,25 @@ main(int argc, char **argv)
 
         case 'l':
             files = 1;
-            result = Stu_eval_file(stu, optarg);
-            Stu_release_val(stu, result);
+            Stu_load_file(stu, optarg);
             break;
 
         case 'L':
             Stu_add_include_path(stu, optarg);
             break;
 
+        case 'C':
+            Stu_set_module_cache(stu, optarg);
+            break;
+
+        case 'p':
+            profile = optarg;
+            if (Stu_profile_start(stu, 0) != 0) {
+                warnx("could not start the profiler");
+                status = 1;
+            }
+            break;
+
         case 'r':
             repl = 1;
             break;
@@ -62,6 +89,16 @@ main(int argc, char **argv)
         case 'd':
             debug = 1;
             break;
+
+        case 't':
+            Stu_set_eval_mode(stu, STU_EVAL_TREE);
+            break;
+
+        case 'o':
+            files = 1;
+            if (Stu_save_image(stu, optarg) != 0)
+                status = 1;
+            break;
         }
     }
 
@@ -93,9 +130,19 @@ main(int argc, char **argv)
         Prompt_finish();
     }
 
+    if (profile) {
+        if ((out = fopen(profile, "w")) == NULL) {
+            warn("%s", profile);
+            status = 1;
+        }
+        Stu_profile_stop(stu, out);
+        if (out)
+            fclose(out);
+    }
+
     if (debug)
         Stu_dump_stats(stu, stderr);
     Stu_destroy(&stu);
 
-    return 0;
+    return status;
 }